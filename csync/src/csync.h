@@ -312,6 +312,16 @@ typedef int (*csync_vio_stat_hook) (csync_vio_handle_t *dhhandle,
 typedef const char* (*csync_checksum_hook) (
         const char *path, uint32_t checksumTypeId, void *userdata);
 
+/*
+ * Lend csync the open connection of the journal of the application instead
+ * of letting it open one of its own. The acquire hook locks the connection
+ * for csync and returns it, or NULL if the journal can't be opened; every
+ * acquire is followed by a release, also when it returned NULL.
+ */
+struct sqlite3;
+typedef struct sqlite3* (*csync_statedb_acquire_hook) (void *userdata);
+typedef void (*csync_statedb_release_hook) (void *userdata);
+
 /**
  * @brief Allocate a csync context.
  *
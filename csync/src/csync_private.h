@@ -101,6 +101,11 @@ struct csync_s {
       csync_checksum_hook checksum_hook;
       void *checksum_userdata;
 
+      /* hooks for reading the statedb through the connection of the application */
+      csync_statedb_acquire_hook statedb_acquire_hook;
+      csync_statedb_release_hook statedb_release_hook;
+      void *statedb_userdata;
+
   } callbacks;
   c_strlist_t *excludes;
 
@@ -55,7 +55,15 @@
 #define SQLTM_TIME 150
 #define SQLTM_COUNT 10
 
-#define SQLITE_BUSY_HANDLED(F) if(1) { \
+/*
+ * Retries a statement on csync's own connection while another process
+ * writes. The connection of the statedb hooks is used with the
+ * application's lock held and has its own busy handler, so it is not
+ * retried here.
+ */
+#define SQLITE_BUSY_HANDLED(CTX, F) if((CTX)->callbacks.statedb_acquire_hook) { \
+    rc = F; \
+  } else { \
     int n = 0; \
     do { rc = F ; \
       if( (rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED) ) { \
@@ -120,6 +128,48 @@ static void sqlite_profile( void *x, const char* sql, sqlite3_uint64 time)
 }
 #endif
 
+static void _csync_statedb_finalize(CSYNC *ctx) {
+  if( ctx->statedb.by_fileid_stmt ) {
+      sqlite3_finalize(ctx->statedb.by_fileid_stmt);
+      ctx->statedb.by_fileid_stmt = NULL;
+  }
+  if( ctx->statedb.by_hash_stmt ) {
+      sqlite3_finalize(ctx->statedb.by_hash_stmt);
+      ctx->statedb.by_hash_stmt = NULL;
+  }
+  if( ctx->statedb.by_inode_stmt) {
+      sqlite3_finalize(ctx->statedb.by_inode_stmt);
+      ctx->statedb.by_inode_stmt = NULL;
+  }
+}
+
+/*
+ * The connection for the next statements. With the statedb hooks it is the
+ * one of the application, locked until _csync_statedb_release, otherwise the
+ * one csync_statedb_load opened.
+ */
+static sqlite3 *_csync_statedb_acquire(CSYNC *ctx) {
+  sqlite3 *db;
+
+  if (!ctx->callbacks.statedb_acquire_hook) {
+      return ctx->statedb.db;
+  }
+
+  db = ctx->callbacks.statedb_acquire_hook(ctx->callbacks.statedb_userdata);
+  if (db != ctx->statedb.db) {
+      /* The application reopened its database: the statements are of the old one */
+      _csync_statedb_finalize(ctx);
+      ctx->statedb.db = db;
+  }
+  return db;
+}
+
+static void _csync_statedb_release(CSYNC *ctx) {
+  if (ctx->callbacks.statedb_release_hook) {
+      ctx->callbacks.statedb_release_hook(ctx->callbacks.statedb_userdata);
+  }
+}
+
 int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb) {
   int rc = -1;
   c_strlist_t *result = NULL;
@@ -137,6 +187,20 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb) {
 
   ctx->statedb.lastReturnValue = SQLITE_OK;
 
+  /* The application checked and set up its connection already */
+  if (ctx->callbacks.statedb_acquire_hook) {
+      db = _csync_statedb_acquire(ctx);
+      if (db == NULL) {
+          _csync_statedb_release(ctx);
+          CSYNC_LOG(CSYNC_LOG_PRIORITY_NOTICE, "ERR: The statedb of the application is not available");
+          ctx->status_code = CSYNC_STATUS_STATEDB_LOAD_ERROR;
+          return -1;
+      }
+      csync_set_statedb_exists(ctx, !_csync_statedb_is_empty(db));
+      _csync_statedb_release(ctx);
+      return 0;
+  }
+
   /* Openthe database */
   if (sqlite_open(statedb, &db) != SQLITE_OK) {
     const char *errmsg= sqlite3_errmsg(ctx->statedb.db);
@@ -201,21 +265,21 @@ int csync_statedb_close(CSYNC *ctx) {
       return -1;
   }
 
-  /* deallocate query resources */
-  if( ctx->statedb.by_fileid_stmt ) {
-      sqlite3_finalize(ctx->statedb.by_fileid_stmt);
-      ctx->statedb.by_fileid_stmt = NULL;
-  }
-  if( ctx->statedb.by_hash_stmt ) {
-      sqlite3_finalize(ctx->statedb.by_hash_stmt);
-      ctx->statedb.by_hash_stmt = NULL;
-  }
-  if( ctx->statedb.by_inode_stmt) {
-      sqlite3_finalize(ctx->statedb.by_inode_stmt);
-      ctx->statedb.by_inode_stmt = NULL;
+  ctx->statedb.lastReturnValue = SQLITE_OK;
+
+  /* The connection stays open, it belongs to the application */
+  if (ctx->callbacks.statedb_acquire_hook) {
+      if (ctx->statedb.db) {
+          _csync_statedb_acquire(ctx);
+          _csync_statedb_finalize(ctx);
+          _csync_statedb_release(ctx);
+      }
+      ctx->statedb.db = 0;
+      return rc;
   }
 
-  ctx->statedb.lastReturnValue = SQLITE_OK;
+  /* deallocate query resources */
+  _csync_statedb_finalize(ctx);
 
   int sr = sqlite3_close(ctx->statedb.db);
   CSYNC_LOG(CSYNC_LOG_PRIORITY_NOTICE, "sqlite3_close=%d", sr);
@@ -231,7 +295,7 @@ int csync_statedb_close(CSYNC *ctx) {
 // structure which it is also allocating.
 // Note that this function calls laso sqlite3_step to actually get the info from db and
 // returns the sqlite return type.
-static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3_stmt *stmt )
+static int _csync_file_stat_from_metadata_table( CSYNC *ctx, csync_file_stat_t **st, sqlite3_stmt *stmt )
 {
     int rc = SQLITE_ERROR;
     int column_count;
@@ -244,7 +308,7 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
 
     column_count = sqlite3_column_count(stmt);
 
-    SQLITE_BUSY_HANDLED( sqlite3_step(stmt) );
+    SQLITE_BUSY_HANDLED( ctx, sqlite3_step(stmt) );
 
     if( rc == SQLITE_ROW ) {
         if(column_count > 7) {
@@ -301,21 +365,17 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
     return rc;
 }
 
-/* caller must free the memory */
-csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
-                                                  uint64_t phash)
+static csync_file_stat_t *_csync_statedb_get_stat_by_hash(CSYNC *ctx,
+                                                         sqlite3 *db,
+                                                         uint64_t phash)
 {
   csync_file_stat_t *st = NULL;
   int rc;
 
-  if( !ctx || ctx->db_is_empty ) {
-      return NULL;
-  }
-
   if( ctx->statedb.by_hash_stmt == NULL ) {
       const char *hash_query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE phash=?1";
 
-      SQLITE_BUSY_HANDLED(sqlite3_prepare_v2(ctx->statedb.db, hash_query, strlen(hash_query), &ctx->statedb.by_hash_stmt, NULL));
+      SQLITE_BUSY_HANDLED(ctx, sqlite3_prepare_v2(db, hash_query, strlen(hash_query), &ctx->statedb.by_hash_stmt, NULL));
       ctx->statedb.lastReturnValue = rc;
       if( rc != SQLITE_OK ) {
           CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Unable to create stmt for hash query.");
@@ -329,7 +389,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
 
   sqlite3_bind_int64(ctx->statedb.by_hash_stmt, 1, (long long signed int)phash);
 
-  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_hash_stmt);
+  rc = _csync_file_stat_from_metadata_table(ctx, &st, ctx->statedb.by_hash_stmt);
   ctx->statedb.lastReturnValue = rc;
   if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) )  {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata: %d!", rc);
@@ -339,26 +399,35 @@ csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
   return st;
 }
 
-csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
-                                                      const char *file_id ) {
-    csync_file_stat_t *st = NULL;
-    int rc = 0;
+/* caller must free the memory */
+csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
+                                                  uint64_t phash)
+{
+  csync_file_stat_t *st = NULL;
+  sqlite3 *db;
 
-    if (!file_id) {
-        return 0;
-    }
-    if (c_streq(file_id, "")) {
-        return 0;
-    }
+  if( !ctx || ctx->db_is_empty ) {
+      return NULL;
+  }
 
-    if( !ctx || ctx->db_is_empty ) {
-        return NULL;
-    }
+  db = _csync_statedb_acquire(ctx);
+  if (db) {
+      st = _csync_statedb_get_stat_by_hash(ctx, db, phash);
+  }
+  _csync_statedb_release(ctx);
+  return st;
+}
+
+static csync_file_stat_t *_csync_statedb_get_stat_by_file_id(CSYNC *ctx,
+                                                            sqlite3 *db,
+                                                            const char *file_id ) {
+    csync_file_stat_t *st = NULL;
+    int rc = 0;
 
     if( ctx->statedb.by_fileid_stmt == NULL ) {
         const char *query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE fileid=?1";
 
-        SQLITE_BUSY_HANDLED(sqlite3_prepare_v2(ctx->statedb.db, query, strlen(query), &ctx->statedb.by_fileid_stmt, NULL));
+        SQLITE_BUSY_HANDLED(ctx, sqlite3_prepare_v2(db, query, strlen(query), &ctx->statedb.by_fileid_stmt, NULL));
         ctx->statedb.lastReturnValue = rc;
         if( rc != SQLITE_OK ) {
             CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Unable to create stmt for file id query.");
@@ -369,7 +438,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
     /* bind the query value */
     sqlite3_bind_text(ctx->statedb.by_fileid_stmt, 1, file_id, -1, SQLITE_STATIC);
 
-    rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_fileid_stmt);
+    rc = _csync_file_stat_from_metadata_table(ctx, &st, ctx->statedb.by_fileid_stmt);
     ctx->statedb.lastReturnValue = rc;
     if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) ) {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata: %d!", rc);
@@ -380,25 +449,41 @@ csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
     return st;
 }
 
-/* caller must free the memory */
-csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
-                                                  uint64_t inode)
+csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
+                                                      const char *file_id ) {
+    csync_file_stat_t *st = NULL;
+    sqlite3 *db;
+
+    if (!file_id) {
+        return 0;
+    }
+    if (c_streq(file_id, "")) {
+        return 0;
+    }
+
+    if( !ctx || ctx->db_is_empty ) {
+        return NULL;
+    }
+
+    db = _csync_statedb_acquire(ctx);
+    if (db) {
+        st = _csync_statedb_get_stat_by_file_id(ctx, db, file_id);
+    }
+    _csync_statedb_release(ctx);
+    return st;
+}
+
+static csync_file_stat_t *_csync_statedb_get_stat_by_inode(CSYNC *ctx,
+                                                          sqlite3 *db,
+                                                          uint64_t inode)
 {
   csync_file_stat_t *st = NULL;
   int rc;
 
-  if (!inode) {
-      return NULL;
-  }
-
-  if( !ctx || ctx->db_is_empty ) {
-      return NULL;
-  }
-
   if( ctx->statedb.by_inode_stmt == NULL ) {
       const char *inode_query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE inode=?1";
 
-      SQLITE_BUSY_HANDLED(sqlite3_prepare_v2(ctx->statedb.db, inode_query, strlen(inode_query), &ctx->statedb.by_inode_stmt, NULL));
+      SQLITE_BUSY_HANDLED(ctx, sqlite3_prepare_v2(db, inode_query, strlen(inode_query), &ctx->statedb.by_inode_stmt, NULL));
       ctx->statedb.lastReturnValue = rc;
       if( rc != SQLITE_OK ) {
           CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Unable to create stmt for inode query.");
@@ -412,7 +497,7 @@ csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
 
   sqlite3_bind_int64(ctx->statedb.by_inode_stmt, 1, (long long signed int)inode);
 
-  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_inode_stmt);
+  rc = _csync_file_stat_from_metadata_table(ctx, &st, ctx->statedb.by_inode_stmt);
   ctx->statedb.lastReturnValue = rc;
   if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) ) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata by inode: %d!", rc);
@@ -422,25 +507,40 @@ csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
   return st;
 }
 
-int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
+/* caller must free the memory */
+csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
+                                                  uint64_t inode)
+{
+  csync_file_stat_t *st = NULL;
+  sqlite3 *db;
+
+  if (!inode) {
+      return NULL;
+  }
+
+  if( !ctx || ctx->db_is_empty ) {
+      return NULL;
+  }
+
+  db = _csync_statedb_acquire(ctx);
+  if (db) {
+      st = _csync_statedb_get_stat_by_inode(ctx, db, inode);
+  }
+  _csync_statedb_release(ctx);
+  return st;
+}
+
+static int _csync_statedb_get_below_path( CSYNC *ctx, sqlite3 *db, const char *path ) {
     int rc;
     sqlite3_stmt *stmt = NULL;
     int64_t cnt = 0;
 
-    if( !path ) {
-        return -1;
-    }
-
-    if( !ctx || ctx->db_is_empty ) {
-        return -1;
-    }
-
     /*  Select the entries for anything that starts with  (path+'/')
      * In other words, anything that is between  path+'/' and path+'0',
      * (because '0' follows '/' in ascii)
      */
     const char *below_path_query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE path > (?||'/') AND path < (?||'0')";
-    SQLITE_BUSY_HANDLED(sqlite3_prepare_v2(ctx->statedb.db, below_path_query, -1, &stmt, NULL));
+    SQLITE_BUSY_HANDLED(ctx, sqlite3_prepare_v2(db, below_path_query, -1, &stmt, NULL));
     ctx->statedb.lastReturnValue = rc;
     if( rc != SQLITE_OK ) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Unable to create stmt for below path query.");
@@ -460,7 +560,7 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
     do {
         csync_file_stat_t *st = NULL;
 
-        rc = _csync_file_stat_from_metadata_table( &st, stmt);
+        rc = _csync_file_stat_from_metadata_table( ctx, &st, stmt);
         if( st ) {
             /* Check for exclusion from the tree.
              * Note that this is only a safety net in case the ignore list changes
@@ -499,6 +599,26 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
     return 0;
 }
 
+int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
+    int rc = -1;
+    sqlite3 *db;
+
+    if( !path ) {
+        return -1;
+    }
+
+    if( !ctx || ctx->db_is_empty ) {
+        return -1;
+    }
+
+    db = _csync_statedb_acquire(ctx);
+    if (db) {
+        rc = _csync_statedb_get_below_path(ctx, db, path);
+    }
+    _csync_statedb_release(ctx);
+    return rc;
+}
+
 /* query the statedb, caller must free the memory */
 c_strlist_t *csync_statedb_query(sqlite3 *db,
                                  const char *statement) {
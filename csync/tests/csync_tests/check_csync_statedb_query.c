@@ -208,6 +208,77 @@ static void check_csync_statedb_get_stat_by_inode_not_found(void **state)
     assert_null(tmp);
 }
 
+struct shared_db {
+    sqlite3 *db;
+    int acquired;
+    int released;
+};
+
+static sqlite3 *shared_db_acquire(void *userdata)
+{
+    struct shared_db *shared = userdata;
+    shared->acquired++;
+    return shared->db;
+}
+
+static void shared_db_release(void *userdata)
+{
+    struct shared_db *shared = userdata;
+    shared->released++;
+}
+
+static void check_csync_statedb_shared_connection(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *tmp;
+    struct shared_db shared;
+    int rc;
+
+    /* Reopen through the connection of the "application" */
+    rc = csync_statedb_close(csync);
+    assert_int_equal(rc, 0);
+
+    shared.acquired = 0;
+    shared.released = 0;
+    rc = sqlite3_open_v2(TESTDB, &shared.db, SQLITE_OPEN_READWRITE, NULL);
+    assert_int_equal(rc, SQLITE_OK);
+    rc = sqlite3_exec(shared.db,
+                      "ALTER TABLE metadata ADD COLUMN fileid VARCHAR(128);"
+                      "ALTER TABLE metadata ADD COLUMN remotePerm VARCHAR(128);"
+                      "ALTER TABLE metadata ADD COLUMN filesize BIGINT;"
+                      "ALTER TABLE metadata ADD COLUMN ignoredChildrenRemote INT;"
+                      "ALTER TABLE metadata ADD COLUMN contentChecksum TEXT;"
+                      "ALTER TABLE metadata ADD COLUMN contentChecksumTypeId INTEGER;",
+                      NULL, NULL, NULL);
+    assert_int_equal(rc, SQLITE_OK);
+    csync->callbacks.statedb_acquire_hook = shared_db_acquire;
+    csync->callbacks.statedb_release_hook = shared_db_release;
+    csync->callbacks.statedb_userdata = &shared;
+
+    rc = csync_statedb_load(csync, TESTDB, &csync->statedb.db);
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync_get_statedb_exists(csync), 1);
+
+    tmp = csync_statedb_get_stat_by_hash(csync, (uint64_t) 42);
+    assert_non_null(tmp);
+    assert_string_equal(tmp->path, "Its funny stuff");
+    csync_file_stat_free(tmp);
+
+    tmp = csync_statedb_get_stat_by_inode(csync, (ino_t) 666);
+    assert_null(tmp);
+
+    rc = csync_statedb_close(csync);
+    assert_int_equal(rc, 0);
+    assert_null(csync->statedb.db);
+    assert_int_equal(shared.acquired, shared.released);
+    assert_true(shared.acquired >= 3);
+
+    /* The connection stays open and has no statements left */
+    assert_null(sqlite3_next_stmt(shared.db, NULL));
+    rc = sqlite3_close(shared.db);
+    assert_int_equal(rc, SQLITE_OK);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
@@ -217,6 +288,7 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_statedb_write, setup, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_hash_not_found, setup_db, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_inode_not_found, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_shared_connection, setup_db, teardown),
     };
 
     return run_tests(tests);
@@ -32,6 +32,7 @@
 #include "theme.h"
 #include "filesystem.h"
 #include "excludedfiles.h"
+#include "checksums.h"
 
 #include "creds/abstractcredentials.h"
 
@@ -61,6 +62,7 @@ Folder::Folder(const FolderDefinition& definition,
       , _forceSyncOnPollTimeout(false)
       , _consecutiveFailingSyncs(0)
       , _consecutiveFollowUpSyncs(0)
+      , _pendingLocalChanges(false)
       , _journal(definition.localPath)
       , _fileLog(new SyncRunFileLog)
 {
@@ -116,6 +118,8 @@ Folder::Folder(const FolderDefinition& definition,
 
 Folder::~Folder()
 {
+    stopChecksumHasher();
+
     // Reset then engine first as it will abort and try to access members of the Folder
     _engine.reset();
 }
@@ -589,7 +593,7 @@ void Folder::slotWatchedPathChanged(const QString& path)
     // Check that the mtime actually changed.
     if (path.startsWith(this->path())) {
         auto relativePath = path.mid(this->path().size());
-        auto record = _journal.getFileRecord(relativePath);
+        auto record = _journal.getFileRecordReadOnly(relativePath);
         if (record.isValid() && !FileSystem::fileChanged(path, record._fileSize,
                 Utility::qDateTimeToTime_t(record._modtime))) {
             qDebug() << "Ignoring spurious notification for file" << relativePath;
@@ -597,6 +601,7 @@ void Folder::slotWatchedPathChanged(const QString& path)
         }
     }
 
+    _pendingLocalChanges = true;
     emit watchedFileChangedExternally(path);
     emit scheduleToSync(this);
 }
@@ -660,6 +665,7 @@ void Folder::wipe()
 
     //Unregister the socket API so it does not keep the .sync_journal file open
     FolderMan::instance()->socketApi()->slotUnregisterPath(alias());
+    stopChecksumHasher();
     _journal.close(); // close the sync journal
 
     QFile file(stateDbFile);
@@ -728,6 +734,10 @@ void Folder::startSync(const QStringList &pathList)
     _errors.clear();
     _csyncError = false;
     _csyncUnavail = false;
+    _pendingLocalChanges = false;
+
+    // Don't compete with the sync for disk access or the journal
+    stopChecksumHasher();
 
     _timeSinceLastSyncStart.restart();
     _syncResult.clearErrors();
@@ -780,7 +790,10 @@ void Folder::setDirtyNetworkLimits()
         uploadLimit = 0;
     }
 
-    _engine->setNetworkLimits(uploadLimit, downloadLimit);
+    // No switch for this one, 0 means unlimited
+    int totalLimit = cfg.totalLimit() * 1000;
+
+    _engine->setNetworkLimits(uploadLimit, downloadLimit, totalLimit);
 }
 
 
@@ -854,6 +867,11 @@ void Folder::slotSyncFinished(bool success)
         journalDb()->setSelectiveSyncList(SyncJournalDb::SelectiveSyncWhiteList, QStringList());
     }
 
+    if (_syncResult.status() == SyncResult::Success
+            || _syncResult.status() == SyncResult::Problem) {
+        startChecksumHasher();
+    }
+
     emit syncStateChange();
 
     // The syncFinished result that is to be triggered here makes the folderman
@@ -887,6 +905,25 @@ void Folder::slotSyncFinished(bool success)
     }
 }
 
+void Folder::startChecksumHasher()
+{
+    const QByteArray checksumType = contentChecksumType();
+    if (checksumType.isEmpty()
+            || (_checksumHasher && _checksumHasher->isRunning())) {
+        return;
+    }
+    _checksumHasher.reset(new BackgroundChecksumHasher(&_journal, path(), checksumType));
+    _checksumHasher->start(QThread::LowestPriority);
+}
+
+void Folder::stopChecksumHasher()
+{
+    if (_checksumHasher) {
+        _checksumHasher->abort();
+        _checksumHasher->wait();
+    }
+}
+
 void Folder::slotEmitFinishedDelayed()
 {
     emit syncFinished( _syncResult );
@@ -36,6 +36,7 @@ namespace OCC {
 class SyncEngine;
 class AccountState;
 class SyncRunFileLog;
+class BackgroundChecksumHasher;
 
 /**
  * @brief The FolderDefinition class
@@ -179,6 +180,13 @@ public:
      qint64 msecLastSyncDuration() const { return _lastSyncDuration; }
      int consecutiveFollowUpSyncs() const { return _consecutiveFollowUpSyncs; }
 
+     /**
+      * Whether the file watcher reported local changes since the last sync started.
+      *
+      * FolderMan starts these folders first, the user is waiting for them.
+      */
+     bool hasPendingLocalChanges() const { return _pendingLocalChanges; }
+
      /// Saves the folder data in the account's settings.
      void saveToSettings() const;
      /// Removes the folder from the account's settings.
@@ -273,6 +281,10 @@ private:
 
     void checkLocalPath();
 
+    /// Starts hashing the files that are missing from the local checksum cache.
+    void startChecksumHasher();
+    void stopChecksumHasher();
+
     enum LogStatus {
         LogStatusRemove,
         LogStatusRename,
@@ -312,8 +324,14 @@ private:
     /// Reset when no follow-up is requested.
     int           _consecutiveFollowUpSyncs;
 
+    /// Set when the file watcher reports a change, reset when a sync starts.
+    bool          _pendingLocalChanges;
+
     SyncJournalDb _journal;
 
+    /// Fills the local checksum cache between syncs.
+    QScopedPointer<BackgroundChecksumHasher> _checksumHasher;
+
     ClientProxy   _clientProxy;
 
     QScopedPointer<SyncRunFileLog> _fileLog;
@@ -43,7 +43,6 @@ FolderMan* FolderMan::_instance = 0;
 
 FolderMan::FolderMan(QObject *parent) :
     QObject(parent),
-    _currentSyncFolder(0),
     _syncEnabled( true ),
     _lockWatcher(new LockWatcher),
     _appRestartRequired(false)
@@ -130,7 +129,7 @@ int FolderMan::unloadAndDeleteAllFolders()
         cnt++;
     }
     _lastSyncFolder = 0;
-    _currentSyncFolder = 0;
+    _currentSyncFolders.clear();
     _scheduleQueue.clear();
     emit scheduleQueueChanged();
 
@@ -444,10 +443,9 @@ void FolderMan::slotFolderCanSyncChanged()
 // csync still remains in a stable state, regardless of that.
 void FolderMan::terminateSyncProcess()
 {
-    Folder *f = _currentSyncFolder;
-    if( f ) {
+    foreach (Folder *f, _currentSyncFolders) {
         // This will, indirectly and eventually, call slotFolderSyncFinished
-        // and thereby clear _currentSyncFolder.
+        // and thereby remove f from _currentSyncFolders.
         f->slotTerminateSync();
     }
 }
@@ -543,7 +541,7 @@ void FolderMan::slotRunOneEtagJob()
             //qDebug() << "No more remote ETag check jobs to schedule.";
 
             /* now it might be a good time to check for restarting... */
-            if( _currentSyncFolder == NULL && _appRestartRequired ) {
+            if( _currentSyncFolders.isEmpty() && _appRestartRequired ) {
                 restartApplication();
             }
         } else {
@@ -575,9 +573,10 @@ void FolderMan::slotAccountStateChanged()
         qDebug() << "Account" << accountName << "disconnected or paused, "
                     "terminating or descheduling sync folders";
 
-        if (_currentSyncFolder
-                && _currentSyncFolder->accountState() == accountState) {
-            _currentSyncFolder->slotTerminateSync();
+        foreach (Folder *f, _currentSyncFolders) {
+            if (f->accountState() == accountState) {
+                f->slotTerminateSync();
+            }
         }
 
         QMutableListIterator<Folder*> it(_scheduleQueue);
@@ -612,7 +611,7 @@ void FolderMan::startScheduledSyncSoon(qint64 msMinimumDelay)
     if (_scheduleQueue.empty()) {
         return;
     }
-    if (_currentSyncFolder) {
+    if (_currentSyncFolders.count() >= maximumParallelFolderSyncs()) {
         return;
     }
 
@@ -663,8 +662,8 @@ void FolderMan::startScheduledSyncSoon(qint64 msMinimumDelay)
   */
 void FolderMan::slotStartScheduledFolderSync()
 {
-    if( _currentSyncFolder ) {
-        qDebug() << "Currently folder " << _currentSyncFolder->remoteUrl().toString() << " is running, wait for finish!";
+    if( _currentSyncFolders.count() >= maximumParallelFolderSyncs() ) {
+        qDebug() << "Currently" << _currentSyncFolders.count() << "folders are running, wait for finish!";
         return;
     }
 
@@ -678,24 +677,71 @@ void FolderMan::slotStartScheduledFolderSync()
         return;
     }
 
-    // Find the first folder in the queue that can be synced.
-    Folder* f = 0;
-    while( !_scheduleQueue.isEmpty() ) {
-        f = _scheduleQueue.dequeue();
+    // Start as many folders as the budget allows. The propagators of the
+    // running folders share the network connections between them, see
+    // OwncloudPropagator::globalMaximumActiveJob().
+    while( _currentSyncFolders.count() < maximumParallelFolderSyncs() ) {
+        Folder* f = dequeueNextFolderToSync();
+        if( !f ) {
+            break;
+        }
+        _currentSyncFolders.append(f);
+        f->startSync( QStringList() );
+    }
+
+    emit scheduleQueueChanged();
+}
+
+Folder* FolderMan::dequeueNextFolderToSync()
+{
+    // Folders that can't sync are dropped from the queue, as well as
+    // folders of accounts that are already syncing are skipped. Among the
+    // remaining ones, the first with local changes wins over the head of
+    // the queue.
+    Folder* next = 0;
+    QMutableListIterator<Folder*> it(_scheduleQueue);
+    while( it.hasNext() ) {
+        Folder* f = it.next();
         Q_ASSERT(f);
 
-        if( f->canSync() ) {
+        if( !f->canSync() ) {
+            it.remove();
+            continue;
+        }
+        if( isSyncRunningForAccount(f->accountState()) ) {
+            continue;
+        }
+        if( !next ) {
+            next = f;
+        }
+        if( f->hasPendingLocalChanges() ) {
+            next = f;
             break;
         }
     }
+    if( next ) {
+        _scheduleQueue.removeOne(next);
+    }
+    return next;
+}
 
-    emit scheduleQueueChanged();
+bool FolderMan::isSyncRunningForAccount(AccountState *accountState) const
+{
+    foreach (Folder *f, _currentSyncFolders) {
+        if (f->accountState() == accountState) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    // Start syncing this folder!
-    if( f ) {
-        _currentSyncFolder = f;
-        f->startSync( QStringList() );
+int FolderMan::maximumParallelFolderSyncs()
+{
+    static int max = qgetenv("OWNCLOUD_MAX_PARALLEL_FOLDERS").toUInt();
+    if (!max) {
+        max = 3; // default
     }
+    return max;
 }
 
 void FolderMan::slotEtagPollTimerTimeout()
@@ -708,7 +754,7 @@ void FolderMan::slotEtagPollTimerTimeout()
         if (!f) {
             continue;
         }
-        if (_currentSyncFolder == f) {
+        if (_currentSyncFolders.contains(f)) {
             continue;
         }
         if (_scheduleQueue.contains(f)) {
@@ -775,7 +821,9 @@ void FolderMan::slotScheduleFolderOwningFile(const QString& path)
 
 void FolderMan::slotFolderSyncStarted( )
 {
-    qDebug() << ">===================================== sync started for " << _currentSyncFolder->remoteUrl().toString();
+    Folder *f = qobject_cast<Folder*>(sender());
+    Q_ASSERT(f);
+    qDebug() << ">===================================== sync started for " << f->remoteUrl().toString();
 }
 
 /*
@@ -786,10 +834,12 @@ void FolderMan::slotFolderSyncStarted( )
   */
 void FolderMan::slotFolderSyncFinished( const SyncResult& )
 {
-    qDebug() << "<===================================== sync finished for " << _currentSyncFolder->remoteUrl().toString();
+    Folder *f = qobject_cast<Folder*>(sender());
+    Q_ASSERT(f);
+    qDebug() << "<===================================== sync finished for " << f->remoteUrl().toString();
 
-    _lastSyncFolder = _currentSyncFolder;
-    _currentSyncFolder = 0;
+    _currentSyncFolders.removeAll(f);
+    _lastSyncFolder = f;
 
     startScheduledSyncSoon();
 }
@@ -889,10 +939,10 @@ void FolderMan::slotRemoveFolder( Folder *f )
 
     qDebug() << "Removing " << f->alias();
 
-    const bool currentlyRunning = (_currentSyncFolder == f);
+    const bool currentlyRunning = _currentSyncFolders.contains(f);
     if( currentlyRunning ) {
         // abort the sync now
-        terminateSyncProcess();
+        f->slotTerminateSync();
     }
 
     if (_scheduleQueue.removeAll(f) > 0) {
@@ -1265,9 +1315,9 @@ QQueue<Folder*> FolderMan::scheduleQueue() const
     return _scheduleQueue;
 }
 
-Folder *FolderMan::currentSyncFolder() const
+QList<Folder*> FolderMan::currentSyncFolders() const
 {
-    return _currentSyncFolder;
+    return _currentSyncFolders;
 }
 
 void FolderMan::restartApplication()
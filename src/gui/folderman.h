@@ -122,9 +122,16 @@ public:
     QQueue<Folder*> scheduleQueue() const;
 
     /**
-     * Access to the currently syncing folder.
+     * Access to the currently syncing folders.
      */
-    Folder* currentSyncFolder() const;
+    QList<Folder*> currentSyncFolders() const;
+
+    /**
+     * The maximum number of folders that may sync at the same time.
+     *
+     * Folders of the same account never sync at the same time.
+     */
+    static int maximumParallelFolderSyncs();
 
 signals:
     /**
@@ -150,7 +157,7 @@ public slots:
     void slotFolderSyncFinished( const SyncResult& );
 
     /**
-     * Terminates the current folder sync.
+     * Terminates all the running folder syncs.
      *
      * It does not switch the folder to paused state.
      */
@@ -160,7 +167,7 @@ public slots:
     int unloadAndDeleteAllFolders();
 
     // if enabled is set to false, no new folders will start to sync.
-    // the current one will finish.
+    // the running ones will finish.
     void setSyncEnabled( bool );
 
     void slotScheduleAllFolders();
@@ -224,6 +231,12 @@ private:
     /** Will start a sync after a bit of delay. */
     void startScheduledSyncSoon(qint64 msMinimumDelay = 0);
 
+    /** Whether a folder of that account is syncing already */
+    bool isSyncRunningForAccount(AccountState *accountState) const;
+
+    /** Takes the folder that should sync next out of the queue, or returns 0 */
+    Folder *dequeueNextFolderToSync();
+
     // finds all folder configuration files
     // and create the folders
     QString getBackupName( QString fullPathName ) const;
@@ -235,7 +248,7 @@ private:
     QSet<Folder*>  _disabledFolders;
     Folder::Map    _folderMap;
     QString        _folderConfigPath;
-    Folder        *_currentSyncFolder;
+    QList<Folder*> _currentSyncFolders;
     QPointer<Folder> _lastSyncFolder;
     bool           _syncEnabled;
     QTimer         _etagPollTimer;
@@ -993,9 +993,11 @@ void FolderStatusModel::slotFolderSyncStateChange(Folder *f)
     } else if (state == SyncResult::NotYetStarted) {
         FolderMan* folderMan = FolderMan::instance();
         int pos = folderMan->scheduleQueue().indexOf(f);
-        if (folderMan->currentSyncFolder()
-                && folderMan->currentSyncFolder() != f) {
-            pos += 1;
+        foreach (Folder *running, folderMan->currentSyncFolders()) {
+            // Only a running folder of the same account delays this one.
+            if (running != f && running->accountState() == f->accountState()) {
+                pos += 1;
+            }
         }
         QString message;
         if (pos <= 0) {
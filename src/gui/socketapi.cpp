@@ -326,6 +326,30 @@ void SocketApi::command_RETRIEVE_FILE_STATUS(const QString& argument, QIODevice*
     sendMessage(socket, message);
 }
 
+void SocketApi::command_PRIORITIZE_PATH(const QString& argument, QIODevice* socket)
+{
+    if( !socket ) {
+        qDebug() << "No valid socket object.";
+        return;
+    }
+
+    qDebug() << Q_FUNC_INFO << argument;
+
+    QString statusString = QLatin1String("NOP");
+
+    Folder* syncFolder = FolderMan::instance()->folderForPath( argument );
+    if (syncFolder) {
+        QString relativePath = QDir::cleanPath(argument).mid(syncFolder->cleanPath().length()+1);
+        // The sync folder itself has nothing to move forward
+        if (!relativePath.isEmpty() && syncFolder->syncEngine().prioritize(relativePath)) {
+            statusString = QLatin1String("OK");
+        }
+    }
+
+    const QString message = QLatin1String("PRIORITIZE_PATH:") % statusString % QLatin1Char(':') % QDir::toNativeSeparators(argument);
+    sendMessage(socket, message);
+}
+
 void SocketApi::command_SHARE(const QString& localFile, QIODevice* socket)
 {
     if (!socket) {
@@ -372,7 +396,7 @@ void SocketApi::command_SHARE(const QString& localFile, QIODevice* socket)
             return;
         }
 
-        SyncJournalFileRecord rec = shareFolder->journalDb()->getFileRecord(localFileClean);
+        SyncJournalFileRecord rec = shareFolder->journalDb()->getFileRecordReadOnly(localFileClean);
 
         bool allowReshare = true; // lets assume the good
         if( rec.isValid() ) {
@@ -40,6 +40,7 @@ Account::Account(QObject *parent)
     , _capabilities(QVariantMap())
     , _davPath( Theme::instance()->webDavPath() )
     , _wasMigrated(false)
+    , _transferCompressionEnabled(true)
 {
     qRegisterMetaType<AccountPtr>("AccountPtr");
 }
@@ -485,6 +486,16 @@ void Account::setMigrated(bool mig)
     _wasMigrated = mig;
 }
 
+bool Account::transferCompressionEnabled() const
+{
+    return _transferCompressionEnabled;
+}
+
+void Account::setTransferCompressionEnabled(bool enabled)
+{
+    _transferCompressionEnabled = enabled;
+}
+
 const Capabilities &Account::capabilities() const
 {
     return _capabilities;
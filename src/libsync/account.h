@@ -105,6 +105,12 @@ public:
     void setMigrated(bool mig);
     bool wasMigrated();
 
+    /** Whether file transfers of this account may be compressed on the
+     *  wire, if the server and the file type allow it. Default: true
+     */
+    void setTransferCompressionEnabled(bool enabled);
+    bool transferCompressionEnabled() const;
+
     QList<QNetworkCookie> lastAuthCookies() const;
 
     QNetworkReply* headRequest(const QString &relPath);
@@ -225,6 +231,7 @@ private:
     QString _pemPrivateKey;  
     QString _davPath; // defaults to value from theme, might be overwritten in brandings
     bool _wasMigrated;
+    bool _transferCompressionEnabled;
     friend class AccountManager;
 };
 
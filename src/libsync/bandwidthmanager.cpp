@@ -26,8 +26,22 @@
 #include <QTimer>
 #include <QObject>
 
+#include <limits>
+
 namespace OCC {
 
+// The token buckets for absolute limits are refilled at this interval. Handing out
+// small amounts of quota often gives a smoother rate than a whole second at once.
+static const qint64 absoluteLimitTimerIntervalMsec = 100;
+// A bucket holds at most that many intervals worth of tokens, which limits bursts.
+static const qint64 absoluteLimitBurstIntervals = 2;
+
+static qint64 refillTokenBucket(qint64 tokens, qint64 limit, qint64 elapsedMsec)
+{
+    const qint64 capacity = qMax(qint64(1), limit * absoluteLimitTimerIntervalMsec * absoluteLimitBurstIntervals / 1000);
+    return qMin(capacity, tokens + limit * elapsedMsec / 1000);
+}
+
 // Because of the many layers of buffering inside Qt (and probably the OS and the network)
 // we cannot lower this value much more. If we do, the estimated bw will be very high
 // because the buffers fill fast while the actual network algorithms are not relevant yet.
@@ -47,10 +61,15 @@ BandwidthManager::BandwidthManager(OwncloudPropagator *p) : QObject(),
     _relativeUploadLimitProgressAtMeasuringRestart(0),
     _currentUploadLimit(0),
     _relativeLimitCurrentMeasuredJob(0),
-    _currentDownloadLimit(0)
+    _currentDownloadLimit(0),
+    _uploadTokens(0),
+    _downloadTokens(0),
+    _totalTokens(0),
+    _currentTotalLimit(0)
 {
     _currentUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
     _currentDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
+    _currentTotalLimit = _propagator->_totalLimit.fetchAndAddAcquire(0);
 
     QObject::connect(&_switchingTimer, SIGNAL(timeout()), this, SLOT(switchingTimerExpired()));
     _switchingTimer.setInterval(10*1000);
@@ -59,8 +78,9 @@ BandwidthManager::BandwidthManager(OwncloudPropagator *p) : QObject(),
 
     // absolute uploads/downloads
     QObject::connect(&_absoluteLimitTimer, SIGNAL(timeout()), this, SLOT(absoluteLimitTimerExpired()));
-    _absoluteLimitTimer.setInterval(1000);
+    _absoluteLimitTimer.setInterval(absoluteLimitTimerIntervalMsec);
     _absoluteLimitTimer.start();
+    _absoluteLimitElapsed.start();
 
     // Relative uploads
     QObject::connect(&_relativeUploadMeasuringTimer,SIGNAL(timeout()),
@@ -95,15 +115,21 @@ void BandwidthManager::registerUploadDevice(UploadDevice *p)
     _relativeUploadDeviceList.append(p);
     QObject::connect(p, SIGNAL(destroyed(QObject*)), this, SLOT(unregisterUploadDevice(QObject*)));
 
-    if (usingAbsoluteUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(false);
+    applyUploadLimitMode(p);
+}
+
+void BandwidthManager::applyUploadLimitMode(UploadDevice *device)
+{
+    if (usingUploadTokenBucket()) {
+        // Will get quota at the next refill
+        device->setBandwidthLimited(true);
+        device->setChoked(false);
     } else if (usingRelativeUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(true);
+        device->setBandwidthLimited(true);
+        device->setChoked(true);
     } else {
-        p->setBandwidthLimited(false);
-        p->setChoked(false);
+        device->setBandwidthLimited(false);
+        device->setChoked(false);
     }
 }
 
@@ -132,15 +158,21 @@ void BandwidthManager::registerDownloadJob(GETFileJob* j)
     _downloadJobList.append(j);
     QObject::connect(j, SIGNAL(destroyed(QObject*)), this, SLOT(unregisterDownloadJob(QObject*)));
 
-    if (usingAbsoluteDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(false);
+    applyDownloadLimitMode(j);
+}
+
+void BandwidthManager::applyDownloadLimitMode(GETFileJob *job)
+{
+    if (usingDownloadTokenBucket()) {
+        // Will get quota at the next refill
+        job->setBandwidthLimited(true);
+        job->setChoked(false);
     } else if (usingRelativeDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(true);
+        job->setBandwidthLimited(true);
+        job->setChoked(true);
     } else {
-        j->setBandwidthLimited(false);
-        j->setChoked(false);
+        job->setBandwidthLimited(false);
+        job->setChoked(false);
     }
 }
 
@@ -353,58 +385,119 @@ void BandwidthManager::relativeDownloadDelayTimerExpired()
 // end downloads
 
 void BandwidthManager::switchingTimerExpired() {
+    qint64 newTotalLimit = _propagator->_totalLimit.fetchAndAddAcquire(0);
+    bool totalLimitChanged = false;
+    if (newTotalLimit != _currentTotalLimit) {
+        qDebug() << Q_FUNC_INFO << "Total Bandwidth limit changed" << _currentTotalLimit << newTotalLimit;
+        _currentTotalLimit = newTotalLimit;
+        _totalTokens = 0;
+        totalLimitChanged = true;
+    }
     qint64 newUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
-    if (newUploadLimit != _currentUploadLimit) {
+    if (newUploadLimit != _currentUploadLimit || totalLimitChanged) {
         qDebug() << Q_FUNC_INFO << "Upload Bandwidth limit changed" << _currentUploadLimit << newUploadLimit;
         _currentUploadLimit = newUploadLimit;
+        _uploadTokens = 0;
         Q_FOREACH(UploadDevice *ud, _relativeUploadDeviceList) {
-            if (newUploadLimit == 0) {
-                ud->setBandwidthLimited(false);
-                ud->setChoked(false);
-            } else if (newUploadLimit > 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(false);
-            } else if (newUploadLimit < 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(true);
-            }
+            applyUploadLimitMode(ud);
         }
     }
     qint64 newDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
-    if (newDownloadLimit != _currentDownloadLimit) {
+    if (newDownloadLimit != _currentDownloadLimit || totalLimitChanged) {
         qDebug() << Q_FUNC_INFO << "Download Bandwidth limit changed" << _currentDownloadLimit << newDownloadLimit;
         _currentDownloadLimit = newDownloadLimit;
+        _downloadTokens = 0;
         Q_FOREACH(GETFileJob *j, _downloadJobList) {
-            if (usingAbsoluteDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(false);
-            } else if (usingRelativeDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(true);
-            } else {
-                j->setBandwidthLimited(false);
-                j->setChoked(false);
-            }
+            applyDownloadLimitMode(j);
         }
     }
 }
 
 void BandwidthManager::absoluteLimitTimerExpired()
 {
-    if (usingAbsoluteUploadLimit() && _absoluteUploadDeviceList.count() > 0) {
-        qint64 quotaPerDevice = _currentUploadLimit / qMax(1, _absoluteUploadDeviceList.count());
-//        qDebug() << Q_FUNC_INFO << quotaPerDevice <<  _absoluteUploadDeviceList.count() << _currentUploadLimit;
+    const qint64 elapsedMsec = _absoluteLimitElapsed.restart();
+
+    const int uploadCount = usingUploadTokenBucket() ? _absoluteUploadDeviceList.count() : 0;
+    const int downloadCount = usingDownloadTokenBucket() ? _downloadJobList.count() : 0;
+
+    // Take back the quota that was not used during the last interval, so that
+    // it can go to the jobs that actually transfer something.
+    qint64 unusedUploadQuota = 0;
+    if (uploadCount > 0) {
+        Q_FOREACH(UploadDevice *device, _absoluteUploadDeviceList) {
+            unusedUploadQuota += device->takeBandwidthQuota();
+        }
+    }
+    qint64 unusedDownloadQuota = 0;
+    if (downloadCount > 0) {
+        Q_FOREACH(GETFileJob *j, _downloadJobList) {
+            unusedDownloadQuota += j->takeBandwidthQuota();
+        }
+    }
+
+    const qint64 unlimited = std::numeric_limits<qint64>::max();
+    qint64 uploadGrant = 0;
+    if (uploadCount > 0) {
+        uploadGrant = unlimited;
+        if (usingAbsoluteUploadLimit()) {
+            _uploadTokens = refillTokenBucket(_uploadTokens + unusedUploadQuota, _currentUploadLimit, elapsedMsec);
+            uploadGrant = _uploadTokens;
+        }
+    }
+    qint64 downloadGrant = 0;
+    if (downloadCount > 0) {
+        downloadGrant = unlimited;
+        if (usingAbsoluteDownloadLimit()) {
+            _downloadTokens = refillTokenBucket(_downloadTokens + unusedDownloadQuota, _currentDownloadLimit, elapsedMsec);
+            downloadGrant = _downloadTokens;
+        }
+    }
+
+    if (usingTotalLimit()) {
+        _totalTokens = refillTokenBucket(_totalTokens + unusedUploadQuota + unusedDownloadQuota,
+                                         _currentTotalLimit, elapsedMsec);
+        if (uploadCount + downloadCount > 0) {
+            // Share the sync-wide tokens equally between all jobs, then give what
+            // one direction can't use to the other one.
+            const qint64 perJob = _totalTokens / (uploadCount + downloadCount);
+            qint64 totalUploadGrant = qMin(uploadGrant, perJob * uploadCount);
+            qint64 totalDownloadGrant = qMin(downloadGrant, perJob * downloadCount);
+            qint64 leftover = _totalTokens - totalUploadGrant - totalDownloadGrant;
+            if (uploadCount > 0) {
+                qint64 extra = qMin(leftover, uploadGrant - totalUploadGrant);
+                totalUploadGrant += extra;
+                leftover -= extra;
+            }
+            if (downloadCount > 0) {
+                totalDownloadGrant += qMin(leftover, downloadGrant - totalDownloadGrant);
+            }
+            uploadGrant = totalUploadGrant;
+            downloadGrant = totalDownloadGrant;
+        }
+    }
+
+    if (uploadCount > 0) {
+        const qint64 quotaPerDevice = uploadGrant / uploadCount;
+        if (usingAbsoluteUploadLimit()) {
+            _uploadTokens -= quotaPerDevice * uploadCount;
+        }
+        if (usingTotalLimit()) {
+            _totalTokens -= quotaPerDevice * uploadCount;
+        }
         Q_FOREACH(UploadDevice *device, _absoluteUploadDeviceList) {
             device->giveBandwidthQuota(quotaPerDevice);
-//            qDebug() << Q_FUNC_INFO << "Gave " << quotaPerDevice/1024.0 << " kB to" << device;
         }
     }
-    if (usingAbsoluteDownloadLimit() && _downloadJobList.count() > 0) {
-        qint64 quotaPerJob = _currentDownloadLimit / qMax(1, _downloadJobList.count());
-//        qDebug() << Q_FUNC_INFO << quotaPerJob <<  _downloadJobList.count() << _currentDownloadLimit;
+    if (downloadCount > 0) {
+        const qint64 quotaPerJob = downloadGrant / downloadCount;
+        if (usingAbsoluteDownloadLimit()) {
+            _downloadTokens -= quotaPerJob * downloadCount;
+        }
+        if (usingTotalLimit()) {
+            _totalTokens -= quotaPerJob * downloadCount;
+        }
         Q_FOREACH(GETFileJob *j, _downloadJobList) {
             j->giveBandwidthQuota(quotaPerJob);
-//            qDebug() << Q_FUNC_INFO << "Gave " << quotaPerJob/1024.0 << " kB to" << j;
         }
     }
 }
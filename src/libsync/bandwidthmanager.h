@@ -19,6 +19,9 @@
 #include <QLinkedList>
 #include <QTimer>
 #include <QIODevice>
+#include <QElapsedTimer>
+
+#include "owncloudlib.h"
 
 namespace OCC {
 
@@ -28,9 +31,18 @@ class OwncloudPropagator;
 
 /**
  * @brief The BandwidthManager class
+ *
+ * Absolute limits (and the sync-wide limit) are enforced with token buckets
+ * that are refilled in short intervals. The tokens are shared fairly between
+ * all the transfers that are running, so the limits hold for any number of
+ * parallel jobs.
+ *
+ * Relative limits are enforced by measuring the speed of one transfer at a
+ * time while the others are choked.
+ *
  * @ingroup libsync
  */
-class BandwidthManager : public QObject {
+class OWNCLOUDSYNC_EXPORT BandwidthManager : public QObject {
     Q_OBJECT
 public:
     BandwidthManager(OwncloudPropagator *p);
@@ -40,6 +52,21 @@ public:
     bool usingRelativeUploadLimit() { return _currentUploadLimit < 0; }
     bool usingAbsoluteDownloadLimit() { return _currentDownloadLimit > 0; }
     bool usingRelativeDownloadLimit() { return _currentDownloadLimit < 0; }
+    bool usingTotalLimit() { return _currentTotalLimit > 0; }
+
+    /** Whether the uploads get their quota from the token buckets.
+     *
+     * That is the case with an absolute upload limit, or when only the
+     * sync-wide limit applies. A relative limit takes precedence over the
+     * sync-wide one: its quota comes from measuring, and capping the
+     * measured transfer would skew the speed it is a percentage of.
+     */
+    bool usingUploadTokenBucket() {
+        return usingAbsoluteUploadLimit() || (_currentUploadLimit == 0 && usingTotalLimit());
+    }
+    bool usingDownloadTokenBucket() {
+        return usingAbsoluteDownloadLimit() || (_currentDownloadLimit == 0 && usingTotalLimit());
+    }
 
 
 public slots:
@@ -61,11 +88,21 @@ public slots:
     void relativeDownloadDelayTimerExpired();
 
 private:
+    void applyUploadLimitMode(UploadDevice *device);
+    void applyDownloadLimitMode(GETFileJob *job);
+
     QTimer _switchingTimer; // for switching between absolute and relative bw limiting
     OwncloudPropagator *_propagator; // FIXME this timer and this variable should be replaced
     // by the propagator emitting the changed limit values to us as signal
 
-    QTimer _absoluteLimitTimer; // for absolute up/down bw limiting
+    QTimer _absoluteLimitTimer; // for absolute up/down bw limiting, refills the token buckets
+    QElapsedTimer _absoluteLimitElapsed; // time since the last refill
+
+    // Tokens (bytes) that can be handed out to the jobs
+    qint64 _uploadTokens;
+    qint64 _downloadTokens;
+    qint64 _totalTokens;
+    qint64 _currentTotalLimit; // sync-wide limit for uploads and downloads together, 0 for none
 
     QLinkedList<UploadDevice*> _absoluteUploadDeviceList;
     QLinkedList<UploadDevice*> _relativeUploadDeviceList; // FIXME merge with list above ^^
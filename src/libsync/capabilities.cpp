@@ -107,4 +107,33 @@ QByteArray Capabilities::uploadChecksumType() const
     return QByteArray();
 }
 
+bool Capabilities::deltaUploadAvailable() const
+{
+    return _capabilities["files"].toMap()["deltaUpload"].toBool();
+}
+
+bool Capabilities::deltaDownloadAvailable() const
+{
+    return _capabilities["files"].toMap()["deltaDownload"].toBool();
+}
+
+QList<QByteArray> Capabilities::supportedUploadContentEncodings() const
+{
+    QList<QByteArray> list;
+    foreach (const auto & t, _capabilities["files"].toMap()["uploadContentEncodings"].toList()) {
+        list.push_back(t.toByteArray());
+    }
+    return list;
+}
+
+bool Capabilities::bundledUploadsAvailable() const
+{
+    return _capabilities["files"].toMap()["bundledUploads"].toBool();
+}
+
+bool Capabilities::archiveDownloadAvailable() const
+{
+    return _capabilities["files"].toMap()["archiveDownload"].toBool();
+}
+
 }
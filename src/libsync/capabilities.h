@@ -55,7 +55,7 @@ public:
      *
      * Path: checksums/supportedTypes
      * Default: []
-     * Possible entries: "Adler32", "MD5", "SHA1"
+     * Possible entries: "Adler32", "MD5", "SHA1", "SHA1Tree"
      */
     QList<QByteArray> supportedChecksumTypes() const;
 
@@ -76,6 +76,57 @@ public:
      */
     QByteArray uploadChecksumType() const;
 
+    /**
+     * Whether the server can assemble a chunked upload from uploaded chunks
+     * and chunks of the current version of the file.
+     *
+     * The client then skips the chunks that did not change and lists their
+     * numbers in the OC-Chunk-Reuse header of the final chunk.
+     *
+     * Path: files/deltaUpload
+     * Default: false
+     */
+    bool deltaUploadAvailable() const;
+
+    /**
+     * Whether the server publishes block maps of files.
+     *
+     * A block map lists the SHA1 of every block of the current version of a
+     * file, so a download can copy the unchanged blocks from the local file
+     * and only fetch the others with Range requests.
+     *
+     * Path: files/deltaDownload
+     * Default: false
+     */
+    bool deltaDownloadAvailable() const;
+
+    /**
+     * Returns the Content-Encodings the server accepts for file uploads.
+     *
+     * Path: files/uploadContentEncodings
+     * Default: []
+     * Possible entries: "gzip"
+     */
+    QList<QByteArray> supportedUploadContentEncodings() const;
+
+    /**
+     * Whether the server accepts several new files in one multipart POST
+     * to a folder, see PropagateUploadBundle.
+     *
+     * Path: files/bundledUploads
+     * Default: false
+     */
+    bool bundledUploadsAvailable() const;
+
+    /**
+     * Whether the server sends several files of a folder as one zip
+     * archive, see PropagateDownloadArchive.
+     *
+     * Path: files/archiveDownload
+     * Default: false
+     */
+    bool archiveDownloadAvailable() const;
+
 private:
     QVariantMap _capabilities;
 };
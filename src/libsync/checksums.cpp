@@ -17,8 +17,16 @@
 #include "syncfileitem.h"
 #include "propagatorjobs.h"
 #include "account.h"
+#include "syncjournaldb.h"
 
 #include <qtconcurrentrun.h>
+#include <QFile>
+#include <QThread>
+#include <QThreadPool>
+
+#ifdef ZLIB_FOUND
+#include <zlib.h>
+#endif
 
 /** \file checksums.cpp
  *
@@ -55,6 +63,10 @@
  * Transmission checksums guard a specific sync action and are not stored
  * in the database.
  *
+ * Downloads compute the checksums with a ChecksumCalculator while the data
+ * is written to the temporary file. Only resumed downloads need to read the
+ * file again.
+ *
  * Content Checksums
  * -----------------
  *
@@ -65,12 +77,30 @@
  *
  * Content checksums are not sent to the server.
  *
+ * The journal caches the content checksums of local files keyed on their
+ * inode, size and modtime, see computeLocalChecksumCached(). Transfers fill
+ * it as a side effect and a BackgroundChecksumHasher hashes the remaining
+ * files after a sync, so unchanged files never need to be read again.
+ *
  * Checksum Algorithms
  * -------------------
  *
  * - Adler32 (requires zlib)
  * - MD5
  * - SHA1
+ * - SHA1Tree
+ *
+ * SHA1Tree splits the file into leaves of ChecksumCalculator::treeLeafSize
+ * bytes, hashes each leaf with SHA1 and the concatenated binary leaf digests
+ * with SHA1 again. An empty file has a single empty leaf. The leaves are
+ * independent, so the checksum of a large file is computed on all cores.
+ * The client uses it as transmission checksum when the server lists it in
+ * the checksums capability, and as content checksum when it is set in
+ * OWNCLOUD_CONTENT_CHECKSUM_TYPE.
+ *
+ * When more than one type is needed for a file, they are computed in a single
+ * pass over the file. Asynchronous computations run on a small thread pool of
+ * their own, see checksumThreadPool().
  *
  */
 
@@ -102,6 +132,29 @@ bool parseChecksumHeader(const QByteArray& header, QByteArray* type, QByteArray*
     return true;
 }
 
+bool parseBlockMap(const QByteArray& blockMap, qint64* blockSize, QByteArray* checksums)
+{
+    const auto idx = blockMap.indexOf(':');
+    if (idx < 0) {
+        return false;
+    }
+    bool ok = false;
+    *blockSize = blockMap.left(idx).trimmed().toLongLong(&ok);
+    if (!ok || *blockSize <= 0) {
+        return false;
+    }
+
+    checksums->clear();
+    foreach (const QByteArray& checksum, blockMap.mid(idx + 1).split(',')) {
+        const QByteArray sha1 = checksum.trimmed().toLower();
+        if (sha1.size() != 40 || QByteArray::fromHex(sha1).toHex() != sha1) {
+            return false;
+        }
+        checksums->append(sha1);
+    }
+    return true;
+}
+
 bool uploadChecksumEnabled()
 {
     static bool enabled = qgetenv("OWNCLOUD_DISABLE_CHECKSUM_UPLOAD").isEmpty();
@@ -117,6 +170,179 @@ QByteArray contentChecksumType()
     return "SHA1";
 }
 
+Q_GLOBAL_STATIC(QThreadPool, _checksumThreadPool)
+Q_GLOBAL_STATIC(QThreadPool, _treeHashThreadPool)
+
+/**
+ * The pool ComputeChecksum runs on.
+ *
+ * Checksumming is disk bound: running many of them at once only makes the
+ * disk seek. A pool of its own also keeps them from delaying other users of
+ * the global pool.
+ */
+static QThreadPool* checksumThreadPool()
+{
+    QThreadPool* pool = _checksumThreadPool();
+    static bool initialized = false;
+    if (!initialized) {
+        static int max = qgetenv("OWNCLOUD_MAX_CHECKSUM_THREADS").toUInt();
+        if (!max) {
+            max = 2; // default
+        }
+        pool->setMaxThreadCount(max);
+        initialized = true;
+    }
+    return pool;
+}
+
+/**
+ * Hashes the leaves of a SHA1Tree checksum that are in [firstLeaf, endLeaf)
+ *
+ * Returns the binary leaf digests, one after the other. Returns nothing if
+ * the file could not be read, or if it is no longer \a fileSize bytes long.
+ */
+static QByteArray computeTreeLeaves(const QString& filePath, qint64 fileSize, qint64 firstLeaf, qint64 endLeaf)
+{
+    QByteArray digests;
+    QFile file(filePath);
+    QString error;
+    if (!FileSystem::openAndSeekFileSharedRead(&file, &error, firstLeaf * ChecksumCalculator::treeLeafSize)) {
+        qDebug() << "Could not read" << filePath << error;
+        return digests;
+    }
+    QByteArray buf(ChecksumCalculator::treeLeafSize, Qt::Uninitialized);
+    for (qint64 leaf = firstLeaf; leaf < endLeaf; ++leaf) {
+        const qint64 expectedSize = qMin(ChecksumCalculator::treeLeafSize,
+                                         fileSize - leaf * ChecksumCalculator::treeLeafSize);
+        qint64 size = file.read(buf.data(), expectedSize);
+        if (size != expectedSize) {
+            qDebug() << "Short read of" << filePath << "leaf" << leaf << size << expectedSize << file.errorString();
+            return QByteArray();
+        }
+        digests.append(QCryptographicHash::hash(QByteArray::fromRawData(buf.constData(), size),
+                                                QCryptographicHash::Sha1));
+    }
+    return digests;
+}
+
+/**
+ * Computes a SHA1Tree checksum with one task per core.
+ */
+static QByteArray computeTreeChecksumInParallel(const QString& filePath)
+{
+    if (!FileSystem::fileExists(filePath)) {
+        qDebug() << "Could not read" << filePath;
+        return QByteArray();
+    }
+    const qint64 size = FileSystem::getSize(filePath);
+    const qint64 leaves = (size + ChecksumCalculator::treeLeafSize - 1) / ChecksumCalculator::treeLeafSize;
+    const int tasks = qBound(1, QThread::idealThreadCount(), int(qMax(qint64(1), leaves)));
+
+    QThreadPool* pool = _treeHashThreadPool();
+    pool->setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+
+    QList<QFuture<QByteArray> > futures;
+    for (int i = 0; i < tasks; ++i) {
+        const qint64 firstLeaf = leaves * i / tasks;
+        const qint64 endLeaf = leaves * (i + 1) / tasks;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+        futures.append(QtConcurrent::run(pool, computeTreeLeaves, filePath, size, firstLeaf, endLeaf));
+#else
+        futures.append(QtConcurrent::run(computeTreeLeaves, filePath, size, firstLeaf, endLeaf));
+#endif
+    }
+
+    QByteArray digests;
+    foreach (const auto& future, futures) {
+        digests.append(future.result());
+    }
+    if (digests.size() != leaves * 20) {
+        // the file changed or could not be read
+        return QByteArray();
+    }
+    if (leaves == 0) {
+        digests = QCryptographicHash::hash(QByteArray(), QCryptographicHash::Sha1);
+    }
+    return QCryptographicHash::hash(digests, QCryptographicHash::Sha1).toHex();
+}
+
+const qint64 ChecksumCalculator::treeLeafSize;
+
+ChecksumCalculator::ChecksumCalculator(const QByteArray& checksumType)
+    : _checksumType(checksumType)
+    , _useAdler(false)
+    , _adler(0)
+    , _useTree(false)
+    , _treeLeafFill(0)
+{
+    if (checksumType == checkSumMD5C) {
+        _cryptoHash.reset(new QCryptographicHash(QCryptographicHash::Md5));
+    } else if (checksumType == checkSumSHA1C) {
+        _cryptoHash.reset(new QCryptographicHash(QCryptographicHash::Sha1));
+    } else if (checksumType == checkSumSha1TreeC) {
+        _cryptoHash.reset(new QCryptographicHash(QCryptographicHash::Sha1));
+        _useTree = true;
+    }
+#ifdef ZLIB_FOUND
+    else if (checksumType == checkSumAdlerC) {
+        _useAdler = true;
+        _adler = adler32(0L, Z_NULL, 0);
+    }
+#endif
+}
+
+ChecksumCalculator::~ChecksumCalculator()
+{
+}
+
+bool ChecksumCalculator::isValid() const
+{
+    return _cryptoHash || _useAdler;
+}
+
+void ChecksumCalculator::addData(const char* data, qint64 length)
+{
+    if (_useTree) {
+        while (length > 0) {
+            const qint64 part = qMin(length, treeLeafSize - _treeLeafFill);
+            _cryptoHash->addData(data, part);
+            _treeLeafFill += part;
+            data += part;
+            length -= part;
+            if (_treeLeafFill == treeLeafSize) {
+                _treeLeafDigests.append(_cryptoHash->result());
+                _cryptoHash->reset();
+                _treeLeafFill = 0;
+            }
+        }
+    } else if (_cryptoHash) {
+        _cryptoHash->addData(data, length);
+    }
+#ifdef ZLIB_FOUND
+    else if (_useAdler) {
+        _adler = adler32(_adler, reinterpret_cast<const Bytef*>(data), length);
+    }
+#endif
+}
+
+QByteArray ChecksumCalculator::result() const
+{
+    if (_useTree) {
+        QByteArray digests = _treeLeafDigests;
+        if (_treeLeafFill > 0 || digests.isEmpty()) {
+            digests.append(_cryptoHash->result());
+        }
+        return QCryptographicHash::hash(digests, QCryptographicHash::Sha1).toHex();
+    }
+    if (_cryptoHash) {
+        return _cryptoHash->result().toHex();
+    }
+    if (_useAdler) {
+        return QByteArray::number(uint(_adler), 16);
+    }
+    return QByteArray();
+}
+
 ComputeChecksum::ComputeChecksum(QObject* parent)
     : QObject(parent)
 {
@@ -132,37 +358,82 @@ QByteArray ComputeChecksum::checksumType() const
     return _checksumType;
 }
 
+void ComputeChecksum::setExtraChecksumTypes(const QList<QByteArray>& types)
+{
+    _extraChecksumTypes = types;
+}
+
 void ComputeChecksum::start(const QString& filePath)
 {
+    QList<QByteArray> types = _extraChecksumTypes;
+    types.prepend(_checksumType);
+
     // Calculate the checksum in a different thread first.
     connect( &_watcher, SIGNAL(finished()),
              this, SLOT(slotCalculationDone()),
              Qt::UniqueConnection );
-    _watcher.setFuture(QtConcurrent::run(ComputeChecksum::computeNow, filePath, checksumType()));
+    QMap<QByteArray, QByteArray> (*compute)(const QString&, const QList<QByteArray>&) = &ComputeChecksum::computeNow;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    _watcher.setFuture(QtConcurrent::run(checksumThreadPool(), compute, filePath, types));
+#else
+    _watcher.setFuture(QtConcurrent::run(compute, filePath, types));
+#endif
+}
+
+QMap<QByteArray, QByteArray> ComputeChecksum::checksums() const
+{
+    return _watcher.future().result();
 }
 
 QByteArray ComputeChecksum::computeNow(const QString& filePath, const QByteArray& checksumType)
 {
-    if( checksumType == checkSumMD5C ) {
-        return FileSystem::calcMd5(filePath);
-    } else if( checksumType == checkSumSHA1C ) {
-        return FileSystem::calcSha1(filePath);
+    return computeNow(filePath, QList<QByteArray>() << checksumType).value(checksumType);
+}
+
+QMap<QByteArray, QByteArray> ComputeChecksum::computeNow(const QString& filePath, const QList<QByteArray>& checksumTypes)
+{
+    QMap<QByteArray, QByteArray> result;
+    QList<QSharedPointer<ChecksumCalculator> > calculators;
+    foreach (const QByteArray& checksumType, checksumTypes) {
+        if (checksumType == checkSumSha1TreeC) {
+            // Not part of the single pass: it reads the leaves in parallel.
+            QByteArray checksum = computeTreeChecksumInParallel(filePath);
+            if (!checksum.isNull()) {
+                result.insert(checksumType, checksum);
+            }
+            continue;
+        }
+        QSharedPointer<ChecksumCalculator> calculator(new ChecksumCalculator(checksumType));
+        if (!calculator->isValid()) {
+            // for an unknown checksum or no checksum, we're done right now
+            if( !checksumType.isEmpty() ) {
+                qDebug() << "Unknown checksum type:" << checksumType;
+            }
+            continue;
+        }
+        calculators.append(calculator);
     }
-#ifdef ZLIB_FOUND
-    else if( checksumType == checkSumAdlerC) {
-        return FileSystem::calcAdler32(filePath);
+
+    if (calculators.isEmpty()) {
+        return result;
     }
-#endif
-    // for an unknown checksum or no checksum, we're done right now
-    if( !checksumType.isEmpty() ) {
-        qDebug() << "Unknown checksum type:" << checksumType;
+    if (!FileSystem::readFileInBlocks(filePath, [&calculators](const char* data, qint64 size) {
+            foreach (const auto& calculator, calculators) {
+                calculator->addData(data, size);
+            }
+        })) {
+        qDebug() << "Could not read" << filePath << "to compute its checksum";
+        return result;
     }
-    return QByteArray();
+    foreach (const auto& calculator, calculators) {
+        result.insert(calculator->checksumType(), calculator->result());
+    }
+    return result;
 }
 
 void ComputeChecksum::slotCalculationDone()
 {
-    QByteArray checksum = _watcher.future().result();
+    QByteArray checksum = _watcher.future().result().value(_checksumType);
     if (!checksum.isNull()) {
         emit done(_checksumType, checksum);
     } else {
@@ -170,6 +441,52 @@ void ComputeChecksum::slotCalculationDone()
     }
 }
 
+ComputeBlockChecksums::ComputeBlockChecksums(QObject* parent)
+    : QObject(parent)
+{
+}
+
+void ComputeBlockChecksums::start(const QString& filePath, qint64 blockSize)
+{
+    connect( &_watcher, SIGNAL(finished()),
+             this, SLOT(slotCalculationDone()),
+             Qt::UniqueConnection );
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    _watcher.setFuture(QtConcurrent::run(checksumThreadPool(), &ComputeBlockChecksums::computeNow, filePath, blockSize));
+#else
+    _watcher.setFuture(QtConcurrent::run(&ComputeBlockChecksums::computeNow, filePath, blockSize));
+#endif
+}
+
+QByteArray ComputeBlockChecksums::computeNow(const QString& filePath, qint64 blockSize)
+{
+    QByteArray checksums;
+    QFile file(filePath);
+    QString error;
+    if (blockSize <= 0 || !FileSystem::openAndSeekFileSharedRead(&file, &error, 0)) {
+        qDebug() << "Could not read" << filePath << error;
+        return checksums;
+    }
+    QByteArray buf(blockSize, Qt::Uninitialized);
+    while (!file.atEnd()) {
+        qint64 size = file.read(buf.data(), buf.size());
+        if (size < 0) {
+            qDebug() << "Error reading" << filePath << file.errorString();
+            return QByteArray();
+        }
+        if (size == 0) {
+            break;
+        }
+        checksums.append(QCryptographicHash::hash(QByteArray::fromRawData(buf.constData(), size),
+                                                  QCryptographicHash::Sha1).toHex());
+    }
+    return checksums;
+}
+
+void ComputeBlockChecksums::slotCalculationDone()
+{
+    emit done(_watcher.future().result());
+}
 
 ValidateChecksumHeader::ValidateChecksumHeader(QObject *parent)
     : QObject(parent)
@@ -177,6 +494,12 @@ ValidateChecksumHeader::ValidateChecksumHeader(QObject *parent)
 }
 
 void ValidateChecksumHeader::start(const QString& filePath, const QByteArray& checksumHeader)
+{
+    start(filePath, checksumHeader, QMap<QByteArray, QByteArray>());
+}
+
+void ValidateChecksumHeader::start(const QString& filePath, const QByteArray& checksumHeader,
+                                   const QMap<QByteArray, QByteArray>& knownChecksums)
 {
     // If the incoming header is empty no validation can happen. Just continue.
     if( checksumHeader.isEmpty() ) {
@@ -190,6 +513,11 @@ void ValidateChecksumHeader::start(const QString& filePath, const QByteArray& ch
         return;
     }
 
+    if (knownChecksums.contains(_expectedChecksumType)) {
+        slotChecksumCalculated(_expectedChecksumType, knownChecksums.value(_expectedChecksumType));
+        return;
+    }
+
     auto calculator = new ComputeChecksum(this);
     calculator->setChecksumType(_expectedChecksumType);
     connect(calculator, SIGNAL(done(QByteArray,QByteArray)),
@@ -239,7 +567,7 @@ QByteArray CSyncChecksumHook::compute(const QString& path, int checksumTypeId)
         return QByteArray();
     }
 
-    QByteArray checksum = ComputeChecksum::computeNow(path, checksumType);
+    QByteArray checksum = computeLocalChecksumCached(_journal, path, checksumType);
     if (checksum.isNull()) {
         qDebug() << "Failed to compute checksum" << checksumType << "for" << path;
         return QByteArray();
@@ -248,5 +576,85 @@ QByteArray CSyncChecksumHook::compute(const QString& path, int checksumTypeId)
     return checksum;
 }
 
+QByteArray computeLocalChecksumCached(SyncJournalDb* journal,
+                                     const QString& filePath,
+                                     const QByteArray& checksumType)
+{
+    const quint64 inode = FileSystem::getInode(filePath);
+    const qint64 size = FileSystem::getSize(filePath);
+    const time_t modtime = FileSystem::getModTime(filePath);
+
+    QByteArray checksum = journal->getCachedLocalChecksum(inode, size, modtime, checksumType);
+    if (!checksum.isEmpty()) {
+        return checksum;
+    }
+
+    checksum = ComputeChecksum::computeNow(filePath, checksumType);
+
+    // Only cache it if the file did not change while it was read
+    if (!checksum.isEmpty() && !FileSystem::fileChanged(filePath, size, modtime)) {
+        journal->setCachedLocalChecksum(inode, size, modtime, checksumType, checksum);
+    }
+    return checksum;
+}
+
+BackgroundChecksumHasher::BackgroundChecksumHasher(SyncJournalDb* journal, const QString& localPath,
+                                                   const QByteArray& checksumType, QObject* parent)
+    : QThread(parent)
+    , _journal(journal)
+    , _localPath(localPath)
+    , _checksumType(checksumType)
+    , _abort(0)
+    , _hashedFileCount(0)
+{
+    if (!_localPath.endsWith(QLatin1Char('/'))) {
+        _localPath.append(QLatin1Char('/'));
+    }
+}
+
+void BackgroundChecksumHasher::abort()
+{
+    _abort.fetchAndStoreOrdered(1);
+}
+
+void BackgroundChecksumHasher::run()
+{
+    // Page through the journal, so an abort doesn't wait for a full
+    // listing of a large folder
+    static const int batchSize = 500;
+    qDebug() << "Background hashing of the files in" << _localPath;
+
+    QString lastPath;
+    while (!_abort.fetchAndAddRelaxed(0)) {
+        const QStringList files = _journal->getFilesWithoutCachedLocalChecksum(_checksumType, lastPath, batchSize);
+        foreach (const QString& file, files) {
+            if (_abort.fetchAndAddRelaxed(0)) {
+                break;
+            }
+            const QString filePath = _localPath + file;
+            if (!FileSystem::fileExists(filePath)) {
+                continue;
+            }
+
+            if (!computeLocalChecksumCached(_journal, filePath, _checksumType).isEmpty()) {
+                ++_hashedFileCount;
+            }
+        }
+        if (files.count() < batchSize) {
+            break;
+        }
+        lastPath = files.last();
+    }
+
+    // A sync may own the journal's transaction once we were aborted
+    if (_abort.fetchAndAddRelaxed(0)) {
+        qDebug() << "Background hashing aborted after" << _hashedFileCount << "files";
+        return;
+    }
+    if (_hashedFileCount > 0) {
+        _journal->commit("background hashing");
+    }
+}
+
 
 }
@@ -19,7 +19,12 @@
 
 #include <QObject>
 #include <QByteArray>
+#include <QCryptographicHash>
 #include <QFutureWatcher>
+#include <QMap>
+#include <QScopedPointer>
+#include <QThread>
+#include <QAtomicInt>
 
 namespace OCC {
 
@@ -31,6 +36,15 @@ QByteArray makeChecksumHeader(const QByteArray& checksumType, const QByteArray&
 /// Parses a checksum header
 bool parseChecksumHeader(const QByteArray& header, QByteArray* type, QByteArray* checksum);
 
+/**
+ * Parses a block map, as the server publishes them for delta downloads.
+ *
+ * The format is "<block size>:<sha1>,<sha1>,..." with the hex SHA1 of every
+ * block of the file. The checksums are returned concatenated, the way
+ * ComputeBlockChecksums and SyncJournalDb::BlockSignatures have them.
+ */
+bool parseBlockMap(const QByteArray& blockMap, qint64* blockSize, QByteArray* checksums);
+
 /// Checks OWNCLOUD_DISABLE_CHECKSUM_UPLOAD
 bool uploadChecksumEnabled();
 
@@ -38,6 +52,46 @@ bool uploadChecksumEnabled();
 QByteArray contentChecksumType();
 
 
+/**
+ * Computes a checksum incrementally from data that is passed in pieces.
+ *
+ * Used to checksum a file while it is being transferred, so that it does not
+ * need to be read again afterwards.
+ * \ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ChecksumCalculator
+{
+public:
+    explicit ChecksumCalculator(const QByteArray& checksumType);
+    ~ChecksumCalculator();
+
+    QByteArray checksumType() const { return _checksumType; }
+
+    /// Returns false if the checksum type is not supported.
+    bool isValid() const;
+
+    void addData(const char* data, qint64 length);
+
+    /// The checksum of all data added so far, as computeNow() would return it.
+    QByteArray result() const;
+
+    /// The size of the blocks whose hashes make up a SHA1Tree checksum.
+    static const qint64 treeLeafSize = 1024 * 1024;
+
+private:
+    Q_DISABLE_COPY(ChecksumCalculator)
+
+    QByteArray _checksumType;
+    QScopedPointer<QCryptographicHash> _cryptoHash;
+    bool _useAdler;
+    unsigned long _adler;
+
+    // For SHA1Tree, _cryptoHash hashes the current leaf
+    bool _useTree;
+    qint64 _treeLeafFill; // bytes in the current leaf
+    QByteArray _treeLeafDigests; // of the complete leaves
+};
+
 /**
  * Computes the checksum of a file.
  * \ingroup libsync
@@ -55,6 +109,13 @@ public:
 
     QByteArray checksumType() const;
 
+    /**
+     * Sets checksum types that are computed in the same pass over the file.
+     *
+     * Their values are available from checksums() once done() is emitted.
+     */
+    void setExtraChecksumTypes(const QList<QByteArray>& types);
+
     /**
      * Computes the checksum for the given file path.
      *
@@ -62,11 +123,23 @@ public:
      */
     void start(const QString& filePath);
 
+    /**
+     * All checksums that were computed, by type. Unknown types are left out.
+     */
+    QMap<QByteArray, QByteArray> checksums() const;
+
     /**
      * Computes the checksum synchronously.
      */
     static QByteArray computeNow(const QString& filePath, const QByteArray& checksumType);
 
+    /**
+     * Computes checksums of several types synchronously, reading the file only once.
+     *
+     * Unknown types are left out of the result.
+     */
+    static QMap<QByteArray, QByteArray> computeNow(const QString& filePath, const QList<QByteArray>& checksumTypes);
+
 signals:
     void done(const QByteArray& checksumType, const QByteArray& checksum);
 
@@ -75,7 +148,44 @@ private slots:
 
 private:
     QByteArray _checksumType;
+    QList<QByteArray> _extraChecksumTypes;
 
+    // watcher for the checksum calculation thread
+    QFutureWatcher<QMap<QByteArray, QByteArray> > _watcher;
+};
+
+/**
+ * Computes the SHA1 of every block of a file, for delta transfers.
+ * \ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ComputeBlockChecksums : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ComputeBlockChecksums(QObject* parent = 0);
+
+    /**
+     * Hashes the file in blocks of \a blockSize bytes, the last one may be shorter.
+     *
+     * done() is emitted when the calculation finishes.
+     */
+    void start(const QString& filePath, qint64 blockSize);
+
+    /**
+     * Computes the block checksums synchronously.
+     *
+     * Returns the hex SHA1 of the blocks, concatenated. Empty if the file
+     * could not be read.
+     */
+    static QByteArray computeNow(const QString& filePath, qint64 blockSize);
+
+signals:
+    void done(const QByteArray& checksums);
+
+private slots:
+    void slotCalculationDone();
+
+private:
     // watcher for the checksum calculation thread
     QFutureWatcher<QByteArray> _watcher;
 };
@@ -99,6 +209,15 @@ public:
      */
     void start(const QString& filePath, const QByteArray& checksumHeader);
 
+    /**
+     * Same as above, but if \a knownChecksums has a checksum of the expected
+     * type for the file, that one is compared instead of reading the file.
+     *
+     * The map goes from checksum type to checksum.
+     */
+    void start(const QString& filePath, const QByteArray& checksumHeader,
+               const QMap<QByteArray, QByteArray>& knownChecksums);
+
 signals:
     void validated(const QByteArray& checksumType, const QByteArray& checksum);
     void validationFailed( const QString& errMsg );
@@ -136,4 +255,47 @@ private:
     SyncJournalDb* _journal;
 };
 
+/**
+ * Returns the content checksum of a local file, using the journal's local
+ * checksum cache if the file's inode, size and modtime are unchanged.
+ *
+ * On a cache miss the file is hashed and the result is cached.
+ */
+OWNCLOUDSYNC_EXPORT QByteArray computeLocalChecksumCached(SyncJournalDb* journal,
+                                                          const QString& filePath,
+                                                          const QByteArray& checksumType);
+
+/**
+ * @brief Fills the local checksum cache in the background
+ *
+ * Hashes the files of a sync folder that have no cached content checksum
+ * yet, in a low priority thread. Started when a sync is done, so the next
+ * syncs find the checksums in the journal instead of reading the files.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT BackgroundChecksumHasher : public QThread
+{
+    Q_OBJECT
+public:
+    BackgroundChecksumHasher(SyncJournalDb* journal, const QString& localPath,
+                             const QByteArray& checksumType, QObject* parent = 0);
+
+    /// Makes the thread stop after the current file. Does not wait for it.
+    void abort();
+
+    /// The number of files whose checksums are in the cache now.
+    int hashedFileCount() const { return _hashedFileCount; }
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    SyncJournalDb* _journal;
+    QString _localPath; // ends with '/'
+    QByteArray _checksumType;
+    QAtomicInt _abort;
+    int _hashedFileCount;
+};
+
 }
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "compression.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QSet>
+#include <QStringList>
+
+#include <cstring>
+
+#ifdef ZLIB_FOUND
+#include <zlib.h>
+#endif
+
+/** \file compression.cpp
+ *
+ * \brief Compressing file transfers on the wire
+ *
+ * Uploads are sent with "Content-Encoding: gzip" if the server lists gzip
+ * in files/uploadContentEncodings. Every chunk is compressed on its own, see
+ * UploadDevice::compressData(); the OC-Total-Length and checksum headers
+ * still describe the uncompressed file.
+ *
+ * Downloads ask for "Accept-Encoding: gzip" and GETFileJob decodes the body
+ * while it writes it. Range requests are never compressed: their offsets
+ * refer to the file itself.
+ *
+ * Both need zlib, the account's transferCompressionEnabled() and a file
+ * that isCompressibleFile().
+ */
+
+namespace OCC {
+
+bool transferCompressionSupported()
+{
+#ifdef ZLIB_FOUND
+    static bool enabled = qgetenv("OWNCLOUD_DISABLE_COMPRESSION").isEmpty();
+    return enabled;
+#else
+    return false;
+#endif
+}
+
+static QSet<QString> incompressibleExtensions()
+{
+    static const char* const builtin[] = {
+        "7z", "aac", "apk", "avi", "bz2", "cab", "deb", "dmg", "docx", "epub",
+        "flac", "gif", "gz", "heic", "jar", "jpeg", "jpg", "lz", "lzma", "m4a",
+        "m4v", "mkv", "mov", "mp3", "mp4", "odg", "odp", "ods", "odt", "ogg",
+        "opus", "png", "pptx", "rar", "rpm", "tgz", "txz", "webm", "webp", "xlsx",
+        "xz", "zip", "zst"
+    };
+    QSet<QString> extensions;
+    for (const char* extension : builtin) {
+        extensions.insert(QLatin1String(extension));
+    }
+    foreach (const QString& extension, QString::fromLocal8Bit(qgetenv("OWNCLOUD_COMPRESSION_SKIP_EXTENSIONS"))
+                 .split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        extensions.insert(extension.trimmed().toLower());
+    }
+    return extensions;
+}
+
+bool isCompressibleFile(const QString& fileName)
+{
+    static const QSet<QString> skipped = incompressibleExtensions();
+    return !skipped.contains(QFileInfo(fileName).suffix().toLower());
+}
+
+QByteArray gzipCompress(const QByteArray& data)
+{
+    QByteArray result;
+#ifdef ZLIB_FOUND
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 16 + MAX_WBITS makes zlib write a gzip header and trailer
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return result;
+    }
+    result.resize(deflateBound(&stream, data.size()));
+    stream.next_in = (Bytef*) data.constData();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef*) result.data();
+    stream.avail_out = result.size();
+    const int status = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (status != Z_STREAM_END) {
+        qDebug() << "Could not compress" << data.size() << "bytes:" << status;
+        return QByteArray();
+    }
+    result.resize(stream.total_out);
+#else
+    Q_UNUSED(data);
+#endif
+    return result;
+}
+
+QByteArray inflateRaw(const QByteArray& data, qint64 size)
+{
+#ifdef ZLIB_FOUND
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // A negative window size means there is no zlib header
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return QByteArray();
+    }
+    QByteArray result(size, Qt::Uninitialized);
+    stream.next_in = (Bytef*) data.constData();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef*) result.data();
+    stream.avail_out = result.size();
+    const int status = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    if (status != Z_STREAM_END || qint64(stream.total_out) != size) {
+        qDebug() << "Could not inflate" << data.size() << "bytes:" << status;
+        return QByteArray();
+    }
+    if (result.isNull()) {
+        result = QByteArray("");
+    }
+    return result;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    return QByteArray();
+#endif
+}
+
+struct ContentDecoder::Private
+{
+#ifdef ZLIB_FOUND
+    z_stream _stream;
+#endif
+    bool _valid;
+    bool _atEnd;
+};
+
+ContentDecoder::ContentDecoder(const QByteArray& contentEncoding)
+    : _d(new Private)
+{
+    _d->_valid = false;
+    _d->_atEnd = false;
+#ifdef ZLIB_FOUND
+    const QByteArray encoding = contentEncoding.trimmed().toLower();
+    if (encoding == "gzip" || encoding == "x-gzip" || encoding == "deflate") {
+        memset(&_d->_stream, 0, sizeof(_d->_stream));
+        // 32 + MAX_WBITS detects both the gzip and the zlib header
+        _d->_valid = inflateInit2(&_d->_stream, 32 + MAX_WBITS) == Z_OK;
+    }
+#else
+    Q_UNUSED(contentEncoding);
+#endif
+}
+
+ContentDecoder::~ContentDecoder()
+{
+#ifdef ZLIB_FOUND
+    if (_d->_valid) {
+        inflateEnd(&_d->_stream);
+    }
+#endif
+}
+
+bool ContentDecoder::isValid() const
+{
+    return _d->_valid;
+}
+
+bool ContentDecoder::addData(const char* data, qint64 length, QByteArray* out)
+{
+#ifdef ZLIB_FOUND
+    if (!_d->_valid) {
+        return false;
+    }
+    z_stream& stream = _d->_stream;
+    stream.next_in = (Bytef*) data;
+    stream.avail_in = length;
+    char buffer[16 * 1024];
+    while (stream.avail_in > 0 && !_d->_atEnd) {
+        stream.next_out = (Bytef*) buffer;
+        stream.avail_out = sizeof(buffer);
+        const int status = inflate(&stream, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END) {
+            qDebug() << "Corrupt compressed data:" << status;
+            return false;
+        }
+        out->append(buffer, sizeof(buffer) - stream.avail_out);
+        _d->_atEnd = status == Z_STREAM_END;
+    }
+    // Output that did not fit in the buffer is still pending
+    while (!_d->_atEnd && stream.avail_out == 0) {
+        stream.next_out = (Bytef*) buffer;
+        stream.avail_out = sizeof(buffer);
+        const int status = inflate(&stream, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+            qDebug() << "Corrupt compressed data:" << status;
+            return false;
+        }
+        out->append(buffer, sizeof(buffer) - stream.avail_out);
+        _d->_atEnd = status == Z_STREAM_END;
+    }
+    return true;
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(length);
+    Q_UNUSED(out);
+    return false;
+#endif
+}
+
+bool ContentDecoder::atEnd() const
+{
+    return _d->_atEnd;
+}
+
+}
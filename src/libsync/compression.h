@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "config.h"
+#include "owncloudlib.h"
+
+#include <QByteArray>
+#include <QScopedPointer>
+#include <QString>
+
+namespace OCC {
+
+/**
+ * Whether file transfers can be compressed at all.
+ *
+ * Needs zlib. Checks OWNCLOUD_DISABLE_COMPRESSION.
+ */
+OWNCLOUDSYNC_EXPORT bool transferCompressionSupported();
+
+/**
+ * Whether a file is worth compressing for its transfer.
+ *
+ * Files in formats that are compressed already, like archives, images,
+ * audio, video and office documents, are not. More extensions can be
+ * given in OWNCLOUD_COMPRESSION_SKIP_EXTENSIONS, separated by commas.
+ */
+OWNCLOUDSYNC_EXPORT bool isCompressibleFile(const QString& fileName);
+
+/**
+ * Compresses data for a body sent with "Content-Encoding: gzip".
+ *
+ * Returns an empty array if that is not possible.
+ */
+OWNCLOUDSYNC_EXPORT QByteArray gzipCompress(const QByteArray& data);
+
+/**
+ * Inflates raw deflate data without header, like the entries of a zip
+ * archive, of which \a size is the inflated size.
+ *
+ * Returns a null array if the data is corrupt or zlib is missing.
+ */
+OWNCLOUDSYNC_EXPORT QByteArray inflateRaw(const QByteArray& data, qint64 size);
+
+/**
+ * Decodes a gzip or deflate encoded body piece by piece, as it is received.
+ * \ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ContentDecoder
+{
+public:
+    /// \a contentEncoding is the value of the Content-Encoding header.
+    explicit ContentDecoder(const QByteArray& contentEncoding);
+    ~ContentDecoder();
+
+    /// Returns false if the encoding is not supported.
+    bool isValid() const;
+
+    /**
+     * Appends the decoded form of \a data to \a out.
+     *
+     * Returns false if the data is corrupt.
+     */
+    bool addData(const char* data, qint64 length, QByteArray* out);
+
+    /// Whether the end of the encoded data was seen.
+    bool atEnd() const;
+
+private:
+    Q_DISABLE_COPY(ContentDecoder)
+
+    struct Private;
+    QScopedPointer<Private> _d;
+};
+
+}
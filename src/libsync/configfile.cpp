@@ -64,6 +64,7 @@ static const char useUploadLimitC[]   = "BWLimit/useUploadLimit";
 static const char useDownloadLimitC[] = "BWLimit/useDownloadLimit";
 static const char uploadLimitC[]      = "BWLimit/uploadLimit";
 static const char downloadLimitC[]    = "BWLimit/downloadLimit";
+static const char totalLimitC[]       = "BWLimit/totalLimit";
 
 static const char newBigFolderSizeLimitC[] = "newBigFolderSizeLimit";
 static const char useNewBigFolderSizeLimitC[] = "useNewBigFolderSizeLimit";
@@ -582,6 +583,16 @@ void ConfigFile::setDownloadLimit(int kbytes)
     setValue(downloadLimitC, kbytes);
 }
 
+int ConfigFile::totalLimit() const
+{
+    return getValue(totalLimitC, QString::null, 0).toInt();
+}
+
+void ConfigFile::setTotalLimit(int kbytes)
+{
+    setValue(totalLimitC, kbytes);
+}
+
 QPair<bool, quint64> ConfigFile::newBigFolderSizeLimit() const
 {
     auto defaultValue = Theme::instance()->newBigFolderSizeLimit();
@@ -102,6 +102,9 @@ public:
     int downloadLimit() const;
     void setUploadLimit(int kbytes);
     void setDownloadLimit(int kbytes);
+    /** for uploads and downloads together, in kbyte/s. 0: no limit */
+    int totalLimit() const;
+    void setTotalLimit(int kbytes);
     /** [checked, size in MB] **/
     QPair<bool, quint64> newBigFolderSizeLimit() const;
     void setNewBigFolderSizeLimit(bool isChecked, quint64 mbytes);
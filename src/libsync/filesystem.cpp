@@ -174,6 +174,19 @@ time_t FileSystem::getModTime(const QString &filename)
     return result;
 }
 
+quint64 FileSystem::getInode(const QString &filename)
+{
+    csync_vio_file_stat_t* stat = csync_vio_file_stat_new();
+    quint64 result = 0;
+    if (csync_vio_local_stat(filename.toUtf8().data(), stat) != -1) {
+        result = stat->inode;
+    } else {
+        qDebug() << "Could not get inode for" << filename;
+    }
+    csync_vio_file_stat_destroy(stat);
+    return result;
+}
+
 bool FileSystem::setModTime(const QString& filename, time_t modTime)
 {
     struct timeval times[2];
@@ -499,25 +512,39 @@ QString FileSystem::fileSystemForPath(const QString & path)
 
 #define BUFSIZE qint64(500*1024)  // 500 KiB
 
-static QByteArray readToCrypto( const QString& filename, QCryptographicHash::Algorithm algo )
+bool FileSystem::readFileInBlocks( const QString& filename,
+                                   const std::function<void(const char*, qint64)>& processData )
 {
     QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
     const qint64 bufSize = qMin(BUFSIZE, file.size() + 1);
     QByteArray buf(bufSize, Qt::Uninitialized);
-    QByteArray arr;
-    QCryptographicHash crypto( algo );
 
-    if (file.open(QIODevice::ReadOnly)) {
-        qint64 size;
-        while (!file.atEnd()) {
-            size = file.read( buf.data(), bufSize );
-            if( size > 0 ) {
-                crypto.addData(buf.data(), size);
-            }
+    qint64 size;
+    while (!file.atEnd()) {
+        size = file.read( buf.data(), bufSize );
+        if( size < 0 ) {
+            qDebug() << "Error reading" << filename << file.errorString();
+            return false;
+        }
+        if( size > 0 ) {
+            processData(buf.constData(), size);
         }
-        arr = crypto.result().toHex();
     }
-    return arr;
+    return true;
+}
+
+static QByteArray readToCrypto( const QString& filename, QCryptographicHash::Algorithm algo )
+{
+    QCryptographicHash crypto( algo );
+    if (!FileSystem::readFileInBlocks(filename, [&crypto](const char* data, qint64 size) {
+            crypto.addData(data, size);
+        })) {
+        return QByteArray();
+    }
+    return crypto.result().toHex();
 }
 
 QByteArray FileSystem::calcMd5( const QString& filename )
@@ -533,18 +560,11 @@ QByteArray FileSystem::calcSha1( const QString& filename )
 #ifdef ZLIB_FOUND
 QByteArray FileSystem::calcAdler32( const QString& filename )
 {
-    QFile file(filename);
-    const qint64 bufSize = qMin(BUFSIZE, file.size() + 1);
-    QByteArray buf(bufSize, Qt::Uninitialized);
-
     unsigned int adler = adler32(0L, Z_NULL, 0);
-    if (file.open(QIODevice::ReadOnly)) {
-        qint64 size;
-        while (!file.atEnd()) {
-            size = file.read(buf.data(), bufSize);
-            if( size > 0 )
-                adler = adler32(adler, (const Bytef*) buf.data(), size);
-        }
+    if (!readFileInBlocks(filename, [&adler](const char* data, qint64 size) {
+            adler = adler32(adler, (const Bytef*) data, size);
+        })) {
+        return QByteArray();
     }
 
     return QByteArray::number( adler, 16 );
@@ -17,6 +17,7 @@
 
 #include <QString>
 #include <ctime>
+#include <functional>
 #include <QCryptographicHash>
 #include <QFileInfo>
 
@@ -87,6 +88,13 @@ bool setModTime(const QString &filename, time_t modTime);
  */
 qint64 OWNCLOUDSYNC_EXPORT getSize(const QString& filename);
 
+/**
+ * @brief Get the inode for a file
+ *
+ * On Windows this is the file index. Returns 0 if it can't be determined.
+ */
+quint64 OWNCLOUDSYNC_EXPORT getInode(const QString& filename);
+
 /**
  * @brief Checks whether a file exists.
  *
@@ -171,6 +179,15 @@ bool openAndSeekFileSharedRead(QFile* file, QString* error, qint64 seek);
 QString fileSystemForPath(const QString & path);
 #endif
 
+/**
+ * Reads the whole file once and passes the data to \a processData, block by block.
+ *
+ * Used to compute several checksums with a single pass over the file.
+ * Returns false if the file could not be opened or read completely.
+ */
+bool OWNCLOUDSYNC_EXPORT readFileInBlocks( const QString& fileName,
+                                           const std::function<void(const char* data, qint64 size)>& processData );
+
 QByteArray OWNCLOUDSYNC_EXPORT calcMd5( const QString& fileName );
 QByteArray OWNCLOUDSYNC_EXPORT calcSha1( const QString& fileName );
 #ifdef ZLIB_FOUND
@@ -17,7 +17,9 @@
 #include "syncjournaldb.h"
 #include "syncjournalfilerecord.h"
 #include "propagatedownload.h"
+#include "propagatedownloadarchive.h"
 #include "propagateupload.h"
+#include "propagateuploadbundle.h"
 #include "propagateremotedelete.h"
 #include "propagateremotemove.h"
 #include "propagateremotemkdir.h"
@@ -25,6 +27,7 @@
 #include "configfile.h"
 #include "utility.h"
 #include "account.h"
+#include "compression.h"
 #include <json.h>
 
 #ifdef Q_OS_WIN
@@ -68,8 +71,20 @@ qint64 freeSpaceLimit()
     return value;
 }
 
+/** The propagators of all the folders that are currently syncing.
+ *
+ * They share the budget of globalMaximumActiveJob(). Only used from the main thread.
+ */
+static QList<OwncloudPropagator*> &runningPropagators()
+{
+    static QList<OwncloudPropagator*> list;
+    return list;
+}
+
 OwncloudPropagator::~OwncloudPropagator()
-{}
+{
+    releaseGlobalBudget();
+}
 
 /* The maximum number of active jobs in parallel  */
 int OwncloudPropagator::maximumActiveJob()
@@ -79,11 +94,8 @@ int OwncloudPropagator::maximumActiveJob()
         max = 3; //default
     }
 
-    if (_downloadLimit.fetchAndAddAcquire(0) != 0 || _uploadLimit.fetchAndAddAcquire(0) != 0) {
-        // disable parallelism when there is a network limit.
-        return 1;
-    }
-
+    // Bandwidth limits don't reduce the parallelism: the BandwidthManager
+    // shares the quota between all running transfers.
     return max;
 }
 
@@ -91,9 +103,66 @@ int OwncloudPropagator::hardMaximumActiveJob()
 {
     int max = maximumActiveJob();
     return max*2;
-    // FIXME: Wondering if we should hard-limit to 1 if maximumActiveJob() is 1
-    // to support our old use case of limiting concurrency (when "automatic" bandwidth
-    // limiting is set. But this causes https://github.com/owncloud/client/issues/4081
+}
+
+int OwncloudPropagator::globalMaximumActiveJob()
+{
+    static int max = qgetenv("OWNCLOUD_MAX_PARALLEL_GLOBAL").toUInt();
+    if (!max) {
+        // A single sync still gets hardMaximumActiveJob(), several ones
+        // running at once get a bit less each.
+        max = hardMaximumActiveJob() + maximumActiveJob();
+    }
+    return max;
+}
+
+int OwncloudPropagator::globalBudgetShare()
+{
+    const int running = qMax(1, runningPropagators().count());
+    return qBound(1, globalMaximumActiveJob() / running, hardMaximumActiveJob());
+}
+
+void OwncloudPropagator::releaseGlobalBudget()
+{
+    if (!runningPropagators().removeOne(this)) {
+        return;
+    }
+    // The share of the others got bigger, let them make use of it
+    foreach (OwncloudPropagator *other, runningPropagators()) {
+        QTimer::singleShot(0, other, SLOT(scheduleNextJob()));
+    }
+}
+
+int OwncloudPropagator::transferLaneBudget(PropagatorJob::TransferLane lane)
+{
+    // Small jobs finish quickly and may use all of hardMaximumActiveJob(),
+    // as they could before there were lanes. With the default of 3 this
+    // gives 6 small, 2 medium and 1 large transfer.
+    const int max = maximumActiveJob();
+    const int large = qMax(1, max / 3);
+    switch (lane) {
+    case PropagatorJob::SmallTransferLane:
+        return hardMaximumActiveJob();
+    case PropagatorJob::MediumTransferLane:
+        return qMax(1, max - large);
+    case PropagatorJob::LargeTransferLane:
+        return large;
+    case PropagatorJob::TransferLaneCount:
+        break;
+    }
+    return max;
+}
+
+PropagatorJob::TransferLane OwncloudPropagator::transferLaneForSize(quint64 size)
+{
+    // Small files are sent in a single request, large ones need many chunks
+    if (size < 1000 * 1000) {
+        return PropagatorJob::SmallTransferLane;
+    }
+    if (size < 10 * chunkSize()) {
+        return PropagatorJob::MediumTransferLane;
+    }
+    return PropagatorJob::LargeTransferLane;
 }
 
 
@@ -115,8 +184,23 @@ static bool blacklistCheck(SyncJournalDb* journal, const SyncFileItem& item)
     return newEntry.isValid();
 }
 
+bool PropagateItemJob::scheduleNextJob()
+{
+    if (_state != NotYetStarted) {
+        return false;
+    }
+    _state = Running;
+    _runningInLane = transferLane();
+    _propagator->_runningJobsInLane[_runningInLane]++;
+    QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
+    return true;
+}
+
 void PropagateItemJob::done(SyncFileItem::Status status, const QString &errorString)
 {
+    if (_state == Running) {
+        _propagator->_runningJobsInLane[_runningInLane]--;
+    }
     _state = Finished;
     if (_item->_isRestoration) {
         if( status == SyncFileItem::Success || status == SyncFileItem::Conflict) {
@@ -303,6 +387,8 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
     directories.push(qMakePair(QString(), _rootJob.data()));
     QVector<PropagatorJob*> directoriesToRemove;
     QString removedDirectory;
+    QHash<PropagateDirectory*, PropagateUploadBundle*> bundles;
+    QHash<PropagateDirectory*, PropagateDownloadArchive*> archives;
     foreach(const SyncFileItemPtr &item, items) {
 
         if (!removedDirectory.isEmpty() && item->_file.startsWith(removedDirectory)) {
@@ -343,7 +429,7 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
 
         if (item->_isDirectory) {
             PropagateDirectory *dir = new PropagateDirectory(this, item);
-            dir->_firstJob.reset(createJob(item));
+            dir->setFirstJob(createJob(item));
 
             if (item->_instruction == CSYNC_INSTRUCTION_TYPE_CHANGE
                     && item->_direction == SyncFileItem::Up) {
@@ -384,6 +470,26 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
                 // will delete directories, so defer execution
                 directoriesToRemove.prepend(current);
                 removedDirectory = item->_file + "/";
+            } else if (PropagateUploadBundle::canBundle(this, *item)) {
+                // New small files of a directory are uploaded together
+                PropagateDirectory *dir = directories.top().second;
+                PropagateUploadBundle *&bundle = bundles[dir];
+                PropagateUploadFile *upload = static_cast<PropagateUploadFile*>(current);
+                if (!bundle || !bundle->append(upload)) {
+                    bundle = new PropagateUploadBundle(this);
+                    bundle->append(upload);
+                    dir->append(bundle);
+                }
+            } else if (PropagateDownloadArchive::canBundle(this, *item)) {
+                // New small files of a directory are downloaded together
+                PropagateDirectory *dir = directories.top().second;
+                PropagateDownloadArchive *&archive = archives[dir];
+                PropagateDownloadFile *download = static_cast<PropagateDownloadFile*>(current);
+                if (!archive || !archive->append(download)) {
+                    archive = new PropagateDownloadArchive(this);
+                    archive->append(download);
+                    dir->append(archive);
+                }
             } else {
                 directories.top().second->append(current);
             }
@@ -402,6 +508,7 @@ void OwncloudPropagator::start(const SyncFileItemVector& items)
 
     qDebug() << "Using QNAM/HTTP parallel code path";
 
+    runningPropagators().append(this);
     QTimer::singleShot(0, this, SLOT(scheduleNextJob()));
 }
 
@@ -447,6 +554,21 @@ quint64 OwncloudPropagator::chunkSize()
     return chunkSize;
 }
 
+bool OwncloudPropagator::compressDownload(const QString& file) const
+{
+    return transferCompressionSupported()
+        && _account->transferCompressionEnabled()
+        && isCompressibleFile(file);
+}
+
+bool OwncloudPropagator::compressUpload(const QString& file) const
+{
+    return transferCompressionSupported()
+        && _account->transferCompressionEnabled()
+        && _account->capabilities().supportedUploadContentEncodings().contains("gzip")
+        && isCompressibleFile(file);
+}
+
 
 bool OwncloudPropagator::localFileNameClash( const QString& relFile )
 {
@@ -513,30 +635,29 @@ void OwncloudPropagator::scheduleNextJob()
     // Down-scaling on slow networks? https://github.com/owncloud/client/issues/3382
     // Making sure we do up/down at same time? https://github.com/owncloud/client/issues/1633
 
-    if (_activeJobList.count() < maximumActiveJob()) {
+    // Which job may start is decided by the budget of its transfer lane (see
+    // transferLaneBudget()), this only caps the total number of requests.
+    // Folders syncing at the same time split the global budget between them.
+    if (_activeJobList.count() < globalBudgetShare()) {
         if (_rootJob->scheduleNextJob()) {
             QTimer::singleShot(0, this, SLOT(scheduleNextJob()));
         }
-    } else if (_activeJobList.count() < hardMaximumActiveJob()) {
-        int likelyFinishedQuicklyCount = 0;
-        // NOTE: Only counts the first 3 jobs! Then for each
-        // one that is likely finished quickly, we can launch another one.
-        // When a job finishes another one will "move up" to be one of the first 3 and then
-        // be counted too.
-        for (int i = 0; i < maximumActiveJob() && i < _activeJobList.count(); i++) {
-            if (_activeJobList.at(i)->isLikelyFinishedQuickly()) {
-                likelyFinishedQuicklyCount++;
-            }
-        }
-        if (_activeJobList.count() < maximumActiveJob() + likelyFinishedQuicklyCount) {
-            qDebug() <<  "Can pump in another request! activeJobs =" << _activeJobList.count();
-            if (_rootJob->scheduleNextJob()) {
-                QTimer::singleShot(0, this, SLOT(scheduleNextJob()));
-            }
-        }
     }
 }
 
+bool OwncloudPropagator::prioritize(const QString &path)
+{
+    if (!_rootJob || _finishedEmited) {
+        return false;
+    }
+    if (!_rootJob->prioritize(path)) {
+        return false;
+    }
+    qDebug() << "Prioritized" << path;
+    QTimer::singleShot(0, this, SLOT(scheduleNextJob()));
+    return true;
+}
+
 AccountPtr OwncloudPropagator::account() const
 {
     return _account;
@@ -562,24 +683,48 @@ OwncloudPropagator::DiskSpaceResult OwncloudPropagator::diskSpaceCheck() const
 
 // ================================================================================
 
-PropagatorJob::JobParallelism PropagateDirectory::parallelism()
+void PropagateDirectory::setFirstJob(PropagateItemJob *job)
 {
-    // If any of the non-finished sub jobs is not parallel, we have to wait
-
-    // FIXME!  we should probably cache this result
+    if (_firstJob && _firstJob->_state != Finished && _firstJob->parallelism() != FullParallelism) {
+        adjustBlockingJobs(-1);
+    }
+    _firstJob.reset(job);
+    if (job && job->parallelism() != FullParallelism) {
+        adjustBlockingJobs(1);
+    }
+}
 
-    if (_firstJob && _firstJob->_state != Finished) {
-        if (_firstJob->parallelism() != FullParallelism)
-            return WaitForFinished;
+void PropagateDirectory::append(PropagatorJob *subJob)
+{
+    _subJobs.append(subJob);
+
+    // The parallelism of items does not change over time, so it can be
+    // accounted for once. Sub directories bring their own count along and
+    // report any later change to us via adjustBlockingJobs().
+    int blocking = 0;
+    if (PropagateDirectory *dir = qobject_cast<PropagateDirectory*>(subJob)) {
+        dir->_parentDirectory = this;
+        blocking = dir->_blockingJobs;
+    } else if (subJob->parallelism() != FullParallelism) {
+        blocking = 1;
     }
+    if (blocking) {
+        adjustBlockingJobs(blocking);
+    }
+}
 
-    // FIXME: use the cached value of finished job
-    for (int i = 0; i < _subJobs.count(); ++i) {
-        if (_subJobs.at(i)->_state != Finished && _subJobs.at(i)->parallelism() != FullParallelism) {
-            return WaitForFinished;
-        }
+void PropagateDirectory::adjustBlockingJobs(int delta)
+{
+    for (PropagateDirectory *dir = this; dir; dir = dir->_parentDirectory) {
+        dir->_blockingJobs += delta;
+        Q_ASSERT(dir->_blockingJobs >= 0);
     }
-    return FullParallelism;
+}
+
+PropagatorJob::JobParallelism PropagateDirectory::parallelism()
+{
+    // If any of the non-finished sub jobs is not parallel, we have to wait
+    return _blockingJobs > 0 ? WaitForFinished : FullParallelism;
 }
 
 
@@ -599,6 +744,9 @@ bool PropagateDirectory::scheduleNextJob()
     }
 
     if (_firstJob && _firstJob->_state == NotYetStarted) {
+        if (!_propagator->transferLaneHasCapacity(_firstJob->transferLane())) {
+            return false;
+        }
         return possiblyRunNextJob(_firstJob.data());
     }
 
@@ -606,24 +754,77 @@ bool PropagateDirectory::scheduleNextJob()
         return false;
     }
 
+    // First give the jobs that are already running (i.e. sub directories)
+    // a chance to start something. Finished jobs are only removed from
+    // the list once slotSubJobFinished is called, so skip them.
     bool stopAtDirectory = false;
-    // FIXME: use the cached value of finished job
-    for (int i = 0; i < _subJobs.count(); ++i) {
-        if (_subJobs.at(i)->_state == Finished) {
+    for (int i = 0; i < _runningJobs.count(); ++i) {
+        PropagatorJob *job = _runningJobs.at(i);
+        if (job->_state == Finished) {
             continue;
         }
 
-        if (stopAtDirectory && qobject_cast<PropagateDirectory*>(_subJobs.at(i))) {
+        if (possiblyRunNextJob(job)) {
+            return true;
+        }
+
+        Q_ASSERT(job->_state == Running);
+
+        auto paral = job->parallelism();
+        if (paral == WaitForFinished) {
+            return false;
+        }
+        if (paral == WaitForFinishedInParentDirectory) {
+            stopAtDirectory = true;
+        }
+    }
+
+    // Then the jobs that had to wait for a free slot in their lane
+    for (int lane = 0; lane < TransferLaneCount; ++lane) {
+        if (!_deferredJobs[lane].isEmpty()
+                && _propagator->transferLaneHasCapacity(TransferLane(lane))) {
+            PropagatorJob *next = _deferredJobs[lane].takeFirst();
+            _runningJobs.append(next);
+            if (possiblyRunNextJob(next)) {
+                return true;
+            }
+        }
+    }
+
+    // Then start the jobs that were not started yet, in order.
+    while (_nextJobIndex < _subJobs.count()) {
+        PropagatorJob *next = _subJobs.at(_nextJobIndex);
+        const bool isDirectory = qobject_cast<PropagateDirectory*>(next);
+
+        if (stopAtDirectory && isDirectory) {
             return false;
         }
 
-        if (possiblyRunNextJob(_subJobs.at(i))) {
+        if (!isDirectory) {
+            TransferLane lane = next->transferLane();
+            if (!_propagator->transferLaneHasCapacity(lane)) {
+                if (next->parallelism() != FullParallelism) {
+                    // Must not be overtaken, wait until the lane has room
+                    return false;
+                }
+                // Let the jobs behind it go first
+                _deferredJobs[lane].append(next);
+                _nextJobIndex++;
+                continue;
+            }
+        }
+
+        _nextJobIndex++;
+        _runningJobs.append(next);
+        if (possiblyRunNextJob(next)) {
             return true;
         }
 
-        Q_ASSERT(_subJobs.at(i)->_state == Running);
+        if (next->_state == Finished) {
+            continue;
+        }
 
-        auto paral = _subJobs.at(i)->parallelism();
+        auto paral = next->parallelism();
         if (paral == WaitForFinished) {
             return false;
         }
@@ -634,10 +835,95 @@ bool PropagateDirectory::scheduleNextJob()
     return false;
 }
 
+static QString jobDestination(PropagatorJob *job)
+{
+    if (PropagateDirectory *dir = qobject_cast<PropagateDirectory*>(job)) {
+        return dir->_item->destination();
+    }
+    if (PropagateItemJob *item = qobject_cast<PropagateItemJob*>(job)) {
+        return item->_item->destination();
+    }
+    return QString();
+}
+
+static bool jobContainsPath(PropagatorJob *job, const QString &path)
+{
+    if (PropagateBundle *bundle = qobject_cast<PropagateBundle*>(job)) {
+        return bundle->containsPath(path);
+    }
+    const QString destination = jobDestination(job);
+    if (destination.isEmpty()) {
+        return false;
+    }
+    return path == destination
+        || (qobject_cast<PropagateDirectory*>(job) && path.startsWith(destination + QLatin1Char('/')));
+}
+
+bool PropagateDirectory::prioritize(const QString &path)
+{
+    if (_state == Finished) {
+        return false;
+    }
+
+    // Running sub directories
+    foreach (PropagatorJob *job, _runningJobs) {
+        if (job->_state != Finished && jobContainsPath(job, path)) {
+            if (PropagateBundle *bundle = qobject_cast<PropagateBundle*>(job)) {
+                return bundle->prioritize(path);
+            }
+            PropagateDirectory *dir = qobject_cast<PropagateDirectory*>(job);
+            return dir && dir->prioritize(path);
+        }
+    }
+
+    // Jobs waiting for room in their lane
+    for (int lane = 0; lane < TransferLaneCount; ++lane) {
+        for (int i = 0; i < _deferredJobs[lane].count(); ++i) {
+            if (jobContainsPath(_deferredJobs[lane].at(i), path)) {
+                _deferredJobs[lane].move(i, 0);
+                return true;
+            }
+        }
+    }
+
+    // Jobs that were not started yet
+    for (int i = _nextJobIndex; i < _subJobs.count(); ++i) {
+        PropagatorJob *job = _subJobs.at(i);
+        if (jobContainsPath(job, path)) {
+            if (i != _nextJobIndex) {
+                _subJobs.remove(i);
+                _subJobs.insert(_nextJobIndex, job);
+            }
+            if (PropagateDirectory *dir = qobject_cast<PropagateDirectory*>(job)) {
+                dir->prioritize(path);
+            }
+            return true;
+        }
+        if (job->parallelism() != FullParallelism) {
+            // Can't move anything past this one
+            return false;
+        }
+    }
+    return false;
+}
+
 void PropagateDirectory::slotSubJobFinished(SyncFileItem::Status status)
 {
+    PropagatorJob *subJob = static_cast<PropagatorJob *>(sender());
+    _runningJobs.removeOne(subJob);
+
+    // Update the cached parallelism now that this job is out of the way.
+    if (PropagateDirectory *dir = qobject_cast<PropagateDirectory*>(subJob)) {
+        // Only non-zero if the sub directory was aborted
+        if (dir->_blockingJobs) {
+            dir->adjustBlockingJobs(-dir->_blockingJobs);
+        }
+    } else if (subJob->parallelism() != FullParallelism) {
+        adjustBlockingJobs(-1);
+    }
+
     if (status == SyncFileItem::FatalError ||
-            (sender() == _firstJob.data() && status != SyncFileItem::Success && status != SyncFileItem::Restoration)) {
+            (subJob == _firstJob.data() && status != SyncFileItem::Success && status != SyncFileItem::Restoration)) {
         abort();
         _state = Finished;
         emit finished(status);
@@ -704,13 +990,138 @@ void PropagateDirectory::finalize()
 
 qint64 PropagateDirectory::committedDiskSpace() const
 {
+    // Only running jobs commit disk space
     qint64 needed = 0;
-    foreach (PropagatorJob* job, _subJobs) {
+    foreach (PropagatorJob* job, _runningJobs) {
         needed += job->committedDiskSpace();
     }
     return needed;
 }
 
+// ================================================================================
+
+BundleRequestSlot::BundleRequestSlot(OwncloudPropagator *propagator, PropagateItemJob *job)
+    : _propagator(propagator)
+    , _job(job)
+{
+    _propagator->_runningJobsInLane[PropagatorJob::SmallTransferLane]++;
+    _propagator->_activeJobList.append(_job);
+}
+
+BundleRequestSlot::~BundleRequestSlot()
+{
+    _propagator->_runningJobsInLane[PropagatorJob::SmallTransferLane]--;
+    _propagator->_activeJobList.removeOne(_job);
+}
+
+PropagateBundle::~PropagateBundle()
+{
+    qDeleteAll(_subJobs);
+}
+
+int PropagateBundle::maxBundledFiles()
+{
+    static int max = 0;
+    if (!max) {
+        bool ok = false;
+        max = qgetenv("OWNCLOUD_MAX_BUNDLED_FILES").toInt(&ok);
+        if (!ok) {
+            max = 100;
+        }
+    }
+    return max;
+}
+
+void PropagateBundle::appendJob(PropagateItemJob *job)
+{
+    _subJobs.append(job);
+    connect(job, SIGNAL(finished(SyncFileItem::Status)), this, SLOT(slotSubJobFinished(SyncFileItem::Status)), Qt::QueuedConnection);
+    connect(job, SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)),
+            this, SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)));
+    connect(job, SIGNAL(progress(const SyncFileItem &,quint64)), this, SIGNAL(progress(const SyncFileItem &,quint64)));
+}
+
+bool PropagateBundle::scheduleNextJob()
+{
+    if (_state == Finished) {
+        return false;
+    }
+
+    if (_state == NotYetStarted) {
+        _state = Running;
+        if (startBundle()) {
+            return true;
+        }
+        _fallbackJobs = _subJobs.toList();
+    }
+
+    // The items that are not (or no longer) in the request are propagated like any other
+    while (!_fallbackJobs.isEmpty()) {
+        PropagateItemJob *next = _fallbackJobs.first();
+        if (!_propagator->transferLaneHasCapacity(next->transferLane())) {
+            return false;
+        }
+        _fallbackJobs.removeFirst();
+        if (next->scheduleNextJob()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PropagateBundle::containsPath(const QString &path) const
+{
+    foreach (PropagateItemJob *job, _subJobs) {
+        if (job->_item->destination() == path) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PropagateBundle::prioritize(const QString &path)
+{
+    // The items in the request are all sent at once
+    for (int i = 0; i < _fallbackJobs.count(); ++i) {
+        if (_fallbackJobs.at(i)->_item->destination() == path) {
+            _fallbackJobs.move(i, 0);
+            return true;
+        }
+    }
+    return _state == NotYetStarted && containsPath(path);
+}
+
+void PropagateBundle::abort()
+{
+    foreach (PropagatorJob *job, _subJobs) {
+        job->abort();
+    }
+}
+
+void PropagateBundle::slotSubJobFinished(SyncFileItem::Status status)
+{
+    if (_state == Finished) {
+        return;
+    }
+
+    if (status == SyncFileItem::FatalError) {
+        abort();
+        _state = Finished;
+        emit finished(status);
+        return;
+    } else if (status == SyncFileItem::NormalError || status == SyncFileItem::SoftError) {
+        _hasError = status;
+    }
+
+    _jobsFinished++;
+    if (_jobsFinished >= _subJobs.count()) {
+        _state = Finished;
+        emit finished(_hasError == SyncFileItem::NoStatus ? SyncFileItem::Success : _hasError);
+    } else {
+        emit ready();
+    }
+}
+
 CleanupPollsJob::~CleanupPollsJob()
 {}
 
@@ -88,10 +88,23 @@ public:
 
     virtual JobParallelism parallelism() { return FullParallelism; }
 
-    /**
-     * For "small" jobs
+    /** The scheduling lanes of item jobs.
+     *
+     * Each lane has its own concurrency budget (see OwncloudPropagator::transferLaneBudget())
+     * so that large transfers can't starve the small ones.
+     */
+    enum TransferLane {
+        SmallTransferLane,
+        MediumTransferLane,
+        LargeTransferLane,
+        TransferLaneCount
+    };
+
+    /** The lane in which this job is accounted when it runs.
+     *
+     * Jobs that don't transfer file contents are always small.
      */
-    virtual bool isLikelyFinishedQuickly() { return false; }
+    virtual TransferLane transferLane() { return SmallTransferLane; }
 
     /** The space that the running jobs need to complete but don't actually use yet.
      *
@@ -157,18 +170,14 @@ protected slots:
 private:
     QScopedPointer<PropagateItemJob> _restoreJob;
 
+    // The lane in which the job was accounted when it was started
+    TransferLane _runningInLane;
+
 public:
     PropagateItemJob(OwncloudPropagator* propagator, const SyncFileItemPtr &item)
-        : PropagatorJob(propagator), _item(item) {}
+        : PropagatorJob(propagator), _runningInLane(SmallTransferLane), _item(item) {}
 
-    bool scheduleNextJob() Q_DECL_OVERRIDE {
-        if (_state != NotYetStarted) {
-            return false;
-        }
-        _state = Running;
-        QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
-        return true;
-    }
+    bool scheduleNextJob() Q_DECL_OVERRIDE;
 
     SyncFileItemPtr  _item;
 
@@ -199,15 +208,15 @@ public:
     explicit PropagateDirectory(OwncloudPropagator *propagator, const SyncFileItemPtr &item = SyncFileItemPtr(new SyncFileItem))
         : PropagatorJob(propagator)
         , _firstJob(0), _item(item),  _jobsFinished(0), _runningNow(0), _hasError(SyncFileItem::NoStatus)
+        , _nextJobIndex(0), _blockingJobs(0), _parentDirectory(0)
     { }
 
     virtual ~PropagateDirectory() {
         qDeleteAll(_subJobs);
     }
 
-    void append(PropagatorJob *subJob) {
-        _subJobs.append(subJob);
-    }
+    void setFirstJob(PropagateItemJob *job);
+    void append(PropagatorJob *subJob);
 
     virtual bool scheduleNextJob() Q_DECL_OVERRIDE;
     virtual JobParallelism parallelism() Q_DECL_OVERRIDE;
@@ -226,6 +235,43 @@ public:
 
     qint64 committedDiskSpace() const Q_DECL_OVERRIDE;
 
+    /** Moves the job for the given path (relative to the sync root) in front of
+     *  the jobs that were not started yet, together with the directories containing it.
+     *
+     * Jobs are never moved past a job that isn't FullParallelism.
+     * Returns whether a job waiting for that path was found.
+     */
+    bool prioritize(const QString &path);
+
+private:
+    /** Adds delta to the blocking job count of this directory and all its parents */
+    void adjustBlockingJobs(int delta);
+
+    /** Index in _subJobs of the next job that was not yet started.
+     *
+     * Sub jobs are always started in order, so everything before this index
+     * is either running (and in _runningJobs), deferred or finished.
+     */
+    int _nextJobIndex;
+
+    /** The sub jobs that were started and did not finish yet, in the order they were started */
+    QList<PropagatorJob *> _runningJobs;
+
+    /** Item jobs that were passed over because their lane was full.
+     *
+     * Only jobs with FullParallelism are deferred, so starting them later
+     * does not change the barrier semantics.
+     */
+    QList<PropagatorJob *> _deferredJobs[TransferLaneCount];
+
+    /** Number of unfinished jobs in this directory and all its sub directories
+     * (including the _firstJob) whose parallelism() is not FullParallelism.
+     * This makes parallelism() constant time instead of a recursive scan.
+     */
+    int _blockingJobs;
+
+    PropagateDirectory *_parentDirectory;
+
 private slots:
     bool possiblyRunNextJob(PropagatorJob *next) {
         if (next->_state == NotYetStarted) {
@@ -258,6 +304,94 @@ public:
     }
 };
 
+/**
+ * @brief Accounts for a request that propagates several items at once
+ *
+ * The request takes one slot of the small lane, and is counted as active
+ * on behalf of \a job, one of its items. Both are given back when this is
+ * destroyed.
+ */
+class BundleRequestSlot {
+public:
+    BundleRequestSlot(OwncloudPropagator *propagator, PropagateItemJob *job);
+    ~BundleRequestSlot();
+
+private:
+    Q_DISABLE_COPY(BundleRequestSlot)
+    OwncloudPropagator *_propagator;
+    PropagateItemJob *_job;
+};
+
+/**
+ * @brief Base of the jobs that propagate several items with one request
+ *
+ * Owns the jobs of the items. startBundle() sends the request, and the
+ * items it handled are then completed through their own jobs, so the
+ * journal and the SyncFileItems are updated as usual. The jobs of the other
+ * items are given to fallBack() and run on their own afterwards.
+ *
+ * @ingroup libsync
+ */
+class PropagateBundle : public PropagatorJob {
+    Q_OBJECT
+public:
+    explicit PropagateBundle(OwncloudPropagator *propagator)
+        : PropagatorJob(propagator), _jobsFinished(0), _hasError(SyncFileItem::NoStatus) {}
+    ~PropagateBundle();
+
+    bool scheduleNextJob() Q_DECL_OVERRIDE;
+    void abort() Q_DECL_OVERRIDE;
+
+    /** Whether one of the items of the bundle is \a path (relative to the sync root) */
+    bool containsPath(const QString &path) const;
+
+    /** Moves the job for \a path in front of the other jobs that run on their own
+     *
+     * Returns whether that job was waiting, see PropagateDirectory::prioritize().
+     */
+    bool prioritize(const QString &path);
+
+    /** The maximum number of items in a bundle, checks OWNCLOUD_MAX_BUNDLED_FILES
+     *
+     * A value below 2 turns bundles off.
+     */
+    static int maxBundledFiles();
+
+protected:
+    void appendJob(PropagateItemJob *job);
+
+    /** Starts the request. Returns false if it is not worth it, then all
+     *  the jobs run on their own. */
+    virtual bool startBundle() = 0;
+
+    /** The job is run on its own once the request is done */
+    void fallBack(PropagateItemJob *job) { _fallbackJobs.append(job); }
+
+    /** To be called when the request is sent, on behalf of \a job */
+    void requestStarted(PropagateItemJob *job) { _requestSlot.reset(new BundleRequestSlot(_propagator, job)); }
+
+    /** To be called when the reply arrived, before the items are completed */
+    void requestFinished() { _requestSlot.reset(); }
+
+    /** To be called when the request is done */
+    void bundleFinished() { emit ready(); }
+
+    QVector<PropagateItemJob *> _subJobs;
+
+private slots:
+    void slotSubJobFinished(SyncFileItem::Status status);
+
+private:
+    // Jobs that run on their own, not started yet
+    QList<PropagateItemJob *> _fallbackJobs;
+
+    // Set while the request runs
+    QScopedPointer<BundleRequestSlot> _requestSlot;
+
+    int _jobsFinished;
+    SyncFileItem::Status _hasError; // NoStatus, or NormalError / SoftError if there was an error
+};
+
 class OwncloudPropagator : public QObject {
     Q_OBJECT
 
@@ -285,7 +419,10 @@ public:
             , _bandwidthManager(this)
             , _anotherSyncNeeded(false)
             , _account(account)
-    { }
+    {
+        for (int i = 0; i < PropagatorJob::TransferLaneCount; ++i)
+            _runningJobsInLane[i] = 0;
+    }
 
     ~OwncloudPropagator();
 
@@ -293,6 +430,7 @@ public:
 
     QAtomicInt _downloadLimit;
     QAtomicInt _uploadLimit;
+    QAtomicInt _totalLimit; // for uploads and downloads together, in bytes/s, 0 for none
     BandwidthManager _bandwidthManager;
 
     QAtomicInt _abortRequested; // boolean set by the main thread to abort.
@@ -312,10 +450,36 @@ public:
     int maximumActiveJob();
     int hardMaximumActiveJob();
 
+    /** The maximum number of active jobs of all the folders syncing at the same time */
+    int globalMaximumActiveJob();
+
+    /** The part of the global budget this propagator may use, at most hardMaximumActiveJob() */
+    int globalBudgetShare();
+
+    /** Number of item jobs that were started and are not finished yet, per lane */
+    int _runningJobsInLane[PropagatorJob::TransferLaneCount];
+
+    /** The maximum number of item jobs running in parallel in the given lane */
+    int transferLaneBudget(PropagatorJob::TransferLane lane);
+
+    /** Whether another job in that lane may be started now */
+    bool transferLaneHasCapacity(PropagatorJob::TransferLane lane) {
+        return _runningJobsInLane[lane] < transferLaneBudget(lane);
+    }
+
+    /** The lane in which a transfer of that many bytes is scheduled */
+    static PropagatorJob::TransferLane transferLaneForSize(quint64 size);
+
     bool isInSharedDirectory(const QString& file);
     bool localFileNameClash(const QString& relfile);
     QString getFilePath(const QString& tmp_file_name) const;
 
+    /** Make the not yet started job for path (a file or a directory) the next one to run.
+     *
+     * Returns false if there is no such job.
+     */
+    bool prioritize(const QString &path);
+
     void abort() {
         _abortRequested.fetchAndStoreOrdered(true);
         if (_rootJob) {
@@ -332,6 +496,12 @@ public:
 
     AccountPtr account() const;
 
+    /** Whether the download of \a file asks the server to compress it */
+    bool compressDownload(const QString& file) const;
+
+    /** Whether the upload of \a file is sent gzip compressed */
+    bool compressUpload(const QString& file) const;
+
     enum DiskSpaceResult
     {
         DiskSpaceOk,
@@ -353,6 +523,7 @@ private slots:
         if (!_finishedEmited)
             emit finished(status == SyncFileItem::Success);
         _finishedEmited = true;
+        releaseGlobalBudget();
     }
 
     void scheduleNextJob();
@@ -374,6 +545,9 @@ signals:
 
 private:
 
+    /** Stop counting this propagator against the global budget */
+    void releaseGlobalBudget();
+
     AccountPtr _account;
 
 #if QT_VERSION < QT_VERSION_CHECK(5, 0, 0)
@@ -15,13 +15,11 @@
 #include <QDateTime>
 #include <QString>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QMutex>
 
 #include "ownsql.h"
-#include "utility.h"
-
-#define SQLITE_SLEEP_TIME_USEC 100000
-#define SQLITE_REPEAT_COUNT 20
 
 #define SQLITE_DO(A) if(1) { \
     _errId = (A); if(_errId != SQLITE_OK) { _error= QString::fromUtf8(sqlite3_errmsg(_db)); \
@@ -29,11 +27,82 @@
 
 namespace OCC {
 
+/** The busy timeout of new connections, checks OWNCLOUD_SQLITE_BUSY_TIMEOUT (msec) */
+static int defaultBusyTimeout()
+{
+    static int timeout = -1;
+    if (timeout < 0) {
+        bool ok = false;
+        timeout = qgetenv("OWNCLOUD_SQLITE_BUSY_TIMEOUT").toInt(&ok);
+        if (!ok || timeout < 0) {
+            timeout = 5000;
+        }
+    }
+    return timeout;
+}
+
+// The sleeps of a wait for a lock (msec), the last one repeats.
+// Like the handler of sqlite3_busy_timeout(): a lock held for a short
+// write is picked up quickly, a long one is not polled too often.
+static const int busyDelays[] = { 1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100 };
+static const int busyDelayCount = sizeof(busyDelays) / sizeof(busyDelays[0]);
+
+static QMutex lockWaitStatsMutex;
+static SqlDatabase::LockWaitStats lockWaitStatsTotal;
+
 SqlDatabase::SqlDatabase()
     :_db(0),
-      _errId(0)
+      _errId(0),
+      _busyTimeout(defaultBusyTimeout())
+{
+
+}
+
+void SqlDatabase::setBusyTimeout(int msec)
+{
+    _busyTimeout = msec;
+}
+
+SqlDatabase::LockWaitStats SqlDatabase::lockWaitStats()
+{
+    QMutexLocker locker(&lockWaitStatsMutex);
+    return lockWaitStatsTotal;
+}
+
+// Called by SQLite while another connection holds the lock a statement needs,
+// \a count is the number of calls for this wait so far. Returns 0 to give up.
+int SqlDatabase::busyHandler(void *userdata, int count)
 {
+    SqlDatabase *db = static_cast<SqlDatabase *>(userdata);
+
+    int waited = 0;
+    for (int i = 0; i < count; ++i) {
+        waited += busyDelays[qMin(i, busyDelayCount - 1)];
+    }
+    const int delay = qMin(busyDelays[qMin(count, busyDelayCount - 1)], db->_busyTimeout - waited);
+
+    if (delay <= 0) {
+        QMutexLocker locker(&lockWaitStatsMutex);
+        if (count == 0) {
+            lockWaitStatsTotal._waits++;
+        }
+        lockWaitStatsTotal._timeouts++;
+        locker.unlock();
+        qWarning() << "Gave up waiting for a database lock after" << waited << "msec";
+        return 0;
+    }
 
+    QElapsedTimer timer;
+    timer.start();
+    sqlite3_sleep(delay);
+
+    QMutexLocker locker(&lockWaitStatsMutex);
+    if (count == 0) {
+        lockWaitStatsTotal._waits++;
+    }
+    lockWaitStatsTotal._waitMsecs += timer.elapsed();
+    lockWaitStatsTotal._maxWaitMsecs = qMax(lockWaitStatsTotal._maxWaitMsecs, qint64(waited) + timer.elapsed());
+    return 1;
 }
 
 bool SqlDatabase::isOpen()
@@ -62,7 +131,8 @@ bool SqlDatabase::openHelper( const QString& filename, int sqliteFlags )
         return false;
     }
 
-    sqlite3_busy_timeout(_db, 5000);
+    // Waits for the locks of other connections, see busyHandler()
+    sqlite3_busy_handler(_db, &SqlDatabase::busyHandler, this);
 
     return true;
 }
@@ -106,7 +176,7 @@ bool SqlDatabase::openOrCreateReadWrite( const QString& filename )
     return true;
 }
 
-bool SqlDatabase::openReadOnly( const QString& filename )
+bool SqlDatabase::openReadOnly( const QString& filename, bool checkConsistency )
 {
     if( isOpen() ) {
         return true;
@@ -116,7 +186,7 @@ bool SqlDatabase::openReadOnly( const QString& filename )
         return false;
     }
 
-    if( !checkDb() ) {
+    if( checkConsistency && !checkDb() ) {
         qDebug() << "Consistency check failed in readonly mode, giving up" << filename;
         close();
         return false;
@@ -135,7 +205,9 @@ QString SqlDatabase::error() const
 void SqlDatabase::close()
 {
     if( _db ) {
-        SQLITE_DO(sqlite3_close(_db) );
+        // csync may still hold statements of the journal connection, the
+        // connection goes away when it finalizes them
+        SQLITE_DO(sqlite3_close_v2(_db) );
         if (_errId != SQLITE_OK) {
             qWarning() << "ERROR When closing DB" << _error;
             Q_ASSERT(!"SQLite Close Error");
@@ -198,16 +270,8 @@ int SqlQuery::prepare( const QString& sql)
         finish();
     }
     if(!_sql.isEmpty() ) {
-        int n = 0;
-        int rc;
-        do {
-            rc = sqlite3_prepare_v2(_db, _sql.toUtf8().constData(), -1, &_stmt, 0);
-            if( (rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED) ) {
-                n++;
-                OCC::Utility::usleep(SQLITE_SLEEP_TIME_USEC);
-            }
-        } while( (n < SQLITE_REPEAT_COUNT) && ((rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED)));
-        _errId = rc;
+        // Reading the schema waits in the busy handler of the connection
+        _errId = sqlite3_prepare_v2(_db, _sql.toUtf8().constData(), -1, &_stmt, 0);
 
         if( _errId != SQLITE_OK ) {
             _error = QString::fromUtf8(sqlite3_errmsg(_db));
@@ -236,19 +300,10 @@ bool SqlQuery::exec()
 
     // Don't do anything for selects, that is how we use the lib :-|
     if( !isSelect() && !isPragma() ) {
-        int rc, n = 0;
-        do {
-            rc = sqlite3_step(_stmt);
-            if( rc == SQLITE_LOCKED ) {
-                rc = sqlite3_reset(_stmt); /* This will also return SQLITE_LOCKED */
-                n++;
-                OCC::Utility::usleep(SQLITE_SLEEP_TIME_USEC);
-            } else if( rc == SQLITE_BUSY ) {
-                OCC::Utility::usleep(SQLITE_SLEEP_TIME_USEC);
-                n++;
-            }
-        } while( (n < SQLITE_REPEAT_COUNT) && ((rc == SQLITE_BUSY) || (rc == SQLITE_LOCKED)));
-        _errId = rc;
+        // SQLITE_BUSY means the busy handler waited for the lock already.
+        // SQLITE_LOCKED is a conflict within this connection, retrying
+        // would not resolve it.
+        _errId = sqlite3_step(_stmt);
 
         if (_errId != SQLITE_DONE && _errId != SQLITE_ROW) {
             _error = QString::fromUtf8(sqlite3_errmsg(_db));
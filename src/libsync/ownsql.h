@@ -35,20 +35,38 @@ public:
 
     bool isOpen();
     bool openOrCreateReadWrite( const QString& filename );
-    bool openReadOnly( const QString& filename );
+    bool openReadOnly( const QString& filename, bool checkConsistency = true );
     bool transaction();
     bool commit();
     void close();
     QString error() const;
     sqlite3* sqliteDb();
 
+    /**
+     * How long a statement waits for the lock of another connection before it
+     * fails with SQLITE_BUSY. 5 seconds by default, or OWNCLOUD_SQLITE_BUSY_TIMEOUT (msec).
+     */
+    void setBusyTimeout(int msec);
+
+    /// The waits for locks of other connections, of all connections since the start
+    struct LockWaitStats {
+        LockWaitStats() : _waits(0), _timeouts(0), _waitMsecs(0), _maxWaitMsecs(0) {}
+        qint64 _waits; // statements that found the database locked
+        qint64 _timeouts; // of these, the ones that gave up with SQLITE_BUSY
+        qint64 _waitMsecs; // total time waited
+        qint64 _maxWaitMsecs; // longest single wait
+    };
+    static LockWaitStats lockWaitStats();
+
 private:
     bool openHelper( const QString& filename, int sqliteFlags );
     bool checkDb();
+    static int busyHandler(void *userdata, int count);
 
     sqlite3 *_db;
     QString _error; // last error string
     int _errId;
+    int _busyTimeout;
 
 };
 
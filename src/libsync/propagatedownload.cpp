@@ -67,9 +67,9 @@ GETFileJob::GETFileJob(AccountPtr account, const QString& path, QFile *device,
                     quint64 resumeStart,  QObject* parent)
 : AbstractNetworkJob(account, path, parent),
   _device(device), _headers(headers), _expectedEtagForResume(expectedEtagForResume)
-, _resumeStart(resumeStart) , _errorStatus(SyncFileItem::NoStatus)
+, _resumeStart(resumeStart), _rangeEnd(-1), _errorStatus(SyncFileItem::NoStatus)
 , _bandwidthLimited(false), _bandwidthChoked(false), _bandwidthQuota(0), _bandwidthManager(0)
-, _hasEmittedFinishedSignal(false), _lastModified()
+, _hasEmittedFinishedSignal(false), _lastModified(), _acceptCompression(false), _encodedBodySize(0)
 {
 }
 
@@ -79,18 +79,26 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl& url, QFile *device,
 
 : AbstractNetworkJob(account, url.toEncoded(), parent),
   _device(device), _headers(headers), _expectedEtagForResume(expectedEtagForResume)
-, _resumeStart(resumeStart), _errorStatus(SyncFileItem::NoStatus), _directDownloadUrl(url)
+, _resumeStart(resumeStart), _rangeEnd(-1), _errorStatus(SyncFileItem::NoStatus), _directDownloadUrl(url)
 , _bandwidthLimited(false), _bandwidthChoked(false), _bandwidthQuota(0), _bandwidthManager(0)
-, _hasEmittedFinishedSignal(false), _lastModified()
+, _hasEmittedFinishedSignal(false), _lastModified(), _acceptCompression(false), _encodedBodySize(0)
 {
 }
 
 
 void GETFileJob::start() {
-    if (_resumeStart > 0) {
+    if (_rangeEnd >= 0) {
+        _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-' + QByteArray::number(_rangeEnd);
+        _headers["Accept-Ranges"] = "bytes";
+        qDebug() << "Delta download range " << _headers["Range"];
+    } else if (_resumeStart > 0) {
         _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) +'-';
         _headers["Accept-Ranges"] = "bytes";
         qDebug() << "Retry with range " << _headers["Range"];
+    } else if (_acceptCompression) {
+        // Setting the header ourselves keeps QNAM from decoding the body,
+        // slotReadyRead() does that.
+        _headers["Accept-Encoding"] = "gzip";
     }
 
     QNetworkRequest req;
@@ -141,6 +149,21 @@ void GETFileJob::slotMetaDataChanged()
     if (reply()->error() != QNetworkReply::NoError) {
         return;
     }
+
+    _decoder.reset();
+    _encodedBodySize = 0;
+    const QByteArray contentEncoding = reply()->rawHeader("Content-Encoding");
+    if (_headers.contains("Accept-Encoding") && !contentEncoding.isEmpty() && contentEncoding != "identity") {
+        _decoder.reset(new ContentDecoder(contentEncoding));
+        if (!_decoder->isValid()) {
+            qDebug() << Q_FUNC_INFO << "Unsupported content encoding" << contentEncoding;
+            _errorString = tr("The server sent the file in an unsupported encoding");
+            _errorStatus = SyncFileItem::NormalError;
+            reply()->abort();
+            return;
+        }
+    }
+
     _etag = getEtagFromReply(reply());
 
     if (!_directDownloadUrl.isEmpty() && !_etag.isEmpty()) {
@@ -195,6 +218,43 @@ void GETFileJob::slotMetaDataChanged()
     if (!lastModified.isNull()) {
         _lastModified = Utility::qDateTimeToTime_t(lastModified.toDateTime());
     }
+
+    // Checksum the body while it is written, unless part of the file was
+    // written by an earlier attempt or not all of it is fetched.
+    _checksumCalculators.clear();
+    if (_resumeStart == 0 && _rangeEnd < 0) {
+        QList<QByteArray> types = _streamingChecksumTypes;
+        QByteArray headerType, headerChecksum;
+        if (parseChecksumHeader(reply()->rawHeader(checkSumHeaderC), &headerType, &headerChecksum)
+                && !headerType.isEmpty()) {
+            types.append(headerType);
+        }
+        foreach (const QByteArray &type, types) {
+            QSharedPointer<ChecksumCalculator> calculator(new ChecksumCalculator(type));
+            if (calculator->isValid() && !streamedChecksumTypeIsComputed(type)) {
+                _checksumCalculators.append(calculator);
+            }
+        }
+    }
+}
+
+bool GETFileJob::streamedChecksumTypeIsComputed(const QByteArray &type) const
+{
+    foreach (const auto &calculator, _checksumCalculators) {
+        if (calculator->checksumType() == type) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QMap<QByteArray, QByteArray> GETFileJob::streamedChecksums() const
+{
+    QMap<QByteArray, QByteArray> result;
+    foreach (const auto &calculator, _checksumCalculators) {
+        result.insert(calculator->checksumType(), calculator->result());
+    }
+    return result;
 }
 
 void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
@@ -217,10 +277,16 @@ void GETFileJob::setBandwidthLimited(bool b)
 void GETFileJob::giveBandwidthQuota(qint64 q)
 {
     _bandwidthQuota = q;
-    qDebug() << Q_FUNC_INFO << "Got" << q << "bytes";
     QMetaObject::invokeMethod(this, "slotReadyRead", Qt::QueuedConnection);
 }
 
+qint64 GETFileJob::takeBandwidthQuota()
+{
+    qint64 quota = qMax(qint64(0), _bandwidthQuota);
+    _bandwidthQuota = 0;
+    return quota;
+}
+
 qint64 GETFileJob::currentDownloadPosition()
 {
     if (_device && _device->pos() > 0 && _device->pos() > qint64(_resumeStart)) {
@@ -261,15 +327,33 @@ void GETFileJob::slotReadyRead()
             return;
         }
 
+        _encodedBodySize += r;
+        const char *data = buffer.constData();
+        qint64 size = r;
+        QByteArray decoded;
+        if (_decoder) {
+            if (!_decoder->addData(buffer.constData(), r, &decoded)) {
+                _errorString = tr("The server sent corrupt compressed data");
+                _errorStatus = SyncFileItem::NormalError;
+                reply()->abort();
+                return;
+            }
+            data = decoded.constData();
+            size = decoded.size();
+        }
+
         if (_device->isOpen()) {
-            qint64 w = _device->write(buffer.constData(), r);
-            if (w != r) {
+            qint64 w = _device->write(data, size);
+            if (w != size) {
                 _errorString = _device->errorString();
                 _errorStatus = SyncFileItem::NormalError;
-                qDebug() << "Error while writing to file" << w << r <<  _errorString;
+                qDebug() << "Error while writing to file" << w << size <<  _errorString;
                 reply()->abort();
                 return;
             }
+            foreach (const auto &calculator, _checksumCalculators) {
+                calculator->addData(data, size);
+            }
         }
     }
 
@@ -395,6 +479,45 @@ void PropagateDownloadFile::start()
         _propagator->_journal->commit("download file start");
     }
 
+    if (deltaDownloadPossible()) {
+        startDeltaDownload();
+        return;
+    }
+    startDownload(expectedEtagForResume);
+}
+
+bool PropagateDownloadFile::finishArchivedDownload(const QByteArray& data)
+{
+    // The archive has no etags: only take what matches the discovery
+    if (data.size() != _item->_size || _propagator->localFileNameClash(_item->_file)) {
+        return false;
+    }
+
+    _stopwatch.start();
+    _tmpFile.setFileName(_propagator->getFilePath(createDownloadTmpFileName(_item->_file)));
+    if (!_tmpFile.open(QIODevice::WriteOnly) || _tmpFile.write(data) != data.size()) {
+        qDebug() << "Could not write" << _tmpFile.fileName() << _tmpFile.errorString();
+        _tmpFile.close();
+        FileSystem::remove(_tmpFile.fileName());
+        return false;
+    }
+    _tmpFile.close();
+    FileSystem::setFileHidden(_tmpFile.fileName(), true);
+
+    const QByteArray checksumType = contentChecksumType();
+    ChecksumCalculator contentChecksum(checksumType);
+    if (contentChecksum.isValid()) {
+        contentChecksum.addData(data.constData(), data.size());
+        _item->_contentChecksumType = checksumType;
+        _item->_contentChecksum = contentChecksum.result();
+    }
+
+    downloadFinished();
+    return true;
+}
+
+void PropagateDownloadFile::startDownload(const QByteArray& expectedEtagForResume)
+{
     QMap<QByteArray, QByteArray> headers;
 
     if (_item->_directDownloadUrl.isEmpty()) {
@@ -416,12 +539,202 @@ void PropagateDownloadFile::start()
                               &_tmpFile, headers, expectedEtagForResume, _resumeStart);
     }
     _job->setBandwidthManager(&_propagator->_bandwidthManager);
+    _job->setAcceptCompression(_propagator->compressDownload(_item->_file));
+    _job->addStreamingChecksumType(contentChecksumType());
+    _streamedChecksums.clear();
     connect(_job, SIGNAL(finishedSignal()), this, SLOT(slotGetFinished()));
     connect(_job, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(slotDownloadProgress(qint64,qint64)));
     _propagator->_activeJobList.append(this);
     _job->start();
 }
 
+bool PropagateDownloadFile::deltaDownloadPossible() const
+{
+    if (_resumeStart != 0 || !_item->_directDownloadUrl.isEmpty()) {
+        return false;
+    }
+    if (_item->_instruction != CSYNC_INSTRUCTION_SYNC && _item->_instruction != CSYNC_INSTRUCTION_CONFLICT) {
+        return false;
+    }
+    // Smaller files are fetched faster than the block map and the local blocks
+    if (_item->_size <= _propagator->chunkSize()) {
+        return false;
+    }
+    return _propagator->account()->capabilities().deltaDownloadAvailable()
+        && FileSystem::fileExists(_propagator->getFilePath(_item->_file));
+}
+
+void PropagateDownloadFile::startDeltaDownload()
+{
+    qDebug() << Q_FUNC_INFO << "Fetching the block map of" << _item->_file;
+    _blockMapJob = new PropfindJob(_propagator->account(), _propagator->_remoteFolder + _item->_file, this);
+    _blockMapJob->setProperties(QList<QByteArray>() << "getetag" << "http://owncloud.org/ns:blockmap");
+    connect(_blockMapJob, SIGNAL(result(QVariantMap)), SLOT(slotBlockMapReceived(QVariantMap)));
+    connect(_blockMapJob, SIGNAL(finishedWithError()), SLOT(slotBlockMapFailed()));
+    _propagator->_activeJobList.append(this);
+    _blockMapJob->start();
+}
+
+void PropagateDownloadFile::slotBlockMapReceived(const QVariantMap& values)
+{
+    _propagator->_activeJobList.removeOne(this);
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    // The map must describe the version found by the discovery, the ranges
+    // are fetched with that etag.
+    SyncJournalDb::BlockSignatures blockMap;
+    blockMap._etag = parseEtag(values.value("getetag").toByteArray());
+    if (blockMap._etag != _item->_etag
+            || !parseBlockMap(values.value("blockmap").toByteArray(), &blockMap._blockSize, &blockMap._checksums)
+            || blockMap.blockCount() != qint64((_item->_size + blockMap._blockSize - 1) / blockMap._blockSize)) {
+        qDebug() << Q_FUNC_INFO << "No usable block map for" << _item->_file << blockMap._etag << _item->_etag;
+        startDownload(QByteArray());
+        return;
+    }
+    blockMap._valid = true;
+    _blockMap = blockMap;
+
+    ComputeBlockChecksums *computeChecksums = new ComputeBlockChecksums(this);
+    connect(computeChecksums, SIGNAL(done(QByteArray)), SLOT(slotLocalBlockChecksumsComputed(QByteArray)));
+    connect(computeChecksums, SIGNAL(done(QByteArray)), computeChecksums, SLOT(deleteLater()));
+    _propagator->_activeJobList.append(this);
+    computeChecksums->start(_propagator->getFilePath(_item->_file), _blockMap._blockSize);
+}
+
+void PropagateDownloadFile::slotBlockMapFailed()
+{
+    _propagator->_activeJobList.removeOne(this);
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    qDebug() << Q_FUNC_INFO << "Could not fetch the block map of" << _item->_file;
+    startDownload(QByteArray());
+}
+
+void PropagateDownloadFile::slotLocalBlockChecksumsComputed(const QByteArray& checksums)
+{
+    _propagator->_activeJobList.removeOne(this);
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    // Blocks are looked up by checksum, so the ones that moved by a multiple
+    // of the block size are found as well.
+    _localBlockOffsets.clear();
+    for (int i = checksums.size() / 40 - 1; i >= 0; --i) {
+        _localBlockOffsets.insert(checksums.mid(i * 40, 40), i * _blockMap._blockSize);
+    }
+    deltaDownloadNextBlocks();
+}
+
+void PropagateDownloadFile::deltaDownloadNextBlocks()
+{
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    if (!_tmpFile.isOpen() && !_tmpFile.open(QIODevice::Append | QIODevice::Unbuffered)) {
+        done(SyncFileItem::NormalError, _tmpFile.errorString());
+        return;
+    }
+
+    const qint64 blockSize = _blockMap._blockSize;
+    const int blockCount = _blockMap.blockCount();
+    if (_tmpFile.size() % blockSize != 0 && _tmpFile.size() < qint64(_item->_size)) {
+        // The server sent a different range than the one asked for, get the rest in one go
+        qDebug() << Q_FUNC_INFO << "Unaligned delta download, fetching the rest of" << _item->_file;
+        _blockMap = SyncJournalDb::BlockSignatures();
+        _resumeStart = _tmpFile.size();
+        startDownload(_item->_etag);
+        return;
+    }
+
+    // Copy the blocks the local file has, a few MB of them per event loop iteration
+    static const qint64 copyBudget = 4 * 1024 * 1024;
+    QFile localFile(_propagator->getFilePath(_item->_file));
+    QString error;
+    const bool localFileOpen = FileSystem::openAndSeekFileSharedRead(&localFile, &error, 0);
+    // A complete file may end in a short block
+    int block = (_tmpFile.size() + blockSize - 1) / blockSize;
+    for (qint64 copied = 0; block < blockCount && localFileOpen; ++block) {
+        if (copied >= copyBudget) {
+            emit progress(*_item, _tmpFile.size());
+            QMetaObject::invokeMethod(this, "deltaDownloadNextBlocks", Qt::QueuedConnection);
+            return;
+        }
+        const QByteArray checksum = _blockMap.blockChecksum(block);
+        const qint64 offset = _localBlockOffsets.value(checksum, -1);
+        if (offset < 0) {
+            break;
+        }
+        // The local file may have changed since it was hashed
+        QByteArray data;
+        if (localFile.seek(offset)) {
+            data = localFile.read(qMin(blockSize, qint64(_item->_size) - block * blockSize));
+        }
+        if (QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex() != checksum) {
+            _localBlockOffsets.remove(checksum);
+            break;
+        }
+        if (_tmpFile.write(data) != data.size()) {
+            done(SyncFileItem::NormalError, _tmpFile.errorString());
+            return;
+        }
+        copied += data.size();
+    }
+
+    if (block == blockCount) {
+        qDebug() << Q_FUNC_INFO << "Delta download of" << _item->_file << "assembled";
+        _tmpFile.close();
+        // Only range replies carry an OC-Checksum header, and there are none when
+        // every block was found locally. The block map covers the whole file.
+        ComputeBlockChecksums *computeChecksums = new ComputeBlockChecksums(this);
+        connect(computeChecksums, SIGNAL(done(QByteArray)), SLOT(slotAssembledBlockChecksumsComputed(QByteArray)));
+        connect(computeChecksums, SIGNAL(done(QByteArray)), computeChecksums, SLOT(deleteLater()));
+        _propagator->_activeJobList.append(this);
+        computeChecksums->start(_tmpFile.fileName(), blockSize);
+        return;
+    }
+
+    // Fetch the blocks up to the next one the local file has
+    int endBlock = block + 1;
+    while (endBlock < blockCount && !_localBlockOffsets.contains(_blockMap.blockChecksum(endBlock))) {
+        ++endBlock;
+    }
+    _resumeStart = block * blockSize;
+    _downloadProgress = 0;
+    _job = new GETFileJob(_propagator->account(),
+                          _propagator->_remoteFolder + _item->_file,
+                          &_tmpFile, QMap<QByteArray, QByteArray>(), _item->_etag, _resumeStart);
+    _job->setRangeEnd(qMin(endBlock * blockSize, qint64(_item->_size)) - 1);
+    _job->setBandwidthManager(&_propagator->_bandwidthManager);
+    _streamedChecksums.clear();
+    connect(_job, SIGNAL(finishedSignal()), this, SLOT(slotGetFinished()));
+    connect(_job, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(slotDownloadProgress(qint64,qint64)));
+    _propagator->_activeJobList.append(this);
+    _job->start();
+}
+
+void PropagateDownloadFile::slotAssembledBlockChecksumsComputed(const QByteArray& checksums)
+{
+    _propagator->_activeJobList.removeOne(this);
+    if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
+        return;
+
+    if (checksums != _blockMap._checksums) {
+        qDebug() << Q_FUNC_INFO << "Delta download of" << _item->_file << "does not match the block map, fetching all of it";
+        _blockMap = SyncJournalDb::BlockSignatures();
+        _deltaChecksumHeader.clear();
+        _resumeStart = 0;
+        if (!_tmpFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+            done(SyncFileItem::NormalError, _tmpFile.errorString());
+            return;
+        }
+        startDownload(QByteArray());
+        return;
+    }
+    validateTransmissionChecksum(_deltaChecksumHeader);
+}
+
 qint64 PropagateDownloadFile::committedDiskSpace() const
 {
     if (_state == Running) {
@@ -542,8 +855,11 @@ void PropagateDownloadFile::slotGetFinished()
         return;
     }
 
-    if(bodySize > 0 && bodySize != _tmpFile.size() - job->resumeStart() ) {
-        qDebug() << bodySize << _tmpFile.size() << job->resumeStart();
+    // A decoded body is bigger in the file than on the wire
+    const qint64 receivedBodySize = job->bodyWasDecoded() ? job->encodedBodySize()
+                                                          : _tmpFile.size() - job->resumeStart();
+    if((bodySize > 0 && bodySize != quint64(receivedBodySize)) || !job->decodedBodyComplete()) {
+        qDebug() << bodySize << receivedBodySize << _tmpFile.size() << job->resumeStart();
         _propagator->_anotherSyncNeeded = true;
         done(SyncFileItem::SoftError, tr("The file could not be downloaded completely."));
         return;
@@ -557,6 +873,22 @@ void PropagateDownloadFile::slotGetFinished()
         return;
     }
 
+    auto checksumHeader = job->reply()->rawHeader(checkSumHeaderC);
+    if (_blockMap._valid) {
+        // The checksum header of a range reply is the one of the whole file
+        if (!checksumHeader.isEmpty()) {
+            _deltaChecksumHeader = checksumHeader;
+        }
+        deltaDownloadNextBlocks();
+        return;
+    }
+
+    _streamedChecksums = job->streamedChecksums();
+    validateTransmissionChecksum(checksumHeader);
+}
+
+void PropagateDownloadFile::validateTransmissionChecksum(const QByteArray& checksumHeader)
+{
     // Do checksum validation for the download. If there is no checksum header, the validator
     // will also emit the validated() signal to continue the flow in slot transmissionChecksumValidated()
     // as this is (still) also correct.
@@ -565,8 +897,7 @@ void PropagateDownloadFile::slotGetFinished()
             SLOT(transmissionChecksumValidated(QByteArray,QByteArray)));
     connect(validator, SIGNAL(validationFailed(QString)),
             SLOT(slotChecksumFail(QString)));
-    auto checksumHeader = job->reply()->rawHeader(checkSumHeaderC);
-    validator->start(_tmpFile.fileName(), checksumHeader);
+    validator->start(_tmpFile.fileName(), checksumHeader, _streamedChecksums);
 }
 
 void PropagateDownloadFile::slotChecksumFail( const QString& errMsg )
@@ -687,6 +1018,11 @@ void PropagateDownloadFile::transmissionChecksumValidated(const QByteArray &chec
         return contentChecksumComputed(checksumType, checksum);
     }
 
+    // It was computed while downloading.
+    if (_streamedChecksums.contains(theContentChecksumType)) {
+        return contentChecksumComputed(theContentChecksumType, _streamedChecksums.value(theContentChecksumType));
+    }
+
     // Compute the content checksum.
     auto computeChecksum = new ComputeChecksum(this);
     computeChecksum->setChecksumType(theContentChecksumType);
@@ -717,9 +1053,16 @@ void PropagateDownloadFile::downloadFinished()
     }
 
     // In case of conflict, make a backup of the old file
-    // Ignore conflicts where both files are binary equal
-    bool isConflict = _item->_instruction == CSYNC_INSTRUCTION_CONFLICT
-            && !FileSystem::fileEquals(fn, _tmpFile.fileName());
+    // Ignore conflicts where both files are binary equal. If the cached
+    // checksum of the local file differs, there's no need to compare them.
+    bool isConflict = false;
+    if (_item->_instruction == CSYNC_INSTRUCTION_CONFLICT) {
+        const QByteArray cachedLocalChecksum = _propagator->_journal->getCachedLocalChecksum(
+                    FileSystem::getInode(fn), FileSystem::getSize(fn), FileSystem::getModTime(fn),
+                    _item->_contentChecksumType);
+        isConflict = (!cachedLocalChecksum.isEmpty() && cachedLocalChecksum != _item->_contentChecksum)
+                || !FileSystem::fileEquals(fn, _tmpFile.fileName());
+    }
     if (isConflict) {
         QString renameError;
         QString conflictFileName = FileSystem::makeConflictFileName(fn, Utility::qDateTimeFromTime_t(_item->_modtime));
@@ -808,12 +1151,21 @@ void PropagateDownloadFile::downloadFinished()
     // Get up to date information for the journal.
     _item->_size = FileSystem::getSize(fn);
 
-    if (!_propagator->_journal->setFileRecord(SyncJournalFileRecord(*_item, fn))) {
+    const SyncJournalFileRecord record(*_item, fn);
+    if (!_propagator->_journal->setFileRecord(record)) {
         done(SyncFileItem::FatalError, tr("Error writing metadata to the database"));
         return;
     }
+    // The checksum of the downloaded data is the checksum of the new local file
+    _propagator->_journal->setCachedLocalChecksum(record._inode, _item->_size, _item->_modtime,
+                                                  _item->_contentChecksumType, _item->_contentChecksum);
+    if (_blockMap._valid && _blockMap._etag == _item->_etag
+            && _blockMap._blockSize == qint64(_propagator->chunkSize())) {
+        // The block map is what a delta upload of the next local change compares against
+        _propagator->_journal->setBlockSignatures(_item->_file, _blockMap);
+    }
     _propagator->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
-    _propagator->_journal->commit("download file start2");
+    _propagator->_journal->commitIfNeededAndStartNewTransaction("download file start2");
     done(isConflict ? SyncFileItem::Conflict : SyncFileItem::Success);
 
     // handle the special recall file
@@ -824,7 +1176,7 @@ void PropagateDownloadFile::downloadFinished()
     }
 
     qint64 duration = _stopwatch.elapsed();
-    if (isLikelyFinishedQuickly() && duration > 5*1000) {
+    if (transferLane() == SmallTransferLane && duration > 5*1000) {
         qDebug() << "WARNING: Unexpectedly slow connection, took" << duration << "msec for" << _item->_size - _resumeStart << "bytes for" << _item->_file;
     }
 }
@@ -832,6 +1184,10 @@ void PropagateDownloadFile::downloadFinished()
 void PropagateDownloadFile::slotDownloadProgress(qint64 received, qint64)
 {
     if (!_job) return;
+    if (_job->bodyWasDecoded()) {
+        // received counts the compressed bytes
+        received = _job->currentDownloadPosition() - _resumeStart;
+    }
     _downloadProgress = received;
     emit progress(*_item, _resumeStart + received);
 }
@@ -841,6 +1197,8 @@ void PropagateDownloadFile::abort()
 {
     if (_job &&  _job->reply())
         _job->reply()->abort();
+    if (_blockMapJob && _blockMapJob->reply())
+        _blockMapJob->reply()->abort();
 }
 
 
@@ -15,6 +15,8 @@
 
 #include "owncloudpropagator.h"
 #include "networkjobs.h"
+#include "checksums.h"
+#include "compression.h"
 
 #include <QBuffer>
 #include <QFile>
@@ -32,6 +34,7 @@ class GETFileJob : public AbstractNetworkJob {
     QString _errorString;
     QByteArray _expectedEtagForResume;
     quint64 _resumeStart;
+    qint64 _rangeEnd;
     SyncFileItem::Status _errorStatus;
     QUrl _directDownloadUrl;
     QByteArray _etag;
@@ -41,6 +44,11 @@ class GETFileJob : public AbstractNetworkJob {
     QPointer<BandwidthManager> _bandwidthManager;
     bool _hasEmittedFinishedSignal;
     time_t _lastModified;
+    QList<QByteArray> _streamingChecksumTypes;
+    QList<QSharedPointer<ChecksumCalculator> > _checksumCalculators;
+    bool _acceptCompression;
+    QScopedPointer<ContentDecoder> _decoder;
+    qint64 _encodedBodySize;
 public:
 
     // DOES NOT take ownership of the device.
@@ -79,6 +87,8 @@ public:
     void setChoked(bool c);
     void setBandwidthLimited(bool b);
     void giveBandwidthQuota(qint64 q);
+    /** Returns the quota that was not used yet and resets it to 0 */
+    qint64 takeBandwidthQuota();
     qint64 currentDownloadPosition();
 
     QString errorString() const;
@@ -91,8 +101,48 @@ public:
 
     QByteArray &etag() { return _etag; }
     quint64 resumeStart() { return _resumeStart; }
+
+    /**
+     * Only fetches the bytes from resumeStart up to and including \a end.
+     *
+     * Used by delta downloads. The checksums of such a partial body are not
+     * streamed.
+     */
+    void setRangeEnd(qint64 end) { _rangeEnd = end; }
+
+    /**
+     * Asks the server to compress the body, which is then decoded while it
+     * is written to the device.
+     *
+     * Not for range requests: they stay uncompressed.
+     */
+    void setAcceptCompression(bool accept) { _acceptCompression = accept; }
+
+    /// Whether the body came compressed and was decoded.
+    bool bodyWasDecoded() const { return !_decoder.isNull(); }
+
+    /// Whether a decoded body was complete. Always true for other bodies.
+    bool decodedBodyComplete() const { return _decoder.isNull() || _decoder->atEnd(); }
+
+    /// The number of body bytes received, before any decoding.
+    qint64 encodedBodySize() const { return _encodedBodySize; }
     time_t lastModified() { return _lastModified; }
 
+    /**
+     * Also compute a checksum of that type while the data is written.
+     *
+     * The type of the checksum header sent by the server is always computed.
+     */
+    void addStreamingChecksumType(const QByteArray& type) { _streamingChecksumTypes.append(type); }
+
+    /**
+     * The checksums of the whole file, computed while downloading, by type.
+     *
+     * Empty if the download was resumed or only fetched a range: the data
+     * that was already in the file did not go through this job.
+     */
+    QMap<QByteArray, QByteArray> streamedChecksums() const;
+
 
 signals:
     void finishedSignal();
@@ -100,6 +150,8 @@ signals:
 private slots:
     void slotReadyRead();
     void slotMetaDataChanged();
+private:
+    bool streamedChecksumTypeIsComputed(const QByteArray& type) const;
 };
 
 /**
@@ -114,8 +166,7 @@ public:
     void start() Q_DECL_OVERRIDE;
     qint64 committedDiskSpace() const Q_DECL_OVERRIDE;
 
-    // We think it might finish quickly because it is a small file.
-    bool isLikelyFinishedQuickly() Q_DECL_OVERRIDE { return _item->_size < 100*1024; }
+    TransferLane transferLane() Q_DECL_OVERRIDE { return OwncloudPropagator::transferLaneForSize(_item->_size); }
 
     /**
      * Whether an existing folder with the same name may be deleted before
@@ -128,6 +179,16 @@ public:
      */
     void setDeleteExistingFolder(bool enabled);
 
+    /**
+     * Completes the job with the contents of the file that were received
+     * in the archive of a PropagateDownloadArchive, without the job ever
+     * being started.
+     *
+     * Returns false if \a data can't be used; the job is then started like
+     * any other.
+     */
+    bool finishArchivedDownload(const QByteArray& data);
+
 private slots:
     void slotGetFinished();
     void abort() Q_DECL_OVERRIDE;
@@ -136,16 +197,51 @@ private slots:
     void downloadFinished();
     void slotDownloadProgress(qint64,qint64);
     void slotChecksumFail( const QString& errMsg );
+    void slotBlockMapReceived(const QVariantMap& values);
+    void slotBlockMapFailed();
+    void slotLocalBlockChecksumsComputed(const QByteArray& checksums);
+    void deltaDownloadNextBlocks();
+    void slotAssembledBlockChecksumsComputed(const QByteArray& checksums);
 
 private:
     void deleteExistingFolder();
 
+    /// Fetches the file, or what is missing of it after _resumeStart, with one GET.
+    void startDownload(const QByteArray& expectedEtagForResume);
+
+    /**
+     * Whether the file may be downloaded as a delta of the local file
+     *
+     * Only for big files that exist locally and were modified on the server.
+     */
+    bool deltaDownloadPossible() const;
+
+    /**
+     * Fetches the block map of the file, to build the new version from the
+     * blocks of the local file and Range requests for the other blocks.
+     *
+     * The tmp file is written in order, so it always holds the beginning of
+     * the new version and can be resumed like a normal download. If the map
+     * is not available, the file is downloaded with startDownload().
+     */
+    void startDeltaDownload();
+
+    void validateTransmissionChecksum(const QByteArray& checksumHeader);
+
     quint64 _resumeStart;
     qint64 _downloadProgress;
     QPointer<GETFileJob> _job;
     QFile _tmpFile;
+    QMap<QByteArray, QByteArray> _streamedChecksums;
     bool _deleteExisting;
 
+    // For delta downloads: the map of the new version and where its blocks
+    // are in the local file, by checksum.
+    SyncJournalDb::BlockSignatures _blockMap;
+    QHash<QByteArray, qint64> _localBlockOffsets;
+    QByteArray _deltaChecksumHeader;
+    QPointer<PropfindJob> _blockMapJob;
+
     QElapsedTimer _stopwatch;
 };
 
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "propagatedownloadarchive.h"
+#include "propagatedownload.h"
+#include "owncloudpropagator_p.h"
+#include "account.h"
+#include "filesystem.h"
+#include "ziparchive.h"
+
+#include <json.h>
+
+namespace OCC {
+
+// In propagatedownload.cpp
+QString OWNCLOUDSYNC_EXPORT createDownloadTmpFileName(const QString &previous);
+
+/** Only files up to this size are fetched in an archive */
+static const qint64 maxArchivedFileSize = 100 * 1024;
+
+bool PropagateDownloadArchive::canBundle(OwncloudPropagator* propagator, const SyncFileItem& item)
+{
+    return maxBundledFiles() > 1
+        && !item._isDirectory
+        && item._direction == SyncFileItem::Down
+        // Nothing local to keep or to conflict with
+        && item._instruction == CSYNC_INSTRUCTION_NEW
+        && item._size <= maxArchivedFileSize
+        && item._directDownloadUrl.isEmpty()
+        // Admin recalls are handled by their own download
+        && !item._file.contains(".sys.admin#recall#")
+        && propagator->account()->capabilities().archiveDownloadAvailable();
+}
+
+bool PropagateDownloadArchive::append(PropagateDownloadFile* job)
+{
+    if (!_subJobs.isEmpty()
+            && (_subJobs.count() >= maxBundledFiles()
+                || _archiveSize + job->_item->_size > qint64(_propagator->chunkSize()))) {
+        return false;
+    }
+    _archiveSize += job->_item->_size;
+    appendJob(job);
+    return true;
+}
+
+bool PropagateDownloadArchive::startBundle()
+{
+    if (_subJobs.count() < 2 || _propagator->_abortRequested.fetchAndAddRelaxed(0)
+            || _propagator->diskSpaceCheck() != OwncloudPropagator::DiskSpaceOk) {
+        return false;
+    }
+
+    // All the files are in the same directory
+    const QString firstFile = _subJobs.first()->_item->_file;
+    const int slashPos = firstFile.lastIndexOf(QLatin1Char('/'));
+    const QString dirPath = slashPos == -1 ? QString() : firstFile.left(slashPos);
+    QVariantList names;
+    foreach (PropagateItemJob* job, _subJobs) {
+        names.append(job->_item->_file.mid(slashPos + 1));
+    }
+
+    QString remoteDir = _propagator->_remoteFolder + dirPath;
+    if (!remoteDir.startsWith(QLatin1Char('/'))) {
+        remoteDir.prepend(QLatin1Char('/'));
+    }
+    if (remoteDir.length() > 1 && remoteDir.endsWith(QLatin1Char('/'))) {
+        remoteDir.chop(1);
+    }
+    QList<QPair<QString, QString> > queryItems;
+    queryItems << qMakePair(QString::fromLatin1("dir"), remoteDir);
+    queryItems << qMakePair(QString::fromLatin1("files"), QString::fromUtf8(QtJson::serialize(names)));
+    const QUrl url = Account::concatUrlPath(_propagator->account()->url(),
+                                            QLatin1String("index.php/apps/files/ajax/download.php"), queryItems);
+
+    const QString archiveName = createDownloadTmpFileName(
+                dirPath.isEmpty() ? QString::fromLatin1("archive.zip") : dirPath + QLatin1String("/archive.zip"));
+    _archiveFile.setFileName(_propagator->getFilePath(archiveName));
+    if (!_archiveFile.open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+        qDebug() << "Could not create" << _archiveFile.fileName() << _archiveFile.errorString();
+        return false;
+    }
+    FileSystem::setFileHidden(_archiveFile.fileName(), true);
+
+    qDebug() << "Downloading" << _subJobs.count() << "files of" << remoteDir << "in one archive";
+    _job = new GETFileJob(_propagator->account(), url, &_archiveFile,
+                          QMap<QByteArray, QByteArray>(), QByteArray(), 0, this);
+    _job->setBandwidthManager(&_propagator->_bandwidthManager);
+    connect(_job, SIGNAL(finishedSignal()), this, SLOT(slotArchiveFinished()));
+    connect(_job, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(slotDownloadProgress(qint64,qint64)));
+
+    requestStarted(_subJobs.first());
+    _job->start();
+    return true;
+}
+
+void PropagateDownloadArchive::slotDownloadProgress(qint64 received, qint64)
+{
+    // The files follow each other in the archive, in the order they were asked for
+    qint64 offset = 0;
+    foreach (PropagateItemJob* job, _subJobs) {
+        const SyncFileItem& item = *job->_item;
+        if (offset >= received) {
+            break;
+        }
+        emit progress(item, qMin(received - offset, qint64(item._size)));
+        offset += item._size;
+    }
+}
+
+void PropagateDownloadArchive::slotArchiveFinished()
+{
+    requestFinished();
+    _archiveFile.close();
+
+    if (_state == Finished) {
+        FileSystem::remove(_archiveFile.fileName());
+        return;
+    }
+
+    const int httpStatus = _job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    bool archiveOk = _job->reply()->error() == QNetworkReply::NoError && httpStatus / 100 == 2
+        && _archiveFile.open(QIODevice::ReadOnly);
+    ZipArchive archive(&_archiveFile);
+    archiveOk = archiveOk && archive.open();
+    if (!archiveOk) {
+        qDebug() << "Archive download failed, downloading the files on their own:"
+                 << httpStatus << _job->errorString();
+    }
+
+    foreach (PropagateItemJob* itemJob, _subJobs) {
+        PropagateDownloadFile* job = static_cast<PropagateDownloadFile*>(itemJob);
+        const QString name = job->_item->_file.mid(job->_item->_file.lastIndexOf(QLatin1Char('/')) + 1);
+        const QByteArray data = archiveOk ? archive.read(name) : QByteArray();
+        if (data.isNull() || !job->finishArchivedDownload(data)) {
+            if (archiveOk) {
+                qDebug() << "Could not take" << job->_item->_file << "from the archive";
+            }
+            fallBack(job);
+        }
+    }
+
+    _archiveFile.close();
+    FileSystem::remove(_archiveFile.fileName());
+    bundleFinished();
+}
+
+void PropagateDownloadArchive::abort()
+{
+    if (_job && _job->reply()) {
+        _job->reply()->abort();
+    }
+    PropagateBundle::abort();
+}
+
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+#pragma once
+
+#include "owncloudpropagator.h"
+
+#include <QFile>
+
+namespace OCC {
+
+class GETFileJob;
+class PropagateDownloadFile;
+
+/**
+ * @brief Downloads new small files of a directory together
+ *
+ * Fetches the files of its PropagateDownloadFile jobs as one zip archive
+ * from the ajax/download.php endpoint of the server, which saves a round
+ * trip per file on initial syncs.
+ *
+ * The archive is written to a hidden temporary file in the directory, as
+ * its index is at the end, and each file is then completed by its job like
+ * a normal download. Files that are missing from the archive or do not
+ * match the discovery are downloaded by their jobs as usual afterwards, and
+ * so are all of them if the GET fails.
+ *
+ * @ingroup libsync
+ */
+class PropagateDownloadArchive : public PropagateBundle {
+    Q_OBJECT
+public:
+    explicit PropagateDownloadArchive(OwncloudPropagator* propagator)
+        : PropagateBundle(propagator), _archiveSize(0) {}
+
+    /** Whether the download of \a item may be done with an archive */
+    static bool canBundle(OwncloudPropagator* propagator, const SyncFileItem& item);
+
+    /** Adds the job of a file that canBundle(). Returns false if the archive is full. */
+    bool append(PropagateDownloadFile* job);
+
+    void abort() Q_DECL_OVERRIDE;
+
+private slots:
+    void slotArchiveFinished();
+    void slotDownloadProgress(qint64 received, qint64 total);
+
+private:
+    bool startBundle() Q_DECL_OVERRIDE;
+
+    qint64 _archiveSize; // of all files in the archive
+
+    QPointer<GETFileJob> _job;
+    QFile _archiveFile;
+};
+
+}
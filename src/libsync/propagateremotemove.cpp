@@ -155,11 +155,20 @@ void PropagateRemoteMove::finalize()
 {
     SyncJournalFileRecord oldRecord =
             _propagator->_journal->getFileRecord(_item->_originalFile);
+    if (!oldRecord.isValid() && _item->_file == _item->_renameTarget) {
+        // Below a moved directory: the move of the directory moved the record already
+        oldRecord = _propagator->_journal->getFileRecord(_item->_renameTarget);
+    }
     // if reading from db failed still continue hoping that deleteFileRecord
     // reopens the db successfully.
     // The db is only queried to transfer the content checksum from the old
     // to the new record. It is not a problem to skip it here.
-    _propagator->_journal->deleteFileRecord(_item->_originalFile);
+    if (_item->_isDirectory && _item->_file != _item->_renameTarget) {
+        // Move the records of the whole subtree, the children need not be discovered again
+        _propagator->_journal->renameFileRecords(_item->_originalFile, _item->_renameTarget);
+    } else {
+        _propagator->_journal->deleteFileRecord(_item->_originalFile);
+    }
 
     SyncJournalFileRecord record(*_item, _propagator->getFilePath(_item->_renameTarget));
     record._path = _item->_renameTarget;
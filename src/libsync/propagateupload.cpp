@@ -25,6 +25,7 @@
 #include "checksums.h"
 #include "syncengine.h"
 #include "propagateremotedelete.h"
+#include "compression.h"
 
 #include <json.h>
 #include <QNetworkAccessManager>
@@ -228,9 +229,30 @@ void PropagateUploadFile::slotComputeContentChecksum()
         return;
     }
 
-    // Compute the content checksum.
+    // Or it is in the local checksum cache?
+    const QByteArray cachedChecksum = _propagator->_journal->getCachedLocalChecksum(
+                _item->_inode, _item->_size, _item->_modtime, checksumType);
+    if (!cachedChecksum.isEmpty()) {
+        slotComputeTransmissionChecksum(checksumType, cachedChecksum);
+        return;
+    }
+
+    // Otherwise compute the checksums while uploading, so the upload can start right away.
+    if (startStreamingChecksums()) {
+        slotStartUpload(QByteArray(), QByteArray());
+        return;
+    }
+
+    // Compute the content checksum, and the transmission checksum in the
+    // same pass if it can't reuse the content checksum.
     auto computeChecksum = new ComputeChecksum(this);
     computeChecksum->setChecksumType(checksumType);
+    const auto supportedTransmissionChecksums =
+            _propagator->account()->capabilities().supportedChecksumTypes();
+    if (!supportedTransmissionChecksums.contains(checksumType) && uploadChecksumEnabled()) {
+        computeChecksum->setExtraChecksumTypes(QList<QByteArray>()
+            << _propagator->account()->capabilities().uploadChecksumType());
+    }
 
     connect(computeChecksum, SIGNAL(done(QByteArray,QByteArray)),
             SLOT(slotComputeTransmissionChecksum(QByteArray,QByteArray)));
@@ -244,6 +266,121 @@ void PropagateUploadFile::setDeleteExisting(bool enabled)
     _deleteExisting = enabled;
 }
 
+bool PropagateUploadFile::prepareBundledUpload(QByteArray* data, QMap<QByteArray, QByteArray>* headers)
+{
+    const QString fullFilePath = _propagator->getFilePath(_item->_file);
+    _item->_modtime = FileSystem::getModTime(fullFilePath);
+    if (fileIsStillChanging(*_item)) {
+        return false;
+    }
+
+    QFile file(fullFilePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    *data = file.readAll();
+    if (file.error() != QFile::NoError
+            || FileSystem::getModTime(fullFilePath) != _item->_modtime) {
+        return false;
+    }
+    _item->_size = data->size();
+
+    // The content checksum, and the transmission checksum if it can't be reused
+    const QByteArray checksumType = contentChecksumType();
+    ChecksumCalculator contentChecksum(checksumType);
+    if (contentChecksum.isValid()) {
+        contentChecksum.addData(data->constData(), data->size());
+        _item->_contentChecksumType = checksumType;
+        _item->_contentChecksum = contentChecksum.result();
+    }
+
+    headers->clear();
+    if (contentChecksum.isValid()
+            && _propagator->account()->capabilities().supportedChecksumTypes().contains(checksumType)) {
+        (*headers)["OC-Checksum"] = makeChecksumHeader(checksumType, _item->_contentChecksum);
+    } else if (uploadChecksumEnabled()) {
+        ChecksumCalculator transmissionChecksum(_propagator->account()->capabilities().uploadChecksumType());
+        if (transmissionChecksum.isValid()) {
+            transmissionChecksum.addData(data->constData(), data->size());
+            (*headers)["OC-Checksum"] = makeChecksumHeader(transmissionChecksum.checksumType(),
+                                                           transmissionChecksum.result());
+        }
+    }
+    (*headers)["X-OC-Mtime"] = QByteArray::number(qint64(_item->_modtime));
+
+    _duration.start();
+    return true;
+}
+
+void PropagateUploadFile::finishBundledUpload(const QByteArray& etag, const QByteArray& fileId)
+{
+    // As in slotPutFinished(): the file is on the server now, but if it
+    // changed since it was read it needs to be synced again.
+    const QString fullFilePath = _propagator->getFilePath(_item->_file);
+    if (!FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
+        _propagator->_anotherSyncNeeded = true;
+    }
+
+    if (!fileId.isEmpty()) {
+        _item->_fileId = fileId;
+    }
+    _item->_etag = etag;
+    finalize(*_item);
+}
+
+bool PropagateUploadFile::startStreamingChecksums()
+{
+    // When resuming, the chunks that were sent already won't be read again.
+    const SyncJournalDb::UploadInfo progressInfo = _propagator->_journal->getUploadInfo(_item->_file);
+    if (progressInfo._valid && Utility::qDateTimeToTime_t(progressInfo._modtime) == _item->_modtime) {
+        return false;
+    }
+
+    // Whatever the discovery found is of the wrong type.
+    _item->_contentChecksum.clear();
+    _item->_contentChecksumType.clear();
+
+    const QByteArray checksumType = contentChecksumType();
+    if (!checksumType.isEmpty()) {
+        _streamingContentChecksum.reset(new ChecksumCalculator(checksumType));
+    }
+
+    // Reuse the content checksum as the transmission checksum if possible
+    const auto supportedTransmissionChecksums =
+            _propagator->account()->capabilities().supportedChecksumTypes();
+    if (!supportedTransmissionChecksums.contains(checksumType) && uploadChecksumEnabled()) {
+        _streamingTransmissionChecksum.reset(new ChecksumCalculator(
+                _propagator->account()->capabilities().uploadChecksumType()));
+    }
+    return true;
+}
+
+void PropagateUploadFile::finishStreamingChecksums()
+{
+    if (_streamingContentChecksum && _streamingContentChecksum->isValid()) {
+        _item->_contentChecksumType = _streamingContentChecksum->checksumType();
+        _item->_contentChecksum = _streamingContentChecksum->result();
+    }
+
+    const auto supportedTransmissionChecksums =
+            _propagator->account()->capabilities().supportedChecksumTypes();
+    if (_streamingTransmissionChecksum && _streamingTransmissionChecksum->isValid()) {
+        _transmissionChecksumType = _streamingTransmissionChecksum->checksumType();
+        _transmissionChecksum = _streamingTransmissionChecksum->result();
+    } else if (supportedTransmissionChecksums.contains(_item->_contentChecksumType)) {
+        _transmissionChecksumType = _item->_contentChecksumType;
+        _transmissionChecksum = _item->_contentChecksum;
+    }
+
+    if (_item->_contentChecksum.isEmpty() && _item->_contentChecksumType.isEmpty())  {
+        _item->_contentChecksum = _transmissionChecksum;
+        _item->_contentChecksumType = _transmissionChecksumType;
+    }
+
+    _streamingContentChecksum.reset();
+    _streamingTransmissionChecksum.reset();
+}
+
 void PropagateUploadFile::slotComputeTransmissionChecksum(const QByteArray& contentChecksumType, const QByteArray& contentChecksum)
 {
     _item->_contentChecksum = contentChecksum;
@@ -260,6 +397,17 @@ void PropagateUploadFile::slotComputeTransmissionChecksum(const QByteArray& cont
         return;
     }
 
+    // Maybe it was computed together with the content checksum?
+    if (auto contentChecksummer = qobject_cast<ComputeChecksum*>(sender())) {
+        const QByteArray transmissionChecksumType = uploadChecksumEnabled()
+                ? _propagator->account()->capabilities().uploadChecksumType() : QByteArray();
+        const auto checksums = contentChecksummer->checksums();
+        if (checksums.contains(transmissionChecksumType)) {
+            slotStartUpload(transmissionChecksumType, checksums.value(transmissionChecksumType));
+            return;
+        }
+    }
+
     // Compute the transmission checksum.
     auto computeChecksum = new ComputeChecksum(this);
     if (uploadChecksumEnabled()) {
@@ -335,12 +483,66 @@ void PropagateUploadFile::slotStartUpload(const QByteArray& transmissionChecksum
     }
 
     _currentChunk = 0;
+    setupDeltaUpload();
     _duration.start();
 
     emit progress(*_item, 0);
     this->startNextChunk();
 }
 
+bool PropagateUploadFile::sendsIfMatch() const
+{
+    return !_item->_etag.isEmpty() && _item->_etag != "empty_etag"
+            && _item->_instruction != CSYNC_INSTRUCTION_NEW  // On new files never send a If-Match
+            && _item->_instruction != CSYNC_INSTRUCTION_TYPE_CHANGE
+            && !_deleteExisting;
+}
+
+void PropagateUploadFile::setupDeltaUpload()
+{
+    _previousSignatures = SyncJournalDb::BlockSignatures();
+    _reusedChunks.clear();
+    _blockChecksums.clear();
+
+    _deltaResumeChunk = 0;
+
+    _collectBlockChecksums = _chunkCount > 1
+            && _propagator->account()->capabilities().deltaUploadAvailable();
+    if (!_collectBlockChecksums) {
+        return;
+    }
+
+    // The block checksums need all chunks to be read in order. When resuming,
+    // the chunks the server has already are read again but not sent. Which
+    // ones were reused comes out the same, the file and signatures didn't change.
+    _deltaResumeChunk = _startChunk;
+    _startChunk = 0;
+
+    // The signatures must describe the version the server copies from.
+    const auto signatures = _propagator->_journal->getBlockSignatures(_item->_file);
+    if (signatures._valid && sendsIfMatch()
+            && signatures._etag == _item->_etag
+            && signatures._blockSize == qint64(chunkSize())
+            && signatures.blockCount() > 0) {
+        _previousSignatures = signatures;
+    }
+}
+
+void PropagateUploadFile::restartWithoutDelta()
+{
+    _propagator->_journal->setBlockSignatures(_item->_file, SyncJournalDb::BlockSignatures());
+    _previousSignatures = SyncJournalDb::BlockSignatures();
+    _reusedChunks.clear();
+    _blockChecksums.clear();
+    // The chunks of the failed upload can't be resumed: the reused ones are missing
+    _propagator->_journal->setUploadInfo(_item->_file, SyncJournalDb::UploadInfo());
+    _deltaResumeChunk = 0;
+
+    _currentChunk = 0;
+    _transferId = qrand() ^ _item->_modtime ^ (_item->_size << 16);
+    startNextChunk();
+}
+
 UploadDevice::UploadDevice(BandwidthManager *bwm)
     : _read(0),
       _bandwidthManager(bwm),
@@ -361,6 +563,7 @@ UploadDevice::~UploadDevice() {
 bool UploadDevice::prepareAndOpen(const QString& fileName, qint64 start, qint64 size)
 {
     _data.clear();
+    _compressedData.clear();
     _read = 0;
 
     QFile file(fileName);
@@ -381,6 +584,16 @@ bool UploadDevice::prepareAndOpen(const QString& fileName, qint64 start, qint64
     return QIODevice::open(QIODevice::ReadOnly);
 }
 
+bool UploadDevice::compressData()
+{
+    QByteArray compressed = gzipCompress(_data);
+    if (compressed.isEmpty() || compressed.size() >= _data.size()) {
+        return false;
+    }
+    _compressedData = compressed;
+    _read = 0;
+    return true;
+}
 
 qint64 UploadDevice::writeData(const char* , qint64 ) {
     Q_ASSERT(!"write to read only device");
@@ -389,14 +602,14 @@ qint64 UploadDevice::writeData(const char* , qint64 ) {
 
 qint64 UploadDevice::readData(char* data, qint64 maxlen) {
     //qDebug() << Q_FUNC_INFO << maxlen << _read << _size << _bandwidthQuota;
-    if (_data.size() - _read <= 0) {
+    if (sentData().size() - _read <= 0) {
         // at end
         if (_bandwidthManager) {
             _bandwidthManager->unregisterUploadDevice(this);
         }
         return -1;
     }
-    maxlen = qMin(maxlen, _data.size() - _read);
+    maxlen = qMin(maxlen, sentData().size() - _read);
     if (maxlen == 0) {
         return 0;
     }
@@ -411,7 +624,7 @@ qint64 UploadDevice::readData(char* data, qint64 maxlen) {
         }
         _bandwidthQuota -= maxlen;
     }
-    std::memcpy(data, _data.data()+_read, maxlen);
+    std::memcpy(data, sentData().constData()+_read, maxlen);
     _read += maxlen;
     return maxlen;
 }
@@ -426,19 +639,19 @@ void UploadDevice::slotJobUploadProgress(qint64 sent, qint64 t)
 }
 
 bool UploadDevice::atEnd() const {
-    return _read >= _data.size();
+    return _read >= sentData().size();
 }
 
 qint64 UploadDevice::size() const{
 //    qDebug() << this << Q_FUNC_INFO << _size;
-    return _data.size();
+    return sentData().size();
 }
 
 qint64 UploadDevice::bytesAvailable() const
 {
 //    qDebug() << this << Q_FUNC_INFO << _size << _read << QIODevice::bytesAvailable()
 //             <<   _size - _read + QIODevice::bytesAvailable();
-    return _data.size() - _read + QIODevice::bytesAvailable();
+    return sentData().size() - _read + QIODevice::bytesAvailable();
 }
 
 // random access, we can seek
@@ -450,7 +663,7 @@ bool UploadDevice::seek ( qint64 pos ) {
     if (! QIODevice::seek(pos)) {
         return false;
     }
-    if (pos < 0 || pos > _data.size()) {
+    if (pos < 0 || pos > sentData().size()) {
         return false;
     }
     _read = pos;
@@ -464,6 +677,12 @@ void UploadDevice::giveBandwidthQuota(qint64 bwq) {
     }
 }
 
+qint64 UploadDevice::takeBandwidthQuota() {
+    qint64 quota = qMax(qint64(0), _bandwidthQuota);
+    _bandwidthQuota = 0;
+    return quota;
+}
+
 void UploadDevice::setBandwidthLimited(bool b) {
     _bandwidthLimited = b;
     QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
@@ -481,6 +700,10 @@ void PropagateUploadFile::startNextChunk()
     if (_propagator->_abortRequested.fetchAndAddRelaxed(0))
         return;
 
+    // A queued call for a skipped delta chunk may arrive after an error
+    if (_finished)
+        return;
+
     if (! _jobs.isEmpty() &&  _currentChunk + _startChunk >= _chunkCount - 1) {
         // Don't do parallel upload of chunk if this might be the last chunk because the server cannot handle that
         // https://github.com/owncloud/core/issues/11106
@@ -508,11 +731,7 @@ void PropagateUploadFile::startNextChunk()
         headers["OC-Tag"] = ".sys.admin#recall#";
     }
 
-    if (!_item->_etag.isEmpty() && _item->_etag != "empty_etag"
-            && _item->_instruction != CSYNC_INSTRUCTION_NEW  // On new files never send a If-Match
-            && _item->_instruction != CSYNC_INSTRUCTION_TYPE_CHANGE
-            && !_deleteExisting
-            ) {
+    if (sendsIfMatch()) {
         // We add quotes because the owncloud server always adds quotes around the etag, and
         //  csync_owncloud.c's owncloud_file_id always strips the quotes.
         headers["If-Match"] = '"' + _item->_etag + '"';
@@ -547,11 +766,6 @@ void PropagateUploadFile::startNextChunk()
         isFinalChunk = true;
     }
 
-    if (isFinalChunk && !_transmissionChecksumType.isEmpty()) {
-        headers[checkSumHeaderC] = makeChecksumHeader(
-                _transmissionChecksumType, _transmissionChecksum);
-    }
-
     const QString fileName = _propagator->getFilePath(_item->_file);
     if (! device->prepareAndOpen(fileName, chunkStart, currentChunkSize)) {
         qDebug() << "ERR: Could not prepare upload device: " << device->errorString();
@@ -568,8 +782,79 @@ void PropagateUploadFile::startNextChunk()
         return;
     }
 
+    if (_streamingContentChecksum || _streamingTransmissionChecksum) {
+        // Without resuming the chunks are read in order.
+        if (_streamingContentChecksum) {
+            _streamingContentChecksum->addData(device->data().constData(), device->data().size());
+        }
+        if (_streamingTransmissionChecksum) {
+            _streamingTransmissionChecksum->addData(device->data().constData(), device->data().size());
+        }
+        if (isFinalChunk) {
+            // The checksum must describe a single version of the file: if it
+            // changed while the earlier chunks were read, don't finish the upload.
+            if (!FileSystem::verifyFileUnchanged(fileName, _item->_size, _item->_modtime)) {
+                _propagator->_anotherSyncNeeded = true;
+                abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
+                delete device;
+                return;
+            }
+            finishStreamingChecksums();
+        }
+    }
+
+    if (_collectBlockChecksums) {
+        // Without resuming the chunks are read in order, _currentChunk is the one being sent.
+        const QByteArray blockChecksum =
+                QCryptographicHash::hash(device->data(), QCryptographicHash::Sha1).toHex();
+        _blockChecksums.append(blockChecksum);
+
+        // The final chunk is always sent: it makes the server assemble the file.
+        if (!isFinalChunk && _previousSignatures._valid
+                && _previousSignatures.blockChecksum(_currentChunk) == blockChecksum) {
+            _reusedChunks.append(_currentChunk);
+            delete device;
+            _currentChunk++;
+            // Queued, a large file with few changes would recurse once per chunk
+            QMetaObject::invokeMethod(this, "startNextChunk", Qt::QueuedConnection);
+            return;
+        }
+
+        if (!isFinalChunk && _currentChunk < _deltaResumeChunk) {
+            delete device;
+            _currentChunk++;
+            QMetaObject::invokeMethod(this, "startNextChunk", Qt::QueuedConnection);
+            return;
+        }
+    }
+
+    if (isFinalChunk && !_reusedChunks.isEmpty()) {
+        QStringList reusedChunks;
+        foreach (int chunk, _reusedChunks) {
+            reusedChunks.append(QString::number(chunk));
+        }
+        qDebug() << "Delta upload of" << _item->_file << "reuses" << _reusedChunks.count()
+                 << "of" << _chunkCount << "chunks";
+        headers["OC-Chunk-Reuse"] = reusedChunks.join(QLatin1String(",")).toLatin1();
+    }
+
+    if (isFinalChunk && !_transmissionChecksumType.isEmpty()) {
+        headers[checkSumHeaderC] = makeChecksumHeader(
+                _transmissionChecksumType, _transmissionChecksum);
+    }
+
+    // The checksums and block checksums above are the ones of the uncompressed data
+    const qint64 uncompressedSize = device->data().size();
+    const bool compressed = _propagator->compressUpload(_item->_file) && device->compressData();
+    if (compressed) {
+        headers["Content-Encoding"] = "gzip";
+    }
+
     // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
     PUTFileJob* job = new PUTFileJob(_propagator->account(), _propagator->_remoteFolder + path, device, headers, _currentChunk);
+    if (compressed) {
+        job->setProperty("uncompressedSize", uncompressedSize);
+    }
     _jobs.append(job);
     connect(job, SIGNAL(finishedSignal()), this, SLOT(slotPutFinished()));
     connect(job, SIGNAL(uploadProgress(qint64,qint64)), this, SLOT(slotUploadProgress(qint64,qint64)));
@@ -641,6 +926,19 @@ void PropagateUploadFile::slotPutFinished()
 
     if (err != QNetworkReply::NoError) {
         _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+        // If the server failed to assemble a delta upload, send the whole file instead.
+        // Errors that a full upload would get as well are handled as usual.
+        if (!_reusedChunks.isEmpty() && job->_chunk == _chunkCount - 1
+                && _item->_httpErrorCode >= 400
+                && _item->_httpErrorCode != 403 && _item->_httpErrorCode != 412
+                && _item->_httpErrorCode != 423 && _item->_httpErrorCode != 507) {
+            qDebug() << "Delta upload failed with" << _item->_httpErrorCode
+                     << "- uploading all chunks of" << _item->_file;
+            restartWithoutDelta();
+            return;
+        }
+
         if(checkForProblemsWithShared(_item->_httpErrorCode,
             tr("The file was edited locally but is part of a read only share. "
                "It is restored and your edit is in the conflict file."))) {
@@ -796,13 +1094,26 @@ void PropagateUploadFile::finalize(const SyncFileItem &copy)
 
     _finished = true;
 
-    if (!_propagator->_journal->setFileRecord(SyncJournalFileRecord(*_item, _propagator->getFilePath(_item->_file)))) {
+    const SyncJournalFileRecord record(*_item, _propagator->getFilePath(_item->_file));
+    if (!_propagator->_journal->setFileRecord(record)) {
         done(SyncFileItem::FatalError, tr("Error writing metadata to the database"));
         return;
     }
+    // The uploaded content is what the local file contains
+    _propagator->_journal->setCachedLocalChecksum(record._inode, _item->_size, _item->_modtime,
+                                                  _item->_contentChecksumType, _item->_contentChecksum);
+    // Remember the block checksums of this version for the next delta upload
+    SyncJournalDb::BlockSignatures signatures;
+    if (_collectBlockChecksums && _blockChecksums.size() == _chunkCount * 40) {
+        signatures._etag = _item->_etag;
+        signatures._blockSize = chunkSize();
+        signatures._checksums = _blockChecksums;
+        signatures._valid = true;
+    }
+    _propagator->_journal->setBlockSignatures(_item->_file, signatures);
     // Remove from the progress database:
     _propagator->_journal->setUploadInfo(_item->_file, SyncJournalDb::UploadInfo());
-    _propagator->_journal->commit("upload file start");
+    _propagator->_journal->commitIfNeededAndStartNewTransaction("upload file start");
 
     done(SyncFileItem::Success);
 }
@@ -817,6 +1128,12 @@ void PropagateUploadFile::slotUploadProgress(qint64 sent, qint64 total)
         return;
     }
 
+    // A compressed chunk reports the progress of the compressed data
+    const qint64 uncompressedSize = sender()->property("uncompressedSize").toLongLong();
+    if (uncompressedSize > 0 && total > 0) {
+        sent = sent * uncompressedSize / total;
+    }
+
     int progressChunk = _currentChunk + _startChunk - 1;
     if (progressChunk >= _chunkCount)
         progressChunk = _currentChunk - 1;
@@ -15,6 +15,7 @@
 
 #include "owncloudpropagator.h"
 #include "networkjobs.h"
+#include "checksums.h"
 
 #include <QBuffer>
 #include <QFile>
@@ -37,6 +38,17 @@ public:
     /** Reads the data from the file and opens the device */
     bool prepareAndOpen(const QString& fileName, qint64 start, qint64 size);
 
+    /** The data that was read by prepareAndOpen() */
+    const QByteArray &data() const { return _data; }
+
+    /**
+     * Sends the data gzip compressed instead, for "Content-Encoding: gzip".
+     *
+     * Returns false, and keeps sending the data as it is, if compressing
+     * didn't make it smaller.
+     */
+    bool compressData();
+
     qint64 writeData(const char* , qint64 ) Q_DECL_OVERRIDE;
     qint64 readData(char* data, qint64 maxlen) Q_DECL_OVERRIDE;
     bool atEnd() const Q_DECL_OVERRIDE;
@@ -54,6 +66,8 @@ public:
     void setChoked(bool);
     bool isChoked() { return _choked; }
     void giveBandwidthQuota(qint64 bwq);
+    /** Returns the quota that was not used yet and resets it to 0 */
+    qint64 takeBandwidthQuota();
 
 signals:
 #if QT_VERSION < 0x050402
@@ -64,7 +78,9 @@ private:
 
     // The file data
     QByteArray _data;
-    // Position in the data
+    // The compressed file data, null if the data is sent as it is
+    QByteArray _compressedData;
+    // Position in the data that is sent
     qint64 _read;
 
     // Bandwidth manager related
@@ -74,6 +90,8 @@ private:
     bool _bandwidthLimited; // if _bandwidthQuota will be used
     bool _choked; // if upload is paused (readData() will return 0)
     friend class BandwidthManager;
+
+    const QByteArray &sentData() const { return _compressedData.isNull() ? _data : _compressedData; }
 protected slots:
     void slotJobUploadProgress(qint64 sent, qint64 t);
 };
@@ -186,16 +204,43 @@ private:
     QByteArray _transmissionChecksum;
     QByteArray _transmissionChecksumType;
 
+    /**
+     * When not resuming, the checksums are computed from the chunks while they
+     * are read for the upload, instead of reading the file once more before.
+     * The transmission checksum calculator is null if the content checksum is reused.
+     */
+    QScopedPointer<ChecksumCalculator> _streamingContentChecksum;
+    QScopedPointer<ChecksumCalculator> _streamingTransmissionChecksum;
+
+    /**
+     * Delta upload: if the server supports it, chunks that did not change
+     * since the last synced version are not uploaded. The server copies them
+     * from that version, the one named in the If-Match header.
+     *
+     * _previousSignatures holds the block checksums of that version and is
+     * only valid when a delta upload is done. The block checksums of the
+     * uploaded version are collected in _blockChecksums for the next one.
+     *
+     * This needs every chunk to be read in order, so a resumed upload starts
+     * over at the first chunk. The chunks below _deltaResumeChunk were sent or
+     * reused before the interruption: they are read again, but not sent.
+     */
+    SyncJournalDb::BlockSignatures _previousSignatures;
+    QList<int> _reusedChunks;
+    QByteArray _blockChecksums;
+    bool _collectBlockChecksums;
+    int _deltaResumeChunk;
+
     bool _deleteExisting;
 
     quint64 chunkSize() const { return _propagator->chunkSize(); }
 
 public:
     PropagateUploadFile(OwncloudPropagator* propagator,const SyncFileItemPtr& item)
-        : PropagateItemJob(propagator, item), _startChunk(0), _currentChunk(0), _chunkCount(0), _transferId(0), _finished(false), _deleteExisting(false) {}
+        : PropagateItemJob(propagator, item), _startChunk(0), _currentChunk(0), _chunkCount(0), _transferId(0), _finished(false), _collectBlockChecksums(false), _deltaResumeChunk(0), _deleteExisting(false) {}
     void start() Q_DECL_OVERRIDE;
 
-    bool isLikelyFinishedQuickly() Q_DECL_OVERRIDE { return _item->_size < 100*1024; }
+    TransferLane transferLane() Q_DECL_OVERRIDE { return OwncloudPropagator::transferLaneForSize(_item->_size); }
 
     /**
      * Whether an existing entity with the same name may be deleted before
@@ -205,6 +250,21 @@ public:
      */
     void setDeleteExisting(bool enabled);
 
+    /**
+     * Reads the file for a PropagateUploadBundle, instead of starting the job.
+     *
+     * Fills \a data with the contents and \a headers with the headers of
+     * its part of the bundle. Returns false if the file can't be sent in a
+     * bundle right now; the job is then started like any other.
+     */
+    bool prepareBundledUpload(QByteArray* data, QMap<QByteArray, QByteArray>* headers);
+
+    /**
+     * Completes the job once the bundle with the file was accepted by the
+     * server, without the job ever being started.
+     */
+    void finishBundledUpload(const QByteArray& etag, const QByteArray& fileId);
+
 private slots:
     void slotPutFinished();
     void slotPollFinished();
@@ -220,6 +280,11 @@ private slots:
 private:
     void startPollJob(const QString& path);
     void abortWithError(SyncFileItem::Status status, const QString &error);
+    bool startStreamingChecksums();
+    void finishStreamingChecksums();
+    bool sendsIfMatch() const;
+    void setupDeltaUpload();
+    void restartWithoutDelta();
 };
 
 }
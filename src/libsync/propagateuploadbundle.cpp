@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "propagateuploadbundle.h"
+#include "propagateupload.h"
+#include "owncloudpropagator_p.h"
+#include "account.h"
+
+#include <json.h>
+#include <QUrl>
+
+namespace OCC {
+
+/** Only files up to this size are bundled */
+static const qint64 maxBundledFileSize = 100 * 1024;
+
+UploadBundleJob::UploadBundleJob(AccountPtr account, const QString& path, QObject* parent)
+    : AbstractNetworkJob(account, path, parent)
+    , _boundary("owncloud-bundle-" + QByteArray::number(qrand(), 16) + QByteArray::number(qrand(), 16))
+{
+}
+
+UploadBundleJob::~UploadBundleJob()
+{
+    // Make sure that we destroy the QNetworkReply before our _device of which it keeps an internal pointer.
+    setReply(0);
+}
+
+qint64 UploadBundleJob::addFile(const QString& filePath, const QByteArray& data,
+                                const QMap<QByteArray, QByteArray>& headers)
+{
+    _body += "--" + _boundary + "\r\n";
+    _body += "X-File-Path: " + QUrl::toPercentEncoding(filePath, "/") + "\r\n";
+    for (QMap<QByteArray, QByteArray>::const_iterator it = headers.begin(); it != headers.end(); ++it) {
+        _body += it.key() + ": " + it.value() + "\r\n";
+    }
+    _body += "Content-Type: application/octet-stream\r\n";
+    _body += "Content-Length: " + QByteArray::number(data.size()) + "\r\n\r\n";
+    const qint64 offset = _body.size();
+    _body += data;
+    _body += "\r\n";
+    return offset;
+}
+
+void UploadBundleJob::start()
+{
+    _body += "--" + _boundary + "--\r\n";
+    _device.setBuffer(&_body);
+    _device.open(QIODevice::ReadOnly);
+
+    QNetworkRequest req;
+    req.setRawHeader("Content-Type", "multipart/related; boundary=" + _boundary);
+    setReply(davRequest("POST", path(), req, &_device));
+    setupConnections(reply());
+
+    if (reply()->error() != QNetworkReply::NoError) {
+        qWarning() << Q_FUNC_INFO << " Network error: " << reply()->errorString();
+    }
+
+    connect(reply(), SIGNAL(uploadProgress(qint64,qint64)), this, SIGNAL(uploadProgress(qint64,qint64)));
+    connect(this, SIGNAL(networkActivity()), account().data(), SIGNAL(propagatorNetworkActivity()));
+    AbstractNetworkJob::start();
+}
+
+bool UploadBundleJob::finished()
+{
+    qDebug() << Q_FUNC_INFO << reply()->request().url() << "FINISHED WITH STATUS"
+             << reply()->error()
+             << reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+
+    if (reply()->error() == QNetworkReply::NoError) {
+        bool ok = false;
+        const QString jsonStr = QString::fromUtf8(reply()->readAll());
+        _results = QtJson::parse(jsonStr, ok).toMap();
+        if (!ok) {
+            _errorString = tr("Invalid JSON reply to the bundled upload");
+            _results.clear();
+        }
+    }
+    emit finishedSignal();
+    return true;
+}
+
+QString UploadBundleJob::errorString() const
+{
+    if (!_errorString.isEmpty()) {
+        return _errorString;
+    }
+    return reply() ? reply()->errorString() : QString();
+}
+
+// ================================================================================
+
+bool PropagateUploadBundle::canBundle(OwncloudPropagator* propagator, const SyncFileItem& item)
+{
+    return maxBundledFiles() > 1
+        && !item._isDirectory
+        && item._direction == SyncFileItem::Up
+        // New files never need a If-Match header
+        && item._instruction == CSYNC_INSTRUCTION_NEW
+        && item._size <= maxBundledFileSize
+        // Admin recalls need their OC-Tag header
+        && !item._file.contains(".sys.admin#recall#")
+        && propagator->account()->capabilities().bundledUploadsAvailable();
+}
+
+bool PropagateUploadBundle::append(PropagateUploadFile* job)
+{
+    if (!_subJobs.isEmpty()
+            && (_subJobs.count() >= maxBundledFiles()
+                || _bundleSize + job->_item->_size > qint64(_propagator->chunkSize()))) {
+        return false;
+    }
+    _bundleSize += job->_item->_size;
+    appendJob(job);
+    return true;
+}
+
+bool PropagateUploadBundle::startBundle()
+{
+    if (_subJobs.count() < 2) {
+        return false;
+    }
+
+    _job = new UploadBundleJob(_propagator->account(), _propagator->_remoteFolder, this);
+    foreach (PropagateItemJob* itemJob, _subJobs) {
+        PropagateUploadFile* job = static_cast<PropagateUploadFile*>(itemJob);
+        QByteArray data;
+        QMap<QByteArray, QByteArray> headers;
+        if (job->prepareBundledUpload(&data, &headers)) {
+            _sentOffsets.append(_job->addFile(job->_item->_file, data, headers));
+            _sentJobs.append(job);
+        } else {
+            fallBack(job);
+        }
+    }
+
+    if (_sentJobs.count() < 2) {
+        // Not worth it
+        delete _job;
+        _sentJobs.clear();
+        _sentOffsets.clear();
+        return false;
+    }
+
+    qDebug() << "Uploading" << _sentJobs.count() << "files in one bundle";
+    connect(_job, SIGNAL(finishedSignal()), this, SLOT(slotBundleFinished()));
+    connect(_job, SIGNAL(uploadProgress(qint64,qint64)), this, SLOT(slotUploadProgress(qint64,qint64)));
+
+    requestStarted(_sentJobs.first());
+    _job->start();
+    return true;
+}
+
+void PropagateUploadBundle::slotUploadProgress(qint64 sent, qint64)
+{
+    for (int i = 0; i < _sentJobs.count(); ++i) {
+        const SyncFileItem& item = *_sentJobs.at(i)->_item;
+        const qint64 offset = _sentOffsets.at(i);
+        if (offset < sent) {
+            emit progress(item, qMin(sent - offset, qint64(item._size)));
+        }
+    }
+}
+
+void PropagateUploadBundle::slotBundleFinished()
+{
+    requestFinished();
+
+    if (_state == Finished) {
+        return;
+    }
+
+    const QVariantMap results = _job->results();
+    if (results.isEmpty()) {
+        qDebug() << "Bundled upload failed, uploading the files on their own:" << _job->errorString();
+    }
+
+    foreach (PropagateUploadFile* job, _sentJobs) {
+        const QVariantMap result = results.value(job->_item->_file).toMap();
+        const int status = result.value("status").toInt();
+        const QByteArray etag = parseEtag(result.value("etag").toByteArray().constData());
+        if (status >= 200 && status < 300 && !etag.isEmpty()) {
+            job->_item->_httpErrorCode = status;
+            job->_item->_responseTimeStamp = _job->responseTimestamp();
+            job->finishBundledUpload(etag, result.value("fileid").toByteArray());
+        } else {
+            if (!results.isEmpty()) {
+                qDebug() << "Bundled upload of" << job->_item->_file << "failed:"
+                         << status << result.value("error").toString();
+            }
+            fallBack(job);
+        }
+    }
+    _sentJobs.clear();
+    _sentOffsets.clear();
+
+    bundleFinished();
+}
+
+void PropagateUploadBundle::abort()
+{
+    if (_job && _job->reply()) {
+        _job->reply()->abort();
+    }
+    PropagateBundle::abort();
+}
+
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+#pragma once
+
+#include "owncloudpropagator.h"
+#include "networkjobs.h"
+
+#include <QBuffer>
+
+namespace OCC {
+
+class PropagateUploadFile;
+
+/**
+ * @brief Sends several files in one multipart/related POST
+ *
+ * Every part carries the path of its file, relative to the path of the
+ * job, in a X-File-Path header. The server replies with a JSON object that
+ * has the result of every file under its path:
+ *   { "a.txt": { "status": 201, "etag": "...", "fileid": "..." },
+ *     "b.txt": { "status": 507, "error": "..." } }
+ *
+ * @ingroup libsync
+ */
+class UploadBundleJob : public AbstractNetworkJob {
+    Q_OBJECT
+    QByteArray _boundary;
+    QByteArray _body;
+    QBuffer _device;
+    QVariantMap _results;
+    QString _errorString;
+
+public:
+    explicit UploadBundleJob(AccountPtr account, const QString& path, QObject* parent = 0);
+    ~UploadBundleJob();
+
+    /** Adds a part for \a filePath. Returns the offset of its data in the body. */
+    qint64 addFile(const QString& filePath, const QByteArray& data,
+                   const QMap<QByteArray, QByteArray>& headers);
+
+    void start() Q_DECL_OVERRIDE;
+    bool finished() Q_DECL_OVERRIDE;
+
+    /** The result of every file by path, empty if the reply was not usable */
+    QVariantMap results() const { return _results; }
+
+    QString errorString() const;
+
+signals:
+    void finishedSignal();
+    void uploadProgress(qint64, qint64);
+};
+
+/**
+ * @brief Uploads new small files of a directory together
+ *
+ * Sends the files of its PropagateUploadFile jobs in one UploadBundleJob,
+ * which saves a round trip per file.
+ *
+ * Files that could not be read, were refused by the server or were left
+ * out of its reply are uploaded by their jobs as usual afterwards, and so
+ * are all of them if the POST fails.
+ *
+ * @ingroup libsync
+ */
+class PropagateUploadBundle : public PropagateBundle {
+    Q_OBJECT
+public:
+    explicit PropagateUploadBundle(OwncloudPropagator* propagator)
+        : PropagateBundle(propagator), _bundleSize(0) {}
+
+    /** Whether the upload of \a item may be sent in a bundle */
+    static bool canBundle(OwncloudPropagator* propagator, const SyncFileItem& item);
+
+    /** Adds the job of a file that canBundle(). Returns false if the bundle is full. */
+    bool append(PropagateUploadFile* job);
+
+    void abort() Q_DECL_OVERRIDE;
+
+private slots:
+    void slotBundleFinished();
+    void slotUploadProgress(qint64 sent, qint64 total);
+
+private:
+    bool startBundle() Q_DECL_OVERRIDE;
+
+    qint64 _bundleSize; // of all files in the bundle
+
+    QPointer<UploadBundleJob> _job;
+    // The jobs of the files in _job, and the offsets of their data in its body
+    QVector<PropagateUploadFile*> _sentJobs;
+    QVector<qint64> _sentOffsets;
+};
+
+}
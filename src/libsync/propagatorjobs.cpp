@@ -228,7 +228,16 @@ void PropagateLocalRename::start()
 
     SyncJournalFileRecord oldRecord =
             _propagator->_journal->getFileRecord(_item->_originalFile);
-    _propagator->_journal->deleteFileRecord(_item->_originalFile);
+    if (!oldRecord.isValid() && _item->_file == _item->_renameTarget) {
+        // Below a moved directory: the move of the directory moved the record already
+        oldRecord = _propagator->_journal->getFileRecord(_item->_renameTarget);
+    }
+    if (_item->_isDirectory && _item->_file != _item->_renameTarget) {
+        // Move the records of the whole subtree, the children need not be discovered again
+        _propagator->_journal->renameFileRecords(_item->_originalFile, _item->_renameTarget);
+    } else {
+        _propagator->_journal->deleteFileRecord(_item->_originalFile);
+    }
 
     // store the rename file name in the item.
     const auto oldFile = _item->_file;
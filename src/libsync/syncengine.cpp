@@ -52,7 +52,7 @@ extern "C" const char *csync_instruction_str(enum csync_instructions_e instr);
 
 namespace OCC {
 
-bool SyncEngine::s_anySyncRunning = false;
+int SyncEngine::s_runningSyncs = 0;
 
 qint64 SyncEngine::minimumFileAgeForUpload = 2000;
 
@@ -72,6 +72,7 @@ SyncEngine::SyncEngine(AccountPtr account, const QString& localPath,
   , _backInTimeFiles(0)
   , _uploadLimit(0)
   , _downloadLimit(0)
+  , _totalLimit(0)
   , _newBigFolderSizeLimit(-1)
   , _checksum_hook(journal)
   , _anotherSyncNeeded(false)
@@ -416,11 +417,11 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
         item->_contentChecksumType = _journal->getChecksumType(file->checksumTypeId);
     }
 
-    // record the seen files to be able to clean the journal later
-    _seenFiles.insert(item->_file);
+    // mark the seen files to be able to clean the journal later
+    _journal->markSeen(item->_file);
     if (!renameTarget.isEmpty()) {
-        // Yes, this records both the rename renameTarget and the original so we keep both in case of a rename
-        _seenFiles.insert(renameTarget);
+        // Yes, this marks both the rename renameTarget and the original so we keep both in case of a rename
+        _journal->markSeen(renameTarget);
     }
 
     if (remote && file->remotePerm && file->remotePerm[0]) {
@@ -684,9 +685,8 @@ void SyncEngine::startSync()
         }
     }
 
-    Q_ASSERT(!s_anySyncRunning);
     Q_ASSERT(!_syncRunning);
-    s_anySyncRunning = true;
+    ++s_runningSyncs;
     _syncRunning = true;
     _anotherSyncNeeded = false;
     _clearTouchedFilesTimer.stop();
@@ -773,6 +773,11 @@ void SyncEngine::startSync()
     _csync_ctx->callbacks.checksum_hook = &CSyncChecksumHook::hook;
     _csync_ctx->callbacks.checksum_userdata = &_checksum_hook;
 
+    // csync reads the journal through its connection
+    _csync_ctx->callbacks.statedb_acquire_hook = &SyncJournalDb::csyncAcquireHook;
+    _csync_ctx->callbacks.statedb_release_hook = &SyncJournalDb::csyncReleaseHook;
+    _csync_ctx->callbacks.statedb_userdata = _journal;
+
     _stopWatch.start();
 
     qDebug() << "#### Discovery start #################################################### >>";
@@ -866,7 +871,10 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     _hasForwardInTimeFiles = false;
     _backInTimeFiles = 0;
     bool walkOk = true;
-    _seenFiles.clear();
+    _journal->startSyncGeneration();
+    // The blacklist is checked for every item, the upload and download infos
+    // are read by the propagation
+    _journal->loadSyncInfoCache();
     _temporarilyUnavailablePaths.clear();
     _renamedFolders.clear();
 
@@ -976,7 +984,7 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     connect(_propagator.data(), SIGNAL(touchedFile(QString)), SLOT(slotAddTouchedFile(QString)));
 
     // apply the network limits to the propagator
-    setNetworkLimits(_uploadLimit, _downloadLimit);
+    setNetworkLimits(_uploadLimit, _downloadLimit, _totalLimit);
 
     deleteStaleDownloadInfos();
     deleteStaleUploadInfos();
@@ -987,6 +995,13 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     if (_needsUpdate)
         emit(started());
 
+    // The first sync fills an empty journal: defer its indexes to the end
+    if (_csync_ctx->db_is_empty) {
+        _journal->beginBulkLoad();
+    }
+
+    // The file records of the propagation are written by the writer thread of the journal
+    _journal->startWriter();
     _propagator->start(_syncedItems);
 
     qDebug() << "<<#### Post-Reconcile end #################################################### " << _stopWatch.addLapTime(QLatin1String("Post-Reconcile Finished"));
@@ -998,15 +1013,17 @@ void SyncEngine::slotCleanPollsJobAborted(const QString &error)
     finalize(false);
 }
 
-void SyncEngine::setNetworkLimits(int upload, int download)
+void SyncEngine::setNetworkLimits(int upload, int download, int total)
 {
     _uploadLimit = upload;
     _downloadLimit = download;
+    _totalLimit = qMax(0, total);
 
     if( !_propagator ) return;
 
     _propagator->_uploadLimit = upload;
     _propagator->_downloadLimit = download;
+    _propagator->_totalLimit = _totalLimit;
 
     int propDownloadLimit = _propagator->_downloadLimit
 #if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
@@ -1019,9 +1036,17 @@ void SyncEngine::setNetworkLimits(int upload, int download)
 #endif
             ;
 
-    if( propDownloadLimit != 0 || propUploadLimit != 0 ) {
-        qDebug() << " N------N Network Limits (down/up) " << propDownloadLimit << propUploadLimit;
+    if( propDownloadLimit != 0 || propUploadLimit != 0 || _totalLimit != 0 ) {
+        qDebug() << " N------N Network Limits (down/up/total) " << propDownloadLimit << propUploadLimit << _totalLimit;
+    }
+}
+
+bool SyncEngine::prioritize(const QString &relativePath)
+{
+    if (!_propagator) {
+        return false;
     }
+    return _propagator->prioritize(relativePath);
 }
 
 void SyncEngine::slotItemCompleted(const SyncFileItem &item, const PropagatorJob &job)
@@ -1043,12 +1068,19 @@ void SyncEngine::slotFinished(bool success)
 {
     _anotherSyncNeeded = _anotherSyncNeeded || _propagator->_anotherSyncNeeded;
 
+    if (!_journal->stopWriter()) {
+        // The next sync discovers the items whose records were not written again
+        qWarning() << "Some file records could not be written to the journal";
+        _anotherSyncNeeded = true;
+    }
+    _journal->endBulkLoad();
+
     if (success) {
         _journal->setDataFingerprint(_discoveryMainThread->_dataFingerprint);
     }
 
     // emit the treewalk results.
-    if( ! _journal->postSyncCleanup( _seenFiles, _temporarilyUnavailablePaths ) ) {
+    if( ! _journal->postSyncCleanup( _temporarilyUnavailablePaths ) ) {
         qDebug() << "Cleaning of synced ";
     }
 
@@ -1066,9 +1098,14 @@ void SyncEngine::finalize(bool success)
     _journal->close();
 
     qDebug() << "CSync run took " << _stopWatch.addLapTime(QLatin1String("Sync Finished"));
+    const SqlDatabase::LockWaitStats lockWaits = SqlDatabase::lockWaitStats();
+    qDebug() << "Database lock waits since the start:" << lockWaits._waits << "waits,"
+             << lockWaits._timeouts << "timeouts," << lockWaits._waitMsecs << "msec in total,"
+             << lockWaits._maxWaitMsecs << "msec the longest";
     _stopWatch.stop();
 
-    s_anySyncRunning = false;
+    Q_ASSERT(s_runningSyncs > 0);
+    --s_runningSyncs;
     _syncRunning = false;
     emit finished(success);
 
@@ -64,13 +64,27 @@ public:
     static QString csyncErrorToString( CSYNC_STATUS);
 
     Q_INVOKABLE void startSync();
-    void setNetworkLimits(int upload, int download);
+    /** Limits in bytes/s, or negative for a percentage of the measured speed.
+     *
+     * total limits uploads and downloads together and can't be relative.
+     * It does not cap a direction that has a relative limit.
+     */
+    void setNetworkLimits(int upload, int download, int total = 0);
+
+    /** Propagate the item at relativePath (file or directory) before the others.
+     *
+     * Returns false if no sync is propagating or the item has nothing left to do.
+     */
+    bool prioritize(const QString &relativePath);
 
     /* Abort the sync.  Called from the main thread */
     void abort();
 
     bool isSyncRunning() const { return _syncRunning; }
 
+    /* How many engines are in the middle of a sync right now */
+    static int runningSyncCount() { return s_runningSyncs; }
+
     /* Set the maximum size a folder can have without asking for confirmation
      * -1 means infinite
      */
@@ -182,7 +196,7 @@ private:
     // cleanup and emit the finished signal
     void finalize(bool success);
 
-    static bool s_anySyncRunning; //true when one sync is running somewhere (for debugging)
+    static int s_runningSyncs; // number of engines with a sync running, folders sync in parallel
 
     // Must only be acessed during update and reconcile
     QMap<QString, SyncFileItemPtr> _syncItemMap;
@@ -203,16 +217,12 @@ private:
     QPointer<DiscoveryMainThread> _discoveryMainThread;
     QSharedPointer <OwncloudPropagator> _propagator;
 
-    // After a sync, only the syncdb entries whose filenames appear in this
-    // set will be kept. See _temporarilyUnavailablePaths.
-    QSet<QString> _seenFiles;
-
     // Some paths might be temporarily unavailable on the server, for
     // example due to 503 Storage not available. Deleting information
     // about the files from the database in these cases would lead to
     // incorrect synchronization.
-    // Therefore all syncdb entries whose filename starts with one of
-    // the paths in this set will be kept.
+    // Therefore all syncdb entries of the paths in this set and below
+    // them will be kept, even though they were not seen.
     // The specific case that fails otherwise is deleting a local file
     // while the remote says storage not available.
     QSet<QString> _temporarilyUnavailablePaths;
@@ -249,6 +259,7 @@ private:
 
     int _uploadLimit;
     int _downloadLimit;
+    int _totalLimit;
     /* maximum size a folder can have without asking for confirmation: -1 means infinite */
     qint64 _newBigFolderSizeLimit;
 
@@ -108,7 +108,7 @@ SyncFileStatus SyncFileStatusTracker::fileStatus(const QString& relativePath)
         return SyncFileStatus::StatusSync;
 
     // First look it up in the database to know if it's shared
-    SyncJournalFileRecord rec = _syncEngine->journal()->getFileRecord(relativePath);
+    SyncJournalFileRecord rec = _syncEngine->journal()->getFileRecordReadOnly(relativePath);
     if (rec.isValid()) {
         return resolveSyncAndErrorStatus(relativePath, rec._remotePerm.contains("S") ? Shared : NotShared);
     }
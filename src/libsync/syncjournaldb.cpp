@@ -21,6 +21,7 @@
 
 #include "syncjournaldb.h"
 #include "syncjournalfilerecord.h"
+#include "syncjournalwriter.h"
 #include "utility.h"
 #include "version.h"
 #include "filesystem.h"
@@ -29,8 +30,85 @@
 
 namespace OCC {
 
+/*
+ * Subtree queries
+ *
+ * The records below a directory are the ones whose path sorts between
+ * "dir/" and "dir0" ('0' follows '/' in ascii), a range the metadata_path
+ * index answers directly. LIKE(?||'/%') only uses an index when SQLite can
+ * prove that the pattern compares like the column, which depends on the
+ * build and on PRAGMA case_sensitive_like, and otherwise scans the whole
+ * table. csync_statedb_get_below_path() uses the same range.
+ *
+ * All queries on a subtree of the journal build their condition here.
+ */
+
+/** The condition for the paths below the directory bound to \a param, like "?1" */
+static QString belowPathCondition(const QString& param)
+{
+    return QString::fromLatin1("(path > (%1||'/') AND path < (%1||'0'))").arg(param);
+}
+
+/** Like belowPathCondition(), including the directory itself */
+static QString atOrBelowPathCondition(const QString& param)
+{
+    return QString::fromLatin1("(path == %1 OR %2)").arg(param, belowPathCondition(param));
+}
+
+static const char getFileRecordQueryC[] =
+        "SELECT path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize,"
+        "  ignoredChildrenRemote, contentChecksum, contentchecksumtype.name"
+        " FROM metadata"
+        "  LEFT JOIN checksumtype as contentchecksumtype ON metadata.contentChecksumTypeId == contentchecksumtype.id"
+        " WHERE phash=?1";
+
+/** Fills \a rec from the current row of a getFileRecordQueryC query */
+static void fillFileRecord(SqlQuery& query, SyncJournalFileRecord& rec)
+{
+    rec._path    = query.stringValue(0);
+    rec._inode   = query.intValue(1);
+    //rec._uid     = query.value(2).toInt(&ok); Not Used
+    //rec._gid     = query.value(3).toInt(&ok); Not Used
+    //rec._mode    = query.intValue(4);
+    rec._modtime = Utility::qDateTimeFromTime_t(query.int64Value(5));
+    rec._type    = query.intValue(6);
+    rec._etag    = query.baValue(7);
+    rec._fileId  = query.baValue(8);
+    rec._remotePerm = query.baValue(9);
+    rec._fileSize   = query.int64Value(10);
+    rec._serverHasIgnoredFiles = (query.intValue(11) > 0);
+    rec._contentChecksum = query.baValue(12);
+    if( !query.nullValue(13) ) {
+        rec._contentChecksumType = query.baValue(13);
+    }
+}
+
+/** The phash of a path, for queries that change paths, see SyncJournalDb::getPHash() */
+static void phashFunction(sqlite3_context* context, int, sqlite3_value** argv)
+{
+    const uint8_t* path = sqlite3_value_text(argv[0]);
+    const int len = sqlite3_value_bytes(argv[0]);
+    if (!path || len == 0) {
+        sqlite3_result_int64(context, -1);
+        return;
+    }
+    sqlite3_result_int64(context, c_jhash64(path, len, 0));
+}
+
+/** The directories \a path is below, "a" and "a/b" for "a/b/c": their records are found by phash */
+static QStringList parentPaths(const QString& path)
+{
+    QStringList parents;
+    int slashPos = path.indexOf(QLatin1Char('/'));
+    while (slashPos > 0) {
+        parents.append(path.left(slashPos));
+        slashPos = path.indexOf(QLatin1Char('/'), slashPos + 1);
+    }
+    return parents;
+}
+
 SyncJournalDb::SyncJournalDb(const QString& path, QObject *parent) :
-    QObject(parent), _transaction(0)
+    QObject(parent), _transaction(0), _generation(0), _bulkLoad(false), _syncInfoCacheLoaded(false), _writer(new SyncJournalWriter(this))
 {
 
     _dbFile = path;
@@ -190,6 +268,8 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Set PRAGMA case_sensitivity", pragma1);
     }
 
+    sqlite3_create_function(_db.sqliteDb(), "journal_phash", 1, SQLITE_UTF8, 0, phashFunction, 0, 0);
+
     /* Because insert is so slow, we do everything in a transaction, and only need one call to commit */
     startTransaction();
 
@@ -212,6 +292,7 @@ bool SyncJournalDb::checkConnect()
                         // ignoredChildrenRemote
                         // contentChecksum
                         // contentChecksumTypeId
+                        // generation
                          "PRIMARY KEY(phash)"
                          ");");
 
@@ -245,6 +326,18 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Create table uploadinfo", createQuery);
     }
 
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS blocksignatures("
+                           "path VARCHAR(4096),"
+                           "etag VARCHAR(32),"
+                           "blocksize INTEGER(8),"
+                           "checksums TEXT,"
+                           "PRIMARY KEY(path)"
+                           ");");
+
+    if (!createQuery.exec()) {
+        return sqlFail("Create table blocksignatures", createQuery);
+    }
+
     // create the blacklist table.
     createQuery.prepare("CREATE TABLE IF NOT EXISTS blacklist ("
                         "path VARCHAR(4096),"
@@ -286,6 +379,20 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Create table version", createQuery);
     }
 
+    // create the localchecksumcache table.
+    // Only one entry per inode and checksum type: a changed file replaces its old entry.
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS localchecksumcache("
+                        "inode INTEGER,"
+                        "checksumTypeId INTEGER,"
+                        "size INTEGER(8),"
+                        "modtime INTEGER(8),"
+                        "checksum TEXT,"
+                        "PRIMARY KEY(inode, checksumTypeId)"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table localchecksumcache", createQuery);
+    }
+
     // create the checksumtype table.
     createQuery.prepare("CREATE TABLE IF NOT EXISTS datafingerprint("
                         "fingerprint TEXT UNIQUE"
@@ -378,22 +485,23 @@ bool SyncJournalDb::checkConnect()
     }
 
     _getFileRecordQuery.reset(new SqlQuery(_db));
-    if (_getFileRecordQuery->prepare(
-            "SELECT path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize,"
-            "  ignoredChildrenRemote, contentChecksum, contentchecksumtype.name"
-            " FROM metadata"
-            "  LEFT JOIN checksumtype as contentchecksumtype ON metadata.contentChecksumTypeId == contentchecksumtype.id"
-            " WHERE phash=?1" )) {
+    if (_getFileRecordQuery->prepare(getFileRecordQueryC)) {
         return sqlFail("prepare _getFileRecordQuery", *_getFileRecordQuery);
     }
 
     _setFileRecordQuery.reset(new SqlQuery(_db) );
     if (_setFileRecordQuery->prepare("INSERT OR REPLACE INTO metadata "
-                                 "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId) "
-                                 "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16);" )) {
+                                 "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId, generation) "
+                                 "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17);" )) {
         return sqlFail("prepare _setFileRecordQuery", *_setFileRecordQuery);
     }
 
+    // Seen in both trees, a file is marked twice: only the first time changes the row
+    _markSeenQuery.reset(new SqlQuery(_db));
+    if (_markSeenQuery->prepare("UPDATE metadata SET generation=?1 WHERE phash=?2 AND generation<>?1;")) {
+        return sqlFail("prepare _markSeenQuery", *_markSeenQuery);
+    }
+
     _setFileRecordChecksumQuery.reset(new SqlQuery(_db) );
     if (_setFileRecordChecksumQuery->prepare(
             "UPDATE metadata"
@@ -446,6 +554,23 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("prepare _deleteUploadInfoQuery", *_deleteUploadInfoQuery);
     }
 
+    _getBlockSignaturesQuery.reset(new SqlQuery(_db));
+    if (_getBlockSignaturesQuery->prepare( "SELECT etag, blocksize, checksums FROM "
+                                       "blocksignatures WHERE path=?1" )) {
+        return sqlFail("prepare _getBlockSignaturesQuery", *_getBlockSignaturesQuery);
+    }
+
+    _setBlockSignaturesQuery.reset(new SqlQuery(_db));
+    if (_setBlockSignaturesQuery->prepare( "INSERT OR REPLACE INTO blocksignatures "
+                                       "(path, etag, blocksize, checksums) "
+                                       "VALUES ( ?1 , ?2, ?3 , ?4 )")) {
+        return sqlFail("prepare _setBlockSignaturesQuery", *_setBlockSignaturesQuery);
+    }
+
+    _deleteBlockSignaturesQuery.reset(new SqlQuery(_db));
+    if (_deleteBlockSignaturesQuery->prepare("DELETE FROM blocksignatures WHERE path=?1" )) {
+        return sqlFail("prepare _deleteBlockSignaturesQuery", *_deleteBlockSignaturesQuery);
+    }
 
     _deleteFileRecordPhash.reset(new SqlQuery(_db));
     if (_deleteFileRecordPhash->prepare("DELETE FROM metadata WHERE phash=?1")) {
@@ -453,7 +578,7 @@ bool SyncJournalDb::checkConnect()
     }
 
     _deleteFileRecordRecursively.reset(new SqlQuery(_db));
-    if (_deleteFileRecordRecursively->prepare("DELETE FROM metadata WHERE path LIKE(?||'/%')")) {
+    if (_deleteFileRecordRecursively->prepare("DELETE FROM metadata WHERE " + belowPathCondition("?1"))) {
         return sqlFail("prepare _deleteFileRecordRecursively", *_deleteFileRecordRecursively);
     }
 
@@ -496,6 +621,21 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("prepare _insertChecksumTypeQuery", *_insertChecksumTypeQuery);
     }
 
+    _getLocalChecksumCacheQuery.reset(new SqlQuery(_db));
+    if (_getLocalChecksumCacheQuery->prepare(
+            "SELECT checksum FROM localchecksumcache"
+            " WHERE inode=?1 AND checksumTypeId=?2 AND size=?3 AND modtime=?4")) {
+        return sqlFail("prepare _getLocalChecksumCacheQuery", *_getLocalChecksumCacheQuery);
+    }
+
+    _setLocalChecksumCacheQuery.reset(new SqlQuery(_db));
+    if (_setLocalChecksumCacheQuery->prepare(
+            "INSERT OR REPLACE INTO localchecksumcache"
+            " (inode, checksumTypeId, size, modtime, checksum)"
+            " VALUES (?1, ?2, ?3, ?4, ?5)")) {
+        return sqlFail("prepare _setLocalChecksumCacheQuery", *_setLocalChecksumCacheQuery);
+    }
+
     _getDataFingerprintQuery.reset(new SqlQuery(_db));
     if (_getDataFingerprintQuery->prepare("SELECT fingerprint FROM datafingerprint")) {
         return sqlFail("prepare _getDataFingerprintQuery", *_getDataFingerprintQuery);
@@ -513,6 +653,9 @@ bool SyncJournalDb::checkConnect()
     // don't start a new transaction now
     commitInternal(QString("checkConnect End"), false);
 
+    // The reader sees what this connection committed, so it opens last
+    openReader();
+
     // Hide 'em all!
     FileSystem::setFileHidden(databaseFilePath(), true);
     FileSystem::setFileHidden(databaseFilePath() + "-wal", true);
@@ -524,21 +667,36 @@ bool SyncJournalDb::checkConnect()
 
 void SyncJournalDb::close()
 {
+    _writer->stopWriting();
+    _writer->setBulkLoad(false);
+
     QMutexLocker locker(&_mutex);
     qDebug() << Q_FUNC_INFO << _dbFile;
 
+    // The indexes of a bulk load are created on the next connect
+    _bulkLoad = false;
+
+    _syncInfoCacheLoaded = false;
+    _downloadInfoCache.clear();
+    _uploadInfoCache.clear();
+    _errorBlacklistCache.clear();
+
     commitTransaction();
 
     _getFileRecordQuery.reset(0);
     _setFileRecordQuery.reset(0);
     _setFileRecordChecksumQuery.reset(0);
     _setFileRecordLocalMetadataQuery.reset(0);
+    _markSeenQuery.reset(0);
     _getDownloadInfoQuery.reset(0);
     _setDownloadInfoQuery.reset(0);
     _deleteDownloadInfoQuery.reset(0);
     _getUploadInfoQuery.reset(0);
     _setUploadInfoQuery.reset(0);
     _deleteUploadInfoQuery.reset(0);
+    _getBlockSignaturesQuery.reset(0);
+    _setBlockSignaturesQuery.reset(0);
+    _deleteBlockSignaturesQuery.reset(0);
     _deleteFileRecordPhash.reset(0);
     _deleteFileRecordRecursively.reset(0);
     _getErrorBlacklistQuery.reset(0);
@@ -547,12 +705,18 @@ void SyncJournalDb::close()
     _getChecksumTypeIdQuery.reset(0);
     _getChecksumTypeQuery.reset(0);
     _insertChecksumTypeQuery.reset(0);
+    _getLocalChecksumCacheQuery.reset(0);
+    _setLocalChecksumCacheQuery.reset(0);
     _getDataFingerprintQuery.reset(0);
     _setDataFingerprintQuery1.reset(0);
     _setDataFingerprintQuery2.reset(0);
 
     _db.close();
     _avoidReadFromDbOnNextSyncFilter.clear();
+
+    QMutexLocker readLocker(&_readMutex);
+    _readFileRecordQuery.reset(0);
+    _readDb.close();
 }
 
 
@@ -662,10 +826,101 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal("update database structure: add contentChecksumTypeId col");
     }
 
+    if( columns.indexOf(QLatin1String("generation")) == -1 ) {
+        SqlQuery query(_db);
+        query.prepare("ALTER TABLE metadata ADD COLUMN generation INTEGER DEFAULT 0;");
+        if( !query.exec()) {
+            sqlFail("updateMetadataTableStructure: add generation column", query);
+            re = false;
+        }
+
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_generation ON metadata(generation);");
+        if( !query.exec()) {
+            sqlFail("updateMetadataTableStructure: create index generation", query);
+            re = false;
+        }
+        commitInternal("update database structure: add generation col");
+    }
+
+    // Also brings back the indexes of an interrupted bulk load
+    if( !createMetadataIndexes() ) {
+        re = false;
+    }
+    commitInternal("update database structure: metadata indexes");
 
     return re;
 }
 
+/** The secondary indexes of the metadata table, see beginBulkLoad() */
+static const char* const metadataIndexesC[][2] = {
+    { "metadata_file_id", "fileid" },
+    { "metadata_inode", "inode" },
+    { "metadata_path", "path" },
+    { "metadata_generation", "generation" }
+};
+
+bool SyncJournalDb::createMetadataIndexes()
+{
+    for (size_t i = 0; i < sizeof(metadataIndexesC) / sizeof(metadataIndexesC[0]); ++i) {
+        SqlQuery query(_db);
+        query.prepare(QString("CREATE INDEX IF NOT EXISTS %1 ON metadata(%2);")
+                      .arg(metadataIndexesC[i][0], metadataIndexesC[i][1]));
+        if( !query.exec() ) {
+            return sqlFail("createMetadataIndexes", query);
+        }
+    }
+    return true;
+}
+
+void SyncJournalDb::beginBulkLoad()
+{
+    _writer->flush();
+
+    QMutexLocker locker(&_mutex);
+    if( _bulkLoad || !checkConnect() ) {
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(metadataIndexesC) / sizeof(metadataIndexesC[0]); ++i) {
+        SqlQuery query(_db);
+        query.prepare(QString("DROP INDEX IF EXISTS %1;").arg(metadataIndexesC[i][0]));
+        if( !query.exec() ) {
+            sqlFail("beginBulkLoad: drop index", query);
+            return;
+        }
+    }
+    commitInternal("begin bulk load");
+    _bulkLoad = true;
+    _writer->setBulkLoad(true);
+    qDebug() << "Journal bulk load started, the metadata indexes are dropped";
+}
+
+void SyncJournalDb::endBulkLoad()
+{
+    _writer->flush();
+    _writer->setBulkLoad(false);
+
+    QMutexLocker locker(&_mutex);
+    if( !_bulkLoad || !checkConnect() ) {
+        return;
+    }
+    _bulkLoad = false;
+
+    QElapsedTimer timer;
+    timer.start();
+    if( !createMetadataIndexes() ) {
+        return;
+    }
+    SqlQuery query(_db);
+    query.prepare("ANALYZE metadata;");
+    if( !query.exec() ) {
+        sqlFail("endBulkLoad: analyze", query);
+        return;
+    }
+    commitInternal("end bulk load");
+    qDebug() << "Journal bulk load ended, created the metadata indexes in" << timer.elapsed() << "msec";
+}
+
 bool SyncJournalDb::updateErrorBlacklistTableStructure()
 {
     QStringList columns = tableColumns("blacklist");
@@ -751,10 +1006,18 @@ qint64 SyncJournalDb::getPHash(const QString& file)
     return h;
 }
 
-bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
+bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& record )
 {
-    SyncJournalFileRecord record = _record;
+    if (_writer->enqueueFileRecord(record)) {
+        return true;
+    }
     QMutexLocker locker(&_mutex);
+    return setFileRecordLocked(record);
+}
+
+bool SyncJournalDb::setFileRecordLocked( const SyncJournalFileRecord& _record )
+{
+    SyncJournalFileRecord record = _record;
 
     if (!_avoidReadFromDbOnNextSyncFilter.isEmpty()) {
         // If we are a directory that should not be read from db next time, don't write the etag
@@ -797,6 +1060,7 @@ bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
         _setFileRecordQuery->bindValue(14, record._serverHasIgnoredFiles ? 1:0);
         _setFileRecordQuery->bindValue(15, record._contentChecksum );
         _setFileRecordQuery->bindValue(16, contentChecksumTypeId );
+        _setFileRecordQuery->bindValue(17, _generation );
 
         if( !_setFileRecordQuery->exec() ) {
             qWarning() << "Error SQL statement setFileRecord: " << _setFileRecordQuery->lastQuery() <<  " :"
@@ -819,6 +1083,8 @@ bool SyncJournalDb::setFileRecord( const SyncJournalFileRecord& _record )
 
 bool SyncJournalDb::deleteFileRecord(const QString& filename, bool recursively)
 {
+    _writer->flush();
+
     QMutexLocker locker(&_mutex);
 
     if( checkConnect() ) {
@@ -859,10 +1125,14 @@ bool SyncJournalDb::deleteFileRecord(const QString& filename, bool recursively)
 
 SyncJournalFileRecord SyncJournalDb::getFileRecord(const QString& filename)
 {
+    SyncJournalFileRecord rec;
+    if (_writer->pendingFileRecord(filename, &rec)) {
+        return rec;
+    }
+
     QMutexLocker locker(&_mutex);
 
     qlonglong phash = getPHash( filename );
-    SyncJournalFileRecord rec;
 
     if( !filename.isEmpty() && checkConnect() ) {
         _getFileRecordQuery->reset_and_clear_bindings();
@@ -877,22 +1147,7 @@ SyncJournalFileRecord SyncJournalDb::getFileRecord(const QString& filename)
         }
 
         if( _getFileRecordQuery->next() ) {
-            rec._path    = _getFileRecordQuery->stringValue(0);
-            rec._inode   = _getFileRecordQuery->intValue(1);
-            //rec._uid     = _getFileRecordQuery->value(2).toInt(&ok); Not Used
-            //rec._gid     = _getFileRecordQuery->value(3).toInt(&ok); Not Used
-            //rec._mode    = _getFileRecordQuery->intValue(4);
-            rec._modtime = Utility::qDateTimeFromTime_t(_getFileRecordQuery->int64Value(5));
-            rec._type    = _getFileRecordQuery->intValue(6);
-            rec._etag    = _getFileRecordQuery->baValue(7);
-            rec._fileId  = _getFileRecordQuery->baValue(8);
-            rec._remotePerm = _getFileRecordQuery->baValue(9);
-            rec._fileSize   = _getFileRecordQuery->int64Value(10);
-            rec._serverHasIgnoredFiles = (_getFileRecordQuery->intValue(11) > 0);
-            rec._contentChecksum = _getFileRecordQuery->baValue(12);
-            if( !_getFileRecordQuery->nullValue(13) ) {
-                rec._contentChecksumType = _getFileRecordQuery->baValue(13);
-            }
+            fillFileRecord(*_getFileRecordQuery, rec);
             _getFileRecordQuery->reset_and_clear_bindings();
         } else {
             int errId = _getFileRecordQuery->errorId();
@@ -911,62 +1166,213 @@ SyncJournalFileRecord SyncJournalDb::getFileRecord(const QString& filename)
     return rec;
 }
 
-bool SyncJournalDb::postSyncCleanup(const QSet<QString>& filepathsToKeep,
-                                    const QSet<QString>& prefixesToKeep)
+sqlite3* SyncJournalDb::csyncAcquireHook(void* userdata)
+{
+    SyncJournalDb* journal = static_cast<SyncJournalDb*>(userdata);
+    journal->_mutex.lock();
+    if (!journal->checkConnect()) {
+        return 0;
+    }
+    return journal->_db.sqliteDb();
+}
+
+void SyncJournalDb::csyncReleaseHook(void* userdata)
+{
+    static_cast<SyncJournalDb*>(userdata)->_mutex.unlock();
+}
+
+void SyncJournalDb::openReader()
+{
+    QMutexLocker readLocker(&_readMutex);
+    // The connection of the sync checked the database already
+    if (!_readDb.openReadOnly(_dbFile, false)) {
+        qWarning() << "Could not open the journal for reading, queries use the connection of the sync";
+        return;
+    }
+    // Without WAL the reader would hold back the commits of the sync
+    SqlQuery journalMode(_readDb);
+    journalMode.prepare("PRAGMA journal_mode;");
+    if (!journalMode.exec() || !journalMode.next()
+            || journalMode.stringValue(0).compare("wal", Qt::CaseInsensitive) != 0) {
+        journalMode.finish();
+        _readDb.close();
+        return;
+    }
+    journalMode.finish();
+
+    _readFileRecordQuery.reset(new SqlQuery(_readDb));
+    if (_readFileRecordQuery->prepare(getFileRecordQueryC)) {
+        qWarning() << "Error preparing the journal reader" << _readFileRecordQuery->error();
+        _readFileRecordQuery.reset(0);
+        _readDb.close();
+    }
+}
+
+SyncJournalFileRecord SyncJournalDb::getFileRecordReadOnly(const QString& filename)
 {
+    SyncJournalFileRecord rec;
+    if (_writer->pendingFileRecord(filename, &rec)) {
+        return rec;
+    }
+
+    QMutexLocker readLocker(&_readMutex);
+    if (!_readFileRecordQuery) {
+        readLocker.unlock();
+        return getFileRecord(filename);
+    }
+    if (filename.isEmpty()) {
+        return rec;
+    }
+
+    _readFileRecordQuery->reset_and_clear_bindings();
+    _readFileRecordQuery->bindValue(1, QString::number(getPHash(filename)));
+    if (_readFileRecordQuery->exec() && _readFileRecordQuery->next()) {
+        fillFileRecord(*_readFileRecordQuery, rec);
+    } else if (_readFileRecordQuery->errorId() != SQLITE_DONE) {
+        qDebug() << "Journal reader failed for" << filename << _readFileRecordQuery->error();
+    }
+    _readFileRecordQuery->reset_and_clear_bindings();
+    return rec;
+}
+
+void SyncJournalDb::startSyncGeneration()
+{
+    _writer->flush();
+
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
-        return false;
+        return;
     }
 
     SqlQuery query(_db);
-    query.prepare("SELECT phash, path FROM metadata order by path");
-
+    query.prepare("SELECT MAX(generation) FROM metadata");
     if (!query.exec()) {
-        QString err = query.error();
-        qDebug() << "Error creating prepared statement: " << query.lastQuery() << ", Error:" << err;;
-        return false;
+        qWarning() << "Error reading the sync generation: " << query.lastQuery() << ", Error:" << query.error();
+        return;
     }
+    const qint64 last = query.next() ? query.int64Value(0) : 0;
+    _generation = qMax(last, _generation) + 1;
+    qDebug() << "Sync generation" << _generation;
+}
 
-    QStringList superfluousItems;
+void SyncJournalDb::markSeen(const QString& file)
+{
+    QMutexLocker locker(&_mutex);
 
-    while(query.next()) {
-        const QString file = query.stringValue(1);
-        bool keep = filepathsToKeep.contains(file);
-        if( !keep ) {
-            foreach( const QString & prefix, prefixesToKeep ) {
-                if( file.startsWith(prefix) ) {
-                    keep = true;
-                    break;
-                }
-            }
-        }
-        if( !keep ) {
-            superfluousItems.append(query.stringValue(0));
-        }
+    if( !checkConnect() ) {
+        return;
     }
+    if (_transaction == 0) {
+        startTransaction();
+    }
+
+    _markSeenQuery->reset_and_clear_bindings();
+    _markSeenQuery->bindValue(1, _generation);
+    _markSeenQuery->bindValue(2, QString::number(getPHash(file)));
+    if (!_markSeenQuery->exec()) {
+        qWarning() << "Error marking" << file << "as seen: " << _markSeenQuery->lastQuery() << ", Error:" << _markSeenQuery->error();
+    }
+    _markSeenQuery->reset_and_clear_bindings();
+}
 
-    if( superfluousItems.count() )  {
-        QString sql = "DELETE FROM metadata WHERE phash in ("+ superfluousItems.join(",")+")";
-        qDebug() << "Sync Journal cleanup: " << sql;
-        SqlQuery delQuery(_db);
-        delQuery.prepare(sql);
-        if( !delQuery.exec() ) {
-            QString err = delQuery.error();
-            qDebug() << "Error removing superfluous journal entries: " << delQuery.lastQuery() << ", Error:" << err;;
+bool SyncJournalDb::postSyncCleanup(const QSet<QString>& prefixesToKeep)
+{
+    _writer->flush();
+
+    QMutexLocker locker(&_mutex);
+
+    if( !checkConnect() ) {
+        return false;
+    }
+
+    if (prefixesToKeep.contains(QString())) {
+        // The whole tree was unavailable, nothing was really seen
+        return true;
+    }
+
+    // The records below a temporarily unavailable path were not seen but are kept
+    SqlQuery keepQuery(_db);
+    keepQuery.prepare("UPDATE metadata SET generation=?1 WHERE " + atOrBelowPathCondition("?2"));
+    foreach( const QString & prefix, prefixesToKeep ) {
+        keepQuery.reset_and_clear_bindings();
+        keepQuery.bindValue(1, _generation);
+        keepQuery.bindValue(2, prefix);
+        if( !keepQuery.exec() ) {
+            qDebug() << "Error keeping journal entries: " << keepQuery.lastQuery() << ", Error:" << keepQuery.error();
             return false;
         }
     }
 
+    SqlQuery delQuery(_db);
+    delQuery.prepare("DELETE FROM metadata WHERE generation < ?1");
+    delQuery.bindValue(1, _generation);
+    if( !delQuery.exec() ) {
+        QString err = delQuery.error();
+        qDebug() << "Error removing superfluous journal entries: " << delQuery.lastQuery() << ", Error:" << err;;
+        return false;
+    }
+    qDebug() << "Sync Journal cleanup removed" << delQuery.numRowsAffected() << "entries older than generation" << _generation;
+
+    // Block signatures are only kept for files that are in the journal
+    SqlQuery signaturesCleanupQuery(_db);
+    signaturesCleanupQuery.prepare("DELETE FROM blocksignatures"
+                                   " WHERE path NOT IN (SELECT path FROM metadata)");
+    if( !signaturesCleanupQuery.exec() ) {
+        qDebug() << "Error removing stale block signatures: "
+                 << signaturesCleanupQuery.lastQuery() << ", Error:" << signaturesCleanupQuery.error();
+    }
+
+    // The local checksum cache only needs entries for files that are in the journal
+    SqlQuery cacheCleanupQuery(_db);
+    cacheCleanupQuery.prepare("DELETE FROM localchecksumcache"
+                              " WHERE inode NOT IN (SELECT inode FROM metadata)");
+    if( !cacheCleanupQuery.exec() ) {
+        qDebug() << "Error removing stale local checksum cache entries: "
+                 << cacheCleanupQuery.lastQuery() << ", Error:" << cacheCleanupQuery.error();
+    }
+
     // Incorporate results back into main DB
     walCheckpoint();
 
     return true;
 }
 
+bool SyncJournalDb::renameFileRecords(const QString& from, const QString& to)
+{
+    _writer->flush();
+
+    QMutexLocker locker(&_mutex);
+
+    if( !checkConnect() ) {
+        return false;
+    }
+
+    // The new path is "to" followed by what comes after "from".
+    // Records that were already written for the new paths are replaced.
+    const QString newPath = QLatin1String("(?2 || substr(path, length(?1) + 1))");
+    SqlQuery query(_db);
+    query.prepare("UPDATE OR REPLACE metadata SET"
+                  " path = " + newPath + ","
+                  " pathlen = length(CAST(" + newPath + " AS BLOB)),"
+                  " phash = journal_phash(" + newPath + "),"
+                  " generation = ?3"
+                  " WHERE " + atOrBelowPathCondition("?1"));
+    query.bindValue(1, from);
+    query.bindValue(2, to);
+    query.bindValue(3, _generation);
+    if( !query.exec() ) {
+        qWarning() << "Error renaming the records of" << from << "to" << to << query.error();
+        return false;
+    }
+    qDebug() << Q_FUNC_INFO << from << to << "(" << query.numRowsAffected() << " rows)";
+    return true;
+}
+
 int SyncJournalDb::getFileRecordCount()
 {
+    _writer->flush();
+
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
@@ -994,6 +1400,8 @@ bool SyncJournalDb::updateFileRecordChecksum(const QString& filename,
                                              const QByteArray& contentChecksum,
                                              const QByteArray& contentChecksumType)
 {
+    _writer->flush();
+
     QMutexLocker locker(&_mutex);
 
     qlonglong phash = getPHash(filename);
@@ -1028,6 +1436,8 @@ bool SyncJournalDb::updateLocalMetadata(const QString& filename,
                                         qint64 modtime, quint64 size, quint64 inode)
 
 {
+    _writer->flush();
+
     QMutexLocker locker(&_mutex);
 
     qlonglong phash = getPHash(filename);
@@ -1058,6 +1468,117 @@ bool SyncJournalDb::updateLocalMetadata(const QString& filename,
     return true;
 }
 
+QByteArray SyncJournalDb::getCachedLocalChecksum(quint64 inode, qint64 size, qint64 modtime,
+                                                 const QByteArray& checksumType)
+{
+    QMutexLocker locker(&_mutex);
+
+    if( inode == 0 || checksumType.isEmpty() || !checkConnect() ) {
+        return QByteArray();
+    }
+
+    int checksumTypeId = mapChecksumType(checksumType);
+    auto & query = _getLocalChecksumCacheQuery;
+
+    query->reset_and_clear_bindings();
+    query->bindValue(1, inode);
+    query->bindValue(2, checksumTypeId);
+    query->bindValue(3, size);
+    query->bindValue(4, modtime);
+
+    if( !query->exec() ) {
+        qWarning() << "Error SQL statement getCachedLocalChecksum: "
+                   << query->lastQuery() <<  " :"
+                   << query->error();
+        return QByteArray();
+    }
+
+    QByteArray checksum;
+    if( query->next() ) {
+        checksum = query->baValue(0);
+    }
+    query->reset_and_clear_bindings();
+    return checksum;
+}
+
+bool SyncJournalDb::setCachedLocalChecksum(quint64 inode, qint64 size, qint64 modtime,
+                                           const QByteArray& checksumType, const QByteArray& checksum)
+{
+    QMutexLocker locker(&_mutex);
+
+    if( inode == 0 || checksumType.isEmpty() || checksum.isEmpty() ) {
+        return false;
+    }
+    if( modtime >= Utility::qDateTimeToTime_t(QDateTime::currentDateTime()) - 1 ) {
+        qDebug() << "Not caching the checksum of recently modified inode" << inode;
+        return false;
+    }
+    if( !checkConnect() ) {
+        qDebug() << "Failed to connect database.";
+        return false;
+    }
+
+    int checksumTypeId = mapChecksumType(checksumType);
+    auto & query = _setLocalChecksumCacheQuery;
+
+    query->reset_and_clear_bindings();
+    query->bindValue(1, inode);
+    query->bindValue(2, checksumTypeId);
+    query->bindValue(3, size);
+    query->bindValue(4, modtime);
+    query->bindValue(5, checksum);
+
+    if( !query->exec() ) {
+        qWarning() << "Error SQL statement setCachedLocalChecksum: "
+                   << query->lastQuery() <<  " :"
+                   << query->error();
+        return false;
+    }
+
+    query->reset_and_clear_bindings();
+    return true;
+}
+
+QStringList SyncJournalDb::getFilesWithoutCachedLocalChecksum(const QByteArray& checksumType,
+                                                              const QString& after, int limit)
+{
+    _writer->flush();
+
+    QMutexLocker locker(&_mutex);
+
+    QStringList paths;
+    if( checksumType.isEmpty() || !checkConnect() ) {
+        return paths;
+    }
+
+    int checksumTypeId = mapChecksumType(checksumType);
+
+    SqlQuery query(_db);
+    query.prepare("SELECT path FROM metadata"
+                  " LEFT JOIN localchecksumcache AS cache"
+                  "  ON cache.inode == metadata.inode AND cache.checksumTypeId == ?1"
+                  " WHERE metadata.type == 0 AND metadata.inode != 0" // CSYNC_FTW_TYPE_FILE == 0
+                  "  AND (cache.inode IS NULL OR cache.size != metadata.filesize"
+                  "       OR cache.modtime != metadata.modtime)"
+                  "  AND metadata.path > ifnull(?2, '')"
+                  " ORDER BY metadata.path LIMIT ?3");
+    query.bindValue(1, checksumTypeId);
+    query.bindValue(2, after);
+    query.bindValue(3, limit);
+
+    if (!query.exec()) {
+        qWarning() << "Error SQL statement getFilesWithoutCachedLocalChecksum: "
+                   << query.lastQuery() <<  " :"
+                   << query.error();
+        return paths;
+    }
+
+    while (query.next()) {
+        paths.append(query.stringValue(0));
+    }
+    return paths;
+}
+
 bool SyncJournalDb::setFileRecordMetadata(const SyncJournalFileRecord& record)
 {
     SyncJournalFileRecord existing = getFileRecord(record._path);
@@ -1088,6 +1609,33 @@ static void toDownloadInfo(SqlQuery &query, SyncJournalDb::DownloadInfo * res)
     res->_valid      = ok;
 }
 
+static void toUploadInfo(SqlQuery &query, SyncJournalDb::UploadInfo * res)
+{
+    res->_chunk      = query.intValue(0);
+    res->_transferid = query.intValue(1);
+    res->_errorCount = query.intValue(2);
+    res->_size       = query.int64Value(3);
+    res->_modtime    = Utility::qDateTimeFromTime_t(query.int64Value(4));
+    res->_valid      = true;
+}
+
+static void toErrorBlacklistRecord(SqlQuery &query, SyncJournalErrorBlacklistRecord * entry)
+{
+    entry->_lastTryEtag    = query.baValue(0);
+    entry->_lastTryModtime = query.int64Value(1);
+    entry->_retryCount     = query.intValue(2);
+    entry->_errorString    = query.stringValue(3);
+    entry->_lastTryTime    = query.int64Value(4);
+    entry->_ignoreDuration = query.int64Value(5);
+    entry->_renameTarget   = query.stringValue(6);
+}
+
+/** The key of a path in the blacklist cache, like _getErrorBlacklistQuery compares them */
+static QString errorBlacklistKey(const QString& file)
+{
+    return Utility::fsCasePreserving() ? file.toLower() : file;
+}
+
 static bool deleteBatch(SqlQuery & query, const QStringList & entries, const QString & name)
 {
     if (entries.isEmpty())
@@ -1110,11 +1658,77 @@ static bool deleteBatch(SqlQuery & query, const QStringList & entries, const QSt
     return true;
 }
 
-SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString& file)
+void SyncJournalDb::loadSyncInfoCache()
 {
+    _writer->flush();
+
     QMutexLocker locker(&_mutex);
+    if( _syncInfoCacheLoaded || !checkConnect() ) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // The selected values *must* match the ones expected by toDownloadInfo() and friends.
+    QHash<QString, DownloadInfo> downloadInfos;
+    SqlQuery query(_db);
+    query.prepare("SELECT tmpfile, etag, errorcount, path FROM downloadinfo");
+    while (query.next()) {
+        DownloadInfo info;
+        toDownloadInfo(query, &info);
+        downloadInfos.insert(query.stringValue(3), info);
+    }
+    if (query.errorId() != SQLITE_DONE) {
+        qDebug() << "Could not load the download infos:" << query.error();
+        return;
+    }
 
+    QHash<QString, UploadInfo> uploadInfos;
+    query.prepare("SELECT chunk, transferid, errorcount, size, modtime, path FROM uploadinfo");
+    while (query.next()) {
+        UploadInfo info;
+        toUploadInfo(query, &info);
+        uploadInfos.insert(query.stringValue(5), info);
+    }
+    if (query.errorId() != SQLITE_DONE) {
+        qDebug() << "Could not load the upload infos:" << query.error();
+        return;
+    }
+
+    QHash<QString, SyncJournalErrorBlacklistRecord> errorBlacklist;
+    query.prepare("SELECT lastTryEtag, lastTryModtime, retrycount, errorstring, lastTryTime, ignoreDuration, renameTarget, path "
+                  "FROM blacklist");
+    while (query.next()) {
+        SyncJournalErrorBlacklistRecord entry;
+        toErrorBlacklistRecord(query, &entry);
+        entry._file = query.stringValue(7);
+        errorBlacklist.insert(errorBlacklistKey(entry._file), entry);
+    }
+    if (query.errorId() != SQLITE_DONE) {
+        qDebug() << "Could not load the error blacklist:" << query.error();
+        return;
+    }
+
+    _downloadInfoCache = downloadInfos;
+    _uploadInfoCache = uploadInfos;
+    _errorBlacklistCache = errorBlacklist;
+    _syncInfoCacheLoaded = true;
+    qDebug() << "Loaded" << downloadInfos.size() << "download infos," << uploadInfos.size() << "upload infos and"
+             << errorBlacklist.size() << "blacklist entries in" << timer.elapsed() << "msec";
+}
+
+SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString& file)
+{
     DownloadInfo res;
+    if (_writer->infoRemovalPending(SyncJournalWriter::DownloadInfoRemoval, file)) {
+        return res;
+    }
+
+    QMutexLocker locker(&_mutex);
+    if (_syncInfoCacheLoaded) {
+        return _downloadInfoCache.value(file);
+    }
 
     if( checkConnect() ) {
         _getDownloadInfoQuery->reset_and_clear_bindings();
@@ -1138,12 +1752,31 @@ SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString& file)
 
 void SyncJournalDb::setDownloadInfo(const QString& file, const SyncJournalDb::DownloadInfo& i)
 {
+    if (i._valid) {
+        // A queued removal must not delete it
+        _writer->flush();
+    } else if (_writer->enqueueInfoRemoval(SyncJournalWriter::DownloadInfoRemoval, file)) {
+        return;
+    }
+
     QMutexLocker locker(&_mutex);
+    setDownloadInfoLocked(file, i);
+}
 
+void SyncJournalDb::setDownloadInfoLocked(const QString& file, const SyncJournalDb::DownloadInfo& i)
+{
     if( !checkConnect() ) {
         return;
     }
 
+    if (_syncInfoCacheLoaded) {
+        if (i._valid) {
+            _downloadInfoCache.insert(file, i);
+        } else {
+            _downloadInfoCache.remove(file);
+        }
+    }
+
     if (i._valid) {
         _setDownloadInfoQuery->reset_and_clear_bindings();
         _setDownloadInfoQuery->bindValue(1, file);
@@ -1175,12 +1808,32 @@ void SyncJournalDb::setDownloadInfo(const QString& file, const SyncJournalDb::Do
 QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInfos(const QSet<QString>& keep)
 {
     QVector<SyncJournalDb::DownloadInfo> empty_result;
+    _writer->flush();
+
     QMutexLocker locker(&_mutex);
 
     if (!checkConnect()) {
         return empty_result;
     }
 
+    if (_syncInfoCacheLoaded) {
+        QStringList superfluousPaths;
+        QVector<SyncJournalDb::DownloadInfo> deleted_entries;
+        for (QHash<QString, DownloadInfo>::const_iterator it = _downloadInfoCache.constBegin();
+             it != _downloadInfoCache.constEnd(); ++it) {
+            if (!keep.contains(it.key())) {
+                superfluousPaths.append(it.key());
+                deleted_entries.append(it.value());
+            }
+        }
+        if (!deleteBatch(*_deleteDownloadInfoQuery, superfluousPaths, "downloadinfo"))
+            return empty_result;
+        foreach (const QString& file, superfluousPaths) {
+            _downloadInfoCache.remove(file);
+        }
+        return deleted_entries;
+    }
+
     SqlQuery query(_db);
     // The selected values *must* match the ones expected by toDownloadInfo().
     query.prepare("SELECT tmpfile, etag, errorcount, path FROM downloadinfo");
@@ -1213,8 +1866,12 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
 int SyncJournalDb::downloadInfoCount()
 {
     int re = 0;
+    _writer->flush();
 
     QMutexLocker locker(&_mutex);
+    if (_syncInfoCacheLoaded) {
+        return _downloadInfoCache.size();
+    }
     if( checkConnect() ) {
         SqlQuery query("SELECT count(*) FROM downloadinfo", _db);
 
@@ -1230,9 +1887,15 @@ int SyncJournalDb::downloadInfoCount()
 
 SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString& file)
 {
-    QMutexLocker locker(&_mutex);
-
     UploadInfo res;
+    if (_writer->infoRemovalPending(SyncJournalWriter::UploadInfoRemoval, file)) {
+        return res;
+    }
+
+    QMutexLocker locker(&_mutex);
+    if (_syncInfoCacheLoaded) {
+        return _uploadInfoCache.value(file);
+    }
 
     if( checkConnect() ) {
 
@@ -1246,13 +1909,7 @@ SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString& file)
         }
 
         if( _getUploadInfoQuery->next() ) {
-            bool ok = true;
-            res._chunk      = _getUploadInfoQuery->intValue(0);
-            res._transferid = _getUploadInfoQuery->intValue(1);
-            res._errorCount = _getUploadInfoQuery->intValue(2);
-            res._size       = _getUploadInfoQuery->int64Value(3);
-            res._modtime    = Utility::qDateTimeFromTime_t(_getUploadInfoQuery->int64Value(4));
-            res._valid      = ok;
+            toUploadInfo(*_getUploadInfoQuery, &res);
         }
         _getUploadInfoQuery->reset_and_clear_bindings();
     }
@@ -1261,12 +1918,31 @@ SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString& file)
 
 void SyncJournalDb::setUploadInfo(const QString& file, const SyncJournalDb::UploadInfo& i)
 {
+    if (i._valid) {
+        // A queued removal must not delete it
+        _writer->flush();
+    } else if (_writer->enqueueInfoRemoval(SyncJournalWriter::UploadInfoRemoval, file)) {
+        return;
+    }
+
     QMutexLocker locker(&_mutex);
+    setUploadInfoLocked(file, i);
+}
 
+void SyncJournalDb::setUploadInfoLocked(const QString& file, const SyncJournalDb::UploadInfo& i)
+{
     if( !checkConnect() ) {
         return;
     }
 
+    if (_syncInfoCacheLoaded) {
+        if (i._valid) {
+            _uploadInfoCache.insert(file, i);
+        } else {
+            _uploadInfoCache.remove(file);
+        }
+    }
+
     if (i._valid) {
         _setUploadInfoQuery->reset_and_clear_bindings();
         _setUploadInfoQuery->bindValue(1, file);
@@ -1296,14 +1972,92 @@ void SyncJournalDb::setUploadInfo(const QString& file, const SyncJournalDb::Uplo
     }
 }
 
+SyncJournalDb::BlockSignatures SyncJournalDb::getBlockSignatures(const QString& file)
+{
+    QMutexLocker locker(&_mutex);
+
+    BlockSignatures res;
+
+    if( checkConnect() ) {
+        _getBlockSignaturesQuery->reset_and_clear_bindings();
+        _getBlockSignaturesQuery->bindValue(1, file);
+
+        if (!_getBlockSignaturesQuery->exec()) {
+            QString err = _getBlockSignaturesQuery->error();
+            qDebug() << "Database error for file " << file << " : " << _getBlockSignaturesQuery->lastQuery() << ", Error:" << err;
+            return res;
+        }
+
+        if( _getBlockSignaturesQuery->next() ) {
+            res._etag      = _getBlockSignaturesQuery->baValue(0);
+            res._blockSize = _getBlockSignaturesQuery->int64Value(1);
+            res._checksums = _getBlockSignaturesQuery->baValue(2);
+            res._valid     = true;
+        }
+        _getBlockSignaturesQuery->reset_and_clear_bindings();
+    }
+    return res;
+}
+
+void SyncJournalDb::setBlockSignatures(const QString& file, const SyncJournalDb::BlockSignatures& i)
+{
+    QMutexLocker locker(&_mutex);
+
+    if( !checkConnect() ) {
+        return;
+    }
+
+    if (i._valid) {
+        _setBlockSignaturesQuery->reset_and_clear_bindings();
+        _setBlockSignaturesQuery->bindValue(1, file);
+        _setBlockSignaturesQuery->bindValue(2, i._etag);
+        _setBlockSignaturesQuery->bindValue(3, i._blockSize);
+        _setBlockSignaturesQuery->bindValue(4, i._checksums);
+
+        if( !_setBlockSignaturesQuery->exec() ) {
+            qWarning() << "Exec error of SQL statement: " << _setBlockSignaturesQuery->lastQuery() <<  " :"   << _setBlockSignaturesQuery->error();
+            return;
+        }
+
+        qDebug() <<  _setBlockSignaturesQuery->lastQuery() << file << i._etag << i._blockSize << i.blockCount();
+        _setBlockSignaturesQuery->reset_and_clear_bindings();
+    } else {
+        _deleteBlockSignaturesQuery->reset_and_clear_bindings();
+        _deleteBlockSignaturesQuery->bindValue(1, file);
+
+        if( !_deleteBlockSignaturesQuery->exec() ) {
+            qWarning() << "Exec error of SQL statement: " << _deleteBlockSignaturesQuery->lastQuery() <<  " : " << _deleteBlockSignaturesQuery->error();
+            return;
+        }
+        _deleteBlockSignaturesQuery->reset_and_clear_bindings();
+    }
+}
+
 bool SyncJournalDb::deleteStaleUploadInfos(const QSet<QString> &keep)
 {
+    _writer->flush();
+
     QMutexLocker locker(&_mutex);
 
     if (!checkConnect()) {
         return false;
     }
 
+    if (_syncInfoCacheLoaded) {
+        QStringList superfluousPaths;
+        foreach (const QString& file, _uploadInfoCache.keys()) {
+            if (!keep.contains(file)) {
+                superfluousPaths.append(file);
+            }
+        }
+        if (!deleteBatch(*_deleteUploadInfoQuery, superfluousPaths, "uploadinfo"))
+            return false;
+        foreach (const QString& file, superfluousPaths) {
+            _uploadInfoCache.remove(file);
+        }
+        return true;
+    }
+
     SqlQuery query(_db);
     query.prepare("SELECT path FROM uploadinfo");
 
@@ -1332,6 +2086,15 @@ SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry( const QStrin
 
     if( file.isEmpty() ) return entry;
 
+    if (_syncInfoCacheLoaded) {
+        QHash<QString, SyncJournalErrorBlacklistRecord>::const_iterator it = _errorBlacklistCache.constFind(errorBlacklistKey(file));
+        if (it != _errorBlacklistCache.constEnd()) {
+            entry = it.value();
+            entry._file = file;
+        }
+        return entry;
+    }
+
     // SELECT lastTryEtag, lastTryModtime, retrycount, errorstring
 
     if( checkConnect() ) {
@@ -1339,13 +2102,7 @@ SyncJournalErrorBlacklistRecord SyncJournalDb::errorBlacklistEntry( const QStrin
         _getErrorBlacklistQuery->bindValue( 1, file );
         if( _getErrorBlacklistQuery->exec() ){
             if( _getErrorBlacklistQuery->next() ) {
-                entry._lastTryEtag    = _getErrorBlacklistQuery->baValue(0);
-                entry._lastTryModtime = _getErrorBlacklistQuery->int64Value(1);
-                entry._retryCount     = _getErrorBlacklistQuery->intValue(2);
-                entry._errorString    = _getErrorBlacklistQuery->stringValue(3);
-                entry._lastTryTime    = _getErrorBlacklistQuery->int64Value(4);
-                entry._ignoreDuration = _getErrorBlacklistQuery->int64Value(5);
-                entry._renameTarget   = _getErrorBlacklistQuery->stringValue(6);
+                toErrorBlacklistRecord(*_getErrorBlacklistQuery, &entry);
                 entry._file           = file;
             }
             _getErrorBlacklistQuery->reset_and_clear_bindings();
@@ -1366,27 +2123,41 @@ bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QSet<QString> &keep)
         return false;
     }
 
-    SqlQuery query(_db);
-    query.prepare("SELECT path FROM blacklist");
+    QStringList superfluousPaths;
 
-    if (!query.exec()) {
-        QString err = query.error();
-        qDebug() << "Error creating prepared statement: " << query.lastQuery() << ", Error:" << err;
-        return false;
-    }
+    if (_syncInfoCacheLoaded) {
+        foreach (const SyncJournalErrorBlacklistRecord& entry, _errorBlacklistCache) {
+            if (!keep.contains(entry._file)) {
+                superfluousPaths.append(entry._file);
+            }
+        }
+    } else {
+        SqlQuery query(_db);
+        query.prepare("SELECT path FROM blacklist");
 
-    QStringList superfluousPaths;
+        if (!query.exec()) {
+            QString err = query.error();
+            qDebug() << "Error creating prepared statement: " << query.lastQuery() << ", Error:" << err;
+            return false;
+        }
 
-    while (query.next()) {
-        const QString file = query.stringValue(0);
-        if (!keep.contains(file)) {
-            superfluousPaths.append(file);
+        while (query.next()) {
+            const QString file = query.stringValue(0);
+            if (!keep.contains(file)) {
+                superfluousPaths.append(file);
+            }
         }
     }
 
     SqlQuery delQuery(_db);
     delQuery.prepare("DELETE FROM blacklist WHERE path = ?");
-    return deleteBatch(delQuery, superfluousPaths, "blacklist");
+    if (!deleteBatch(delQuery, superfluousPaths, "blacklist")) {
+        return false;
+    }
+    foreach (const QString& file, superfluousPaths) {
+        _errorBlacklistCache.remove(errorBlacklistKey(file));
+    }
+    return true;
 }
 
 int SyncJournalDb::errorBlackListEntryCount()
@@ -1394,6 +2165,9 @@ int SyncJournalDb::errorBlackListEntryCount()
     int re = 0;
 
     QMutexLocker locker(&_mutex);
+    if (_syncInfoCacheLoaded) {
+        return _errorBlacklistCache.size();
+    }
     if( checkConnect() ) {
         SqlQuery query("SELECT count(*) FROM blacklist", _db);
 
@@ -1419,6 +2193,7 @@ int SyncJournalDb::wipeErrorBlacklist()
             sqlFail("Deletion of whole blacklist failed", query);
             return -1;
         }
+        _errorBlacklistCache.clear();
         return query.numRowsAffected();
     }
     return -1;
@@ -1439,6 +2214,7 @@ void SyncJournalDb::wipeErrorBlacklistEntry( const QString& file )
         if( ! query.exec() ) {
             sqlFail("Deletion of blacklist item failed.", query);
         }
+        _errorBlacklistCache.remove(errorBlacklistKey(file));
         qDebug() <<  query.lastQuery() << file;
     }
 }
@@ -1462,6 +2238,9 @@ void SyncJournalDb::updateErrorBlacklistEntry( const SyncJournalErrorBlacklistRe
         QString bug = _setErrorBlacklistQuery->error();
         qDebug() << "SQL exec blacklistitem insert or replace failed: "<< bug;
     }
+    if (_syncInfoCacheLoaded) {
+        _errorBlacklistCache.insert(errorBlacklistKey(item._file), item);
+    }
     qDebug() << "set blacklist entry for " << item._file << item._retryCount
              << item._errorString << item._lastTryTime << item._ignoreDuration
              << item._lastTryModtime << item._lastTryEtag << item._renameTarget ;
@@ -1584,6 +2363,8 @@ void SyncJournalDb::setSelectiveSyncList(SyncJournalDb::SelectiveSyncListType ty
 
 void SyncJournalDb::avoidRenamesOnNextSync(const QString& path)
 {
+    _writer->flush();
+
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
@@ -1591,9 +2372,8 @@ void SyncJournalDb::avoidRenamesOnNextSync(const QString& path)
     }
 
     SqlQuery query(_db);
-    query.prepare("UPDATE metadata SET fileid = '', inode = '0' WHERE path == ?1 OR path LIKE(?2||'/%')");
+    query.prepare("UPDATE metadata SET fileid = '', inode = '0' WHERE " + atOrBelowPathCondition("?1"));
     query.bindValue(1, path);
-    query.bindValue(2, path);
     if( !query.exec() ) {
         qDebug() << Q_FUNC_INFO << "SQL error in avoidRenamesOnNextSync: "<< query.error();
     } else {
@@ -1612,6 +2392,8 @@ void SyncJournalDb::avoidReadFromDbOnNextSync(const QString& fileName)
     // get the info from the server
     // We achieve that by clearing the etag of the parents directory recursively
 
+    _writer->flush();
+
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
@@ -1619,14 +2401,19 @@ void SyncJournalDb::avoidReadFromDbOnNextSync(const QString& fileName)
     }
 
     SqlQuery query(_db);
-    // This query will match entries for which the path is a prefix of fileName
-    query.prepare("UPDATE metadata SET md5='_invalid_' WHERE ?1 LIKE(path||'/%') AND type == 2;"); // CSYNC_FTW_TYPE_DIR == 2
-    query.bindValue(1, fileName);
-    if( !query.exec() ) {
-        qDebug() << Q_FUNC_INFO << "SQL error in avoidRenamesOnNextSync: "<< query.error();
-    } else {
-        qDebug() << Q_FUNC_INFO << query.lastQuery()  << fileName << "(" << query.numRowsAffected() << " rows)";
+    // Update the entries for which the path is a prefix of fileName, one lookup by phash each
+    query.prepare("UPDATE metadata SET md5='_invalid_' WHERE phash=?1 AND type == 2;"); // CSYNC_FTW_TYPE_DIR == 2
+    int rows = 0;
+    foreach (const QString& parent, parentPaths(fileName)) {
+        query.reset_and_clear_bindings();
+        query.bindValue(1, QString::number(getPHash(parent)));
+        if( !query.exec() ) {
+            qDebug() << Q_FUNC_INFO << "SQL error in avoidReadFromDbOnNextSync: "<< query.error();
+            break;
+        }
+        rows += query.numRowsAffected();
     }
+    qDebug() << Q_FUNC_INFO << query.lastQuery()  << fileName << "(" << rows << " rows)";
 
     // Prevent future overwrite of the etag for this sync
     _avoidReadFromDbOnNextSyncFilter.append(fileName);
@@ -1634,6 +2421,8 @@ void SyncJournalDb::avoidReadFromDbOnNextSync(const QString& fileName)
 
 void SyncJournalDb::forceRemoteDiscoveryNextSync()
 {
+    _writer->flush();
+
     QMutexLocker locker(&_mutex);
 
     if( !checkConnect() ) {
@@ -1760,12 +2549,19 @@ void SyncJournalDb::setDataFingerprint(const QByteArray &dataFingerprint)
 
 void SyncJournalDb::commit(const QString& context, bool startTrans)
 {
+    _writer->flush();
+
     QMutexLocker lock(&_mutex);
     commitInternal(context, startTrans);
 }
 
 void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 {
+    if (_writer->isWriting()) {
+        // Committed with the next writes of the writer, or by commit()
+        return;
+    }
+
     QMutexLocker lock(&_mutex);
     if( _transaction == 1 ) {
         commitInternal(context, true);
@@ -1775,6 +2571,21 @@ void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 }
 
 
+void SyncJournalDb::startWriter()
+{
+    _writer->startWriting();
+}
+
+bool SyncJournalDb::stopWriter()
+{
+    return _writer->stopWriting();
+}
+
+bool SyncJournalDb::flush()
+{
+    return _writer->flush();
+}
+
 void SyncJournalDb::commitInternal(const QString& context, bool startTrans )
 {
     qDebug() << Q_FUNC_INFO << "Transaction commit " << context << (startTrans ? "and starting new transaction" : "");
@@ -1817,4 +2628,13 @@ bool operator==(const SyncJournalDb::UploadInfo & lhs,
             && lhs._transferid == rhs._transferid;
 }
 
+bool operator==(const SyncJournalDb::BlockSignatures & lhs,
+                const SyncJournalDb::BlockSignatures & rhs)
+{
+    return     lhs._etag == rhs._etag
+            && lhs._blockSize == rhs._blockSize
+            && lhs._checksums == rhs._checksums
+            && lhs._valid == rhs._valid;
+}
+
 } // namespace OCC
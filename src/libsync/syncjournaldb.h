@@ -21,10 +21,10 @@
 
 #include "utility.h"
 #include "ownsql.h"
+#include "syncjournalfilerecord.h"
 
 namespace OCC {
-class SyncJournalFileRecord;
-class SyncJournalErrorBlacklistRecord;
+class SyncJournalWriter;
 
 /**
  * @brief Class that handles the sync database
@@ -42,12 +42,39 @@ public:
     // to verify that the record could be queried successfully check
     // with SyncJournalFileRecord::isValid()
     SyncJournalFileRecord getFileRecord(const QString& filename);
+
+    /**
+     * Like getFileRecord(), for queries from the GUI and the socket API.
+     *
+     * It reads through a second, read-only connection and does not wait
+     * for the sync. It sees what was committed, and what is queued in the
+     * journal writer. While the journal is closed it is getFileRecord().
+     */
+    SyncJournalFileRecord getFileRecordReadOnly(const QString& filename);
+
+    /**
+     * The statedb hooks of csync, with the journal as userdata.
+     *
+     * csync reads the metadata table through the connection of the journal
+     * instead of opening its own one. Acquiring locks the journal and opens
+     * it if needed, releasing unlocks it again.
+     */
+    static sqlite3* csyncAcquireHook(void* userdata);
+    static void csyncReleaseHook(void* userdata);
     bool setFileRecord( const SyncJournalFileRecord& record );
 
     /// Like setFileRecord, but preserves checksums
     bool setFileRecordMetadata( const SyncJournalFileRecord& record );
 
     bool deleteFileRecord( const QString& filename, bool recursively = false );
+
+    /**
+     * Moves the records of \a from and of everything below it to \a to, in one statement.
+     *
+     * After a directory was moved, its children keep their records this way.
+     */
+    bool renameFileRecords(const QString& from, const QString& to);
+
     int getFileRecordCount();
     bool updateFileRecordChecksum(const QString& filename,
                                   const QByteArray& contentChecksum,
@@ -82,12 +109,38 @@ public:
         bool _valid;
     };
 
+    /**
+     * Checksums of the fixed size blocks of the last synced version of a file.
+     *
+     * Used to upload only the blocks that changed, see PropagateUploadFile.
+     * They describe the server version with the etag \a _etag.
+     */
+    struct BlockSignatures {
+        BlockSignatures() : _blockSize(0), _valid(false) {}
+        QByteArray _etag;
+        qint64 _blockSize;
+        QByteArray _checksums; // hex SHA1 of each block, concatenated
+        bool _valid;
+
+        int blockCount() const { return _checksums.size() / 40; }
+        QByteArray blockChecksum(int block) const { return _checksums.mid(block * 40, 40); }
+    };
+
     struct PollInfo {
         QString _file;
         QString _url;
         time_t _modtime;
     };
 
+    /**
+     * Reads the downloadinfo, uploadinfo and blacklist tables into memory.
+     *
+     * Until close(), the getters of these infos and the cleanups of stale
+     * entries look them up there instead of querying the database; the
+     * setters write through.
+     */
+    void loadSyncInfoCache();
+
     DownloadInfo getDownloadInfo(const QString &file);
     void setDownloadInfo(const QString &file, const DownloadInfo &i);
     QVector<DownloadInfo> getAndDeleteStaleDownloadInfos(const QSet<QString>& keep);
@@ -97,6 +150,9 @@ public:
     void setUploadInfo(const QString &file, const UploadInfo &i);
     bool deleteStaleUploadInfos(const QSet<QString>& keep);
 
+    BlockSignatures getBlockSignatures(const QString &file);
+    void setBlockSignatures(const QString &file, const BlockSignatures &i);
+
     SyncJournalErrorBlacklistRecord errorBlacklistEntry( const QString& );
     bool deleteStaleErrorBlacklistEntries(const QSet<QString>& keep);
 
@@ -135,8 +191,22 @@ public:
      */
     void forceRemoteDiscoveryNextSync();
 
-    bool postSyncCleanup(const QSet<QString>& filepathsToKeep,
-                         const QSet<QString>& prefixesToKeep);
+    /**
+     * Starts the generation of a new sync.
+     *
+     * File records written from now on and the ones passed to markSeen()
+     * belong to it, postSyncCleanup() deletes all others.
+     */
+    void startSyncGeneration();
+
+    /** The record of \a file, if there is one, belongs to the current sync generation. */
+    void markSeen(const QString& file);
+
+    /**
+     * Deletes the file records that do not belong to the current sync generation,
+     * except the ones of the paths in \a prefixesToKeep and below them.
+     */
+    bool postSyncCleanup(const QSet<QString>& prefixesToKeep);
 
     /* Because sqlite transactions are really slow, we encapsulate everything in big transactions
      * Commit will actually commit the transaction and create a new one.
@@ -144,6 +214,41 @@ public:
     void commit(const QString &context, bool startTrans = true);
     void commitIfNeededAndStartNewTransaction(const QString &context);
 
+    /**
+     * Hands setFileRecord() and the removal of upload and download infos to
+     * a SyncJournalWriter thread until stopWriter(), which commits them in
+     * big transactions.
+     *
+     * Reads see the queued writes, and commit() waits for them: what was
+     * written before a commit() is as durable as without the writer. In
+     * between, commitIfNeededAndStartNewTransaction() leaves the committing
+     * to the writer.
+     */
+    void startWriter();
+
+    /**
+     * Waits until the queued writes are committed and stops the writer.
+     *
+     * Returns false if some of them failed.
+     */
+    bool stopWriter();
+
+    /** Waits until the queued writes are committed, the writer keeps running */
+    bool flush();
+
+    /**
+     * Bulk load mode, for the first sync into an empty journal.
+     *
+     * beginBulkLoad() drops the secondary indexes of the metadata table, so
+     * the records of the sync are appended without updating them, and lets
+     * the writer commit bigger transactions. endBulkLoad() creates the
+     * indexes again and runs ANALYZE. In between, lookups by inode, file id
+     * or path scan the table. If the journal is closed before, the indexes
+     * are created when it is opened again.
+     */
+    void beginBulkLoad();
+    void endBulkLoad();
+
     void close();
 
     /**
@@ -156,6 +261,38 @@ public:
      */
     QByteArray getChecksumType(int checksumTypeId);
 
+    /**
+     * Returns the cached content checksum of a local file.
+     *
+     * The cache is keyed on the stat tuple of the file: a hit is only
+     * returned if inode, size and modtime all still match. Returns an
+     * empty QByteArray on a miss.
+     */
+    QByteArray getCachedLocalChecksum(quint64 inode, qint64 size, qint64 modtime,
+                                      const QByteArray& checksumType);
+
+    /**
+     * Stores the content checksum of a local file in the cache.
+     *
+     * Files modified within the last couple of seconds are not cached: a
+     * second write within the same second would not change the stat tuple.
+     */
+    bool setCachedLocalChecksum(quint64 inode, qint64 size, qint64 modtime,
+                                const QByteArray& checksumType, const QByteArray& checksum);
+
+    /**
+     * Returns the paths of the files in the journal that have no up to date
+     * cached local checksum of the given type.
+     *
+     * The journal's size and modtime are used, the caller needs to check the
+     * local file again before hashing it.
+     *
+     * The paths come sorted. Pass the last path of the previous call as
+     * \a after and a \a limit to go through them in batches.
+     */
+    QStringList getFilesWithoutCachedLocalChecksum(const QByteArray& checksumType,
+                                                   const QString& after = QString(), int limit = -1);
+
     /**
      * The data-fingerprint used to detect backup
      */
@@ -163,6 +300,12 @@ public:
     QByteArray dataFingerprint();
 
 private:
+    friend class SyncJournalWriter;
+
+    bool setFileRecordLocked(const SyncJournalFileRecord& record);
+    void setDownloadInfoLocked(const QString &file, const DownloadInfo &i);
+    void setUploadInfoLocked(const QString &file, const UploadInfo &i);
+
     bool updateDatabaseStructure();
     bool updateMetadataTableStructure();
     bool updateErrorBlacklistTableStructure();
@@ -171,6 +314,7 @@ private:
     void startTransaction();
     void commitTransaction();
     QStringList tableColumns( const QString& table );
+    bool createMetadataIndexes();
     bool checkConnect();
 
     // Same as forceRemoteDiscoveryNextSync but without acquiring the lock
@@ -184,19 +328,37 @@ private:
     SqlDatabase _db;
     QString _dbFile;
     QMutex _mutex; // Public functions are protected with the mutex.
+
+    // The read-only connection of getFileRecordReadOnly(), opened and closed with _db
+    void openReader();
+    SqlDatabase _readDb;
+    QMutex _readMutex; // protects _readDb and its queries
+    QScopedPointer<SqlQuery> _readFileRecordQuery;
     int _transaction;
+    qint64 _generation; // of the current sync, see startSyncGeneration()
+    bool _bulkLoad; // between beginBulkLoad() and endBulkLoad()
+
+    // See loadSyncInfoCache(), the blacklist by errorBlacklistKey()
+    bool _syncInfoCacheLoaded;
+    QHash<QString, DownloadInfo> _downloadInfoCache;
+    QHash<QString, UploadInfo> _uploadInfoCache;
+    QHash<QString, SyncJournalErrorBlacklistRecord> _errorBlacklistCache;
 
     // NOTE! when adding a query, don't forget to reset it in SyncJournalDb::close
     QScopedPointer<SqlQuery> _getFileRecordQuery;
     QScopedPointer<SqlQuery> _setFileRecordQuery;
     QScopedPointer<SqlQuery> _setFileRecordChecksumQuery;
     QScopedPointer<SqlQuery> _setFileRecordLocalMetadataQuery;
+    QScopedPointer<SqlQuery> _markSeenQuery;
     QScopedPointer<SqlQuery> _getDownloadInfoQuery;
     QScopedPointer<SqlQuery> _setDownloadInfoQuery;
     QScopedPointer<SqlQuery> _deleteDownloadInfoQuery;
     QScopedPointer<SqlQuery> _getUploadInfoQuery;
     QScopedPointer<SqlQuery> _setUploadInfoQuery;
     QScopedPointer<SqlQuery> _deleteUploadInfoQuery;
+    QScopedPointer<SqlQuery> _getBlockSignaturesQuery;
+    QScopedPointer<SqlQuery> _setBlockSignaturesQuery;
+    QScopedPointer<SqlQuery> _deleteBlockSignaturesQuery;
     QScopedPointer<SqlQuery> _deleteFileRecordPhash;
     QScopedPointer<SqlQuery> _deleteFileRecordRecursively;
     QScopedPointer<SqlQuery> _getErrorBlacklistQuery;
@@ -205,6 +367,8 @@ private:
     QScopedPointer<SqlQuery> _getChecksumTypeIdQuery;
     QScopedPointer<SqlQuery> _getChecksumTypeQuery;
     QScopedPointer<SqlQuery> _insertChecksumTypeQuery;
+    QScopedPointer<SqlQuery> _getLocalChecksumCacheQuery;
+    QScopedPointer<SqlQuery> _setLocalChecksumCacheQuery;
     QScopedPointer<SqlQuery> _getDataFingerprintQuery;
     QScopedPointer<SqlQuery> _setDataFingerprintQuery1;
     QScopedPointer<SqlQuery> _setDataFingerprintQuery2;
@@ -214,6 +378,8 @@ private:
      * that would write the etag and would void the purpose of avoidReadFromDbOnNextSync
      */
     QList<QString> _avoidReadFromDbOnNextSyncFilter;
+
+    QScopedPointer<SyncJournalWriter> _writer;
 };
 
 bool OWNCLOUDSYNC_EXPORT
@@ -222,6 +388,9 @@ operator==(const SyncJournalDb::DownloadInfo & lhs,
 bool OWNCLOUDSYNC_EXPORT
 operator==(const SyncJournalDb::UploadInfo & lhs,
            const SyncJournalDb::UploadInfo & rhs);
+bool OWNCLOUDSYNC_EXPORT
+operator==(const SyncJournalDb::BlockSignatures & lhs,
+           const SyncJournalDb::BlockSignatures & rhs);
 
 }  // namespace OCC
 #endif // SYNCJOURNALDB_H
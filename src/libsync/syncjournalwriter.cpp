@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncjournalwriter.h"
+#include "syncjournaldb.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+namespace OCC {
+
+/** The most writes committed in one transaction */
+static const int maxBatchSize = 1000;
+
+/** The same without indexes to update, see SyncJournalDb::beginBulkLoad() */
+static const int maxBulkBatchSize = 20000;
+
+/** How long the writer waits for more writes before it commits, checks OWNCLOUD_JOURNAL_COMMIT_INTERVAL (msec) */
+static int commitInterval()
+{
+    static int interval = -1;
+    if (interval < 0) {
+        bool ok = false;
+        interval = qgetenv("OWNCLOUD_JOURNAL_COMMIT_INTERVAL").toInt(&ok);
+        if (!ok || interval < 0) {
+            interval = 200;
+        }
+    }
+    return interval;
+}
+
+SyncJournalWriter::SyncJournalWriter(SyncJournalDb* journal)
+    : _journal(journal)
+    , _inFlight(0)
+    , _nextSeq(0)
+    , _writing(false)
+    , _stop(false)
+    , _flushRequested(false)
+    , _failed(false)
+    , _bulkLoad(false)
+{
+}
+
+SyncJournalWriter::~SyncJournalWriter()
+{
+    stopWriting();
+}
+
+void SyncJournalWriter::startWriting()
+{
+    static const bool disabled = !qgetenv("OWNCLOUD_DISABLE_JOURNAL_WRITER").isEmpty();
+    if (disabled) {
+        return;
+    }
+
+    QMutexLocker locker(&_queueMutex);
+    if (_writing) {
+        return;
+    }
+    _writing = true;
+    _stop = false;
+    locker.unlock();
+    start();
+}
+
+bool SyncJournalWriter::stopWriting()
+{
+    QMutexLocker locker(&_queueMutex);
+    if (_writing) {
+        // run() writes what is still queued before it returns
+        _stop = true;
+        _wakeUp.wakeAll();
+        locker.unlock();
+        wait();
+        locker.relock();
+    }
+    const bool ok = !_failed;
+    _failed = false;
+    return ok;
+}
+
+bool SyncJournalWriter::isWriting() const
+{
+    QMutexLocker locker(&_queueMutex);
+    return _writing;
+}
+
+bool SyncJournalWriter::enqueueFileRecord(const SyncJournalFileRecord& record)
+{
+    QMutexLocker locker(&_queueMutex);
+    if (!_writing) {
+        return false;
+    }
+    Write write;
+    write._type = FileRecord;
+    write._seq = ++_nextSeq;
+    write._record = record;
+    _queue.append(write);
+    _pendingRecords.insert(record._path, qMakePair(write._seq, record));
+    _wakeUp.wakeAll();
+    return true;
+}
+
+bool SyncJournalWriter::enqueueInfoRemoval(WriteType type, const QString& file)
+{
+    QMutexLocker locker(&_queueMutex);
+    if (!_writing) {
+        return false;
+    }
+    Write write;
+    write._type = type;
+    write._seq = ++_nextSeq;
+    write._file = file;
+    _queue.append(write);
+    if (type == DownloadInfoRemoval) {
+        _pendingDownloadInfoRemovals.insert(file, write._seq);
+    } else {
+        _pendingUploadInfoRemovals.insert(file, write._seq);
+    }
+    _wakeUp.wakeAll();
+    return true;
+}
+
+bool SyncJournalWriter::pendingFileRecord(const QString& path, SyncJournalFileRecord* record) const
+{
+    QMutexLocker locker(&_queueMutex);
+    QHash<QString, QPair<quint64, SyncJournalFileRecord> >::const_iterator it = _pendingRecords.constFind(path);
+    if (it == _pendingRecords.constEnd()) {
+        return false;
+    }
+    *record = it->second;
+    return true;
+}
+
+bool SyncJournalWriter::infoRemovalPending(WriteType type, const QString& file) const
+{
+    QMutexLocker locker(&_queueMutex);
+    if (type == DownloadInfoRemoval) {
+        return _pendingDownloadInfoRemovals.contains(file);
+    }
+    return _pendingUploadInfoRemovals.contains(file);
+}
+
+void SyncJournalWriter::setBulkLoad(bool bulkLoad)
+{
+    QMutexLocker locker(&_queueMutex);
+    _bulkLoad = bulkLoad;
+}
+
+bool SyncJournalWriter::flush()
+{
+    QMutexLocker locker(&_queueMutex);
+    if (!_queue.isEmpty() || _inFlight > 0) {
+        _flushRequested = true;
+        _wakeUp.wakeAll();
+        while (!_queue.isEmpty() || _inFlight > 0) {
+            _written.wait(&_queueMutex);
+        }
+    }
+    const bool ok = !_failed;
+    _failed = false;
+    return ok;
+}
+
+void SyncJournalWriter::run()
+{
+    QMutexLocker locker(&_queueMutex);
+    forever {
+        while (_queue.isEmpty() && !_stop) {
+            _wakeUp.wait(&_queueMutex);
+        }
+        if (_queue.isEmpty()) {
+            break;
+        }
+
+        // Group commit: let more writes arrive, unless somebody waits for them
+        const int batchSize = _bulkLoad ? maxBulkBatchSize : maxBatchSize;
+        QElapsedTimer timer;
+        timer.start();
+        while (!_stop && !_flushRequested && _queue.size() < batchSize
+               && timer.elapsed() < commitInterval()) {
+            _wakeUp.wait(&_queueMutex, commitInterval() - timer.elapsed());
+        }
+
+        const QList<Write> batch = _queue.mid(0, batchSize);
+        _queue = _queue.mid(batch.size());
+        _inFlight = batch.size();
+        locker.unlock();
+
+        const bool ok = writeBatch(batch);
+
+        locker.relock();
+        foreach (const Write& write, batch) {
+            if (write._type == FileRecord) {
+                QHash<QString, QPair<quint64, SyncJournalFileRecord> >::iterator it = _pendingRecords.find(write._record._path);
+                if (it != _pendingRecords.end() && it->first == write._seq) {
+                    _pendingRecords.erase(it);
+                }
+            } else {
+                QHash<QString, quint64>& removals = write._type == DownloadInfoRemoval
+                    ? _pendingDownloadInfoRemovals : _pendingUploadInfoRemovals;
+                QHash<QString, quint64>::iterator it = removals.find(write._file);
+                if (it != removals.end() && *it == write._seq) {
+                    removals.erase(it);
+                }
+            }
+        }
+        _inFlight = 0;
+        if (!ok) {
+            _failed = true;
+        }
+        if (_queue.isEmpty()) {
+            _flushRequested = false;
+        }
+        _written.wakeAll();
+    }
+    _writing = false;
+}
+
+bool SyncJournalWriter::writeBatch(const QList<Write>& batch)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QMutexLocker locker(&_journal->_mutex);
+    if (!_journal->checkConnect()) {
+        qWarning() << "Journal writer could not connect the database, lost" << batch.size() << "writes";
+        return false;
+    }
+    if (_journal->_transaction == 0) {
+        _journal->startTransaction();
+    }
+
+    bool ok = true;
+    foreach (const Write& write, batch) {
+        switch (write._type) {
+        case FileRecord:
+            ok = _journal->setFileRecordLocked(write._record) && ok;
+            break;
+        case DownloadInfoRemoval:
+            _journal->setDownloadInfoLocked(write._file, SyncJournalDb::DownloadInfo());
+            break;
+        case UploadInfoRemoval:
+            _journal->setUploadInfoLocked(write._file, SyncJournalDb::UploadInfo());
+            break;
+        }
+    }
+    _journal->commitInternal(QLatin1String("journal writer"), true);
+
+    qDebug() << "Journal writer committed" << batch.size() << "writes in" << timer.elapsed() << "msec";
+    return ok;
+}
+
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "syncjournalfilerecord.h"
+
+namespace OCC {
+
+class SyncJournalDb;
+
+/**
+ * @brief Writes file records to the journal in a thread of its own
+ *
+ * While it is running, SyncJournalDb queues the file records and the
+ * removals of upload and download infos here instead of executing them.
+ * The thread executes what accumulated in one transaction and commits it
+ * (group commit), so the thread of the propagator does not wait for SQLite
+ * when an item is done.
+ *
+ * The writes are executed in the order they were queued. Anything else
+ * that changes the same tables calls flush() first.
+ *
+ * @ingroup libsync
+ */
+class SyncJournalWriter : public QThread
+{
+    Q_OBJECT
+public:
+    enum WriteType {
+        FileRecord,
+        DownloadInfoRemoval,
+        UploadInfoRemoval
+    };
+
+    explicit SyncJournalWriter(SyncJournalDb* journal);
+    ~SyncJournalWriter();
+
+    /// Starts queueing. Does nothing if OWNCLOUD_DISABLE_JOURNAL_WRITER is set.
+    void startWriting();
+
+    /// Commits the queued writes and stops the thread. Returns false if a write failed.
+    bool stopWriting();
+
+    bool isWriting() const;
+
+    /// Queues a write. Returns false if the writer is not running: the caller writes then.
+    bool enqueueFileRecord(const SyncJournalFileRecord& record);
+    bool enqueueInfoRemoval(WriteType type, const QString& file);
+
+    /// The newest queued record of \a path, if there is one.
+    bool pendingFileRecord(const QString& path, SyncJournalFileRecord* record) const;
+
+    /// Whether the removal of the upload or download info of \a file is queued.
+    bool infoRemovalPending(WriteType type, const QString& file) const;
+
+    /// In the bulk load of the journal the batches are bigger.
+    void setBulkLoad(bool bulkLoad);
+
+    /**
+     * Waits until the queued writes are committed.
+     *
+     * Returns false if a write failed since the last call. Must not be
+     * called with the mutex of the journal held.
+     */
+    bool flush();
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    struct Write {
+        WriteType _type;
+        quint64 _seq;
+        SyncJournalFileRecord _record;
+        QString _file;
+    };
+
+    /// Executes and commits \a batch, with the mutex of the journal held.
+    bool writeBatch(const QList<Write>& batch);
+
+    SyncJournalDb* _journal;
+
+    mutable QMutex _queueMutex; // protects everything below
+    QWaitCondition _wakeUp;
+    QWaitCondition _written;
+    QList<Write> _queue;
+    int _inFlight; // writes taken from the queue and not committed yet
+    quint64 _nextSeq;
+    bool _writing;
+    bool _stop;
+    bool _flushRequested;
+    bool _failed;
+    bool _bulkLoad;
+
+    // What is queued or in flight, by path, with the seq of the newest write
+    QHash<QString, QPair<quint64, SyncJournalFileRecord> > _pendingRecords;
+    QHash<QString, quint64> _pendingDownloadInfoRemovals;
+    QHash<QString, quint64> _pendingUploadInfoRemovals;
+};
+
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "ziparchive.h"
+#include "compression.h"
+
+#include <QDebug>
+#include <QVector>
+
+#ifdef ZLIB_FOUND
+#include <zlib.h>
+#endif
+
+namespace OCC {
+
+static const quint32 localHeaderSignature = 0x04034b50;
+static const quint32 centralHeaderSignature = 0x02014b50;
+static const quint32 endOfCentralDirSignature = 0x06054b50;
+static const quint32 zip64EndOfCentralDirSignature = 0x06064b50;
+static const quint32 zip64LocatorSignature = 0x07064b50;
+
+static const int localHeaderSize = 30;
+static const int centralHeaderSize = 46;
+static const int endOfCentralDirSize = 22;
+static const int zip64LocatorSize = 20;
+static const int zip64EndOfCentralDirSize = 56;
+
+// All numbers in zip archives are little endian
+static quint16 readUInt16(const QByteArray& data, int pos)
+{
+    const uchar* p = reinterpret_cast<const uchar*>(data.constData()) + pos;
+    return p[0] | (p[1] << 8);
+}
+
+static quint32 readUInt32(const QByteArray& data, int pos)
+{
+    return readUInt16(data, pos) | (quint32(readUInt16(data, pos + 2)) << 16);
+}
+
+static quint64 readUInt64(const QByteArray& data, int pos)
+{
+    return readUInt32(data, pos) | (quint64(readUInt32(data, pos + 4)) << 32);
+}
+
+static bool readAt(QIODevice* device, qint64 pos, qint64 size, QByteArray* data)
+{
+    if (pos < 0 || size < 0 || !device->seek(pos)) {
+        return false;
+    }
+    *data = device->read(size);
+    return data->size() == size;
+}
+
+ZipArchive::ZipArchive(QIODevice* device)
+    : _device(device)
+{
+}
+
+bool ZipArchive::open()
+{
+    _entries.clear();
+    _entryNames.clear();
+
+    // The end of central directory record is followed by a comment of up to 64KB
+    const qint64 deviceSize = _device->size();
+    const qint64 tailSize = qMin(deviceSize, qint64(endOfCentralDirSize + 0xFFFF));
+    QByteArray tail;
+    if (!readAt(_device, deviceSize - tailSize, tailSize, &tail)) {
+        return false;
+    }
+    int eocd = tail.size() - endOfCentralDirSize;
+    while (eocd >= 0 && readUInt32(tail, eocd) != endOfCentralDirSignature) {
+        --eocd;
+    }
+    if (eocd < 0) {
+        qDebug() << "Not a zip archive";
+        return false;
+    }
+
+    qint64 entryCount = readUInt16(tail, eocd + 10);
+    qint64 centralDirSize = readUInt32(tail, eocd + 12);
+    qint64 centralDirOffset = readUInt32(tail, eocd + 16);
+
+    const qint64 locatorPos = deviceSize - tailSize + eocd - zip64LocatorSize;
+    QByteArray locator;
+    if (locatorPos >= 0 && readAt(_device, locatorPos, zip64LocatorSize, &locator)
+            && readUInt32(locator, 0) == zip64LocatorSignature) {
+        QByteArray record;
+        if (!readAt(_device, readUInt64(locator, 8), zip64EndOfCentralDirSize, &record)
+                || readUInt32(record, 0) != zip64EndOfCentralDirSignature) {
+            qDebug() << "Broken zip64 end of central directory";
+            return false;
+        }
+        entryCount = readUInt64(record, 32);
+        centralDirSize = readUInt64(record, 40);
+        centralDirOffset = readUInt64(record, 48);
+    }
+
+    QByteArray centralDir;
+    if (!readAt(_device, centralDirOffset, centralDirSize, &centralDir)) {
+        qDebug() << "Broken zip central directory";
+        return false;
+    }
+
+    int pos = 0;
+    for (qint64 i = 0; i < entryCount; ++i) {
+        if (pos + centralHeaderSize > centralDir.size()
+                || readUInt32(centralDir, pos) != centralHeaderSignature) {
+            qDebug() << "Broken zip central directory entry" << i;
+            return false;
+        }
+        const quint16 flags = readUInt16(centralDir, pos + 8);
+        const int nameLength = readUInt16(centralDir, pos + 28);
+        const int extraLength = readUInt16(centralDir, pos + 30);
+        const int commentLength = readUInt16(centralDir, pos + 32);
+        const int headerEnd = pos + centralHeaderSize + nameLength + extraLength + commentLength;
+        if (headerEnd > centralDir.size()) {
+            qDebug() << "Broken zip central directory entry" << i;
+            return false;
+        }
+
+        Entry entry;
+        entry._method = readUInt16(centralDir, pos + 10);
+        entry._crc = readUInt32(centralDir, pos + 16);
+        entry._compressedSize = readUInt32(centralDir, pos + 20);
+        entry._size = readUInt32(centralDir, pos + 24);
+        entry._localHeaderOffset = readUInt32(centralDir, pos + 42);
+        const QString name = QString::fromUtf8(centralDir.mid(pos + centralHeaderSize, nameLength));
+
+        // The zip64 extra field has the values that did not fit, in this order
+        int extra = pos + centralHeaderSize + nameLength;
+        const int extraEnd = extra + extraLength;
+        while (extra + 4 <= extraEnd) {
+            const quint16 id = readUInt16(centralDir, extra);
+            const int size = readUInt16(centralDir, extra + 2);
+            int field = extra + 4;
+            if (id == 0x0001) {
+                qint64* values[] = { &entry._size, &entry._compressedSize, &entry._localHeaderOffset };
+                for (qint64* value : values) {
+                    if (*value == 0xFFFFFFFF && field + 8 <= extra + 4 + size) {
+                        *value = readUInt64(centralDir, field);
+                        field += 8;
+                    }
+                }
+            }
+            extra += 4 + size;
+        }
+        pos = headerEnd;
+
+        // Encrypted entries are of no use, and directories are implied by the paths
+        if ((flags & 0x1) || name.endsWith(QLatin1Char('/'))) {
+            continue;
+        }
+        if (!_entries.contains(name)) {
+            _entryNames.append(name);
+        }
+        _entries.insert(name, entry);
+    }
+    return true;
+}
+
+qint64 ZipArchive::fileSize(const QString& name) const
+{
+    QHash<QString, Entry>::const_iterator it = _entries.constFind(name);
+    return it == _entries.constEnd() ? -1 : it->_size;
+}
+
+QByteArray ZipArchive::read(const QString& name) const
+{
+    QHash<QString, Entry>::const_iterator it = _entries.constFind(name);
+    if (it == _entries.constEnd()) {
+        return QByteArray();
+    }
+    const Entry& entry = *it;
+
+    QByteArray header;
+    if (!readAt(_device, entry._localHeaderOffset, localHeaderSize, &header)
+            || readUInt32(header, 0) != localHeaderSignature) {
+        qDebug() << "Broken zip local header of" << name;
+        return QByteArray();
+    }
+    // The sizes in the local header may be left out, but the name and extra lengths are not
+    const qint64 dataPos = entry._localHeaderOffset + localHeaderSize
+        + readUInt16(header, 26) + readUInt16(header, 28);
+    QByteArray compressed;
+    if (!readAt(_device, dataPos, entry._compressedSize, &compressed)) {
+        qDebug() << "Truncated zip entry" << name;
+        return QByteArray();
+    }
+
+    QByteArray data;
+    if (entry._method == 0) {
+        data = compressed;
+        if (data.isNull()) {
+            data = QByteArray("");
+        }
+    } else if (entry._method == 8) {
+        data = inflateRaw(compressed, entry._size);
+    } else {
+        qDebug() << "Unsupported compression method" << entry._method << "of zip entry" << name;
+        return QByteArray();
+    }
+
+    if (data.isNull() || data.size() != entry._size || crc32(data) != entry._crc) {
+        qDebug() << "Corrupt zip entry" << name;
+        return QByteArray();
+    }
+    return data;
+}
+
+#ifndef ZLIB_FOUND
+static QVector<quint32> crc32Table()
+{
+    QVector<quint32> table(256);
+    for (quint32 i = 0; i < 256; ++i) {
+        quint32 c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+    }
+    return table;
+}
+#endif
+
+quint32 ZipArchive::crc32(const QByteArray& data)
+{
+#ifdef ZLIB_FOUND
+    return ::crc32(::crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(data.constData()), data.size());
+#else
+    // Only stored entries can be read without zlib. The table is built
+    // once, by the first thread that gets here.
+    static const QVector<quint32> table = crc32Table();
+    quint32 crc = 0xFFFFFFFF;
+    const uchar* p = reinterpret_cast<const uchar*>(data.constData());
+    for (int i = 0; i < data.size(); ++i) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+#endif
+}
+
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) by ownCloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QIODevice>
+#include <QStringList>
+
+namespace OCC {
+
+/**
+ * @brief Reads the files of a zip archive
+ *
+ * Only what the server produces is supported: stored or deflated entries,
+ * without encryption, and zip64 for big archives. The names are expected
+ * in UTF-8.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ZipArchive
+{
+public:
+    /// DOES NOT take ownership of the device, which must be open and seekable.
+    explicit ZipArchive(QIODevice* device);
+
+    /// Reads the central directory. Returns false if it is not a usable archive.
+    bool open();
+
+    QStringList fileNames() const { return _entryNames; }
+    bool contains(const QString& name) const { return _entries.contains(name); }
+
+    /// The uncompressed size of the entry, or -1 if there is no such entry.
+    qint64 fileSize(const QString& name) const;
+
+    /**
+     * Reads the content of an entry.
+     *
+     * Returns a null array if there is no such entry, or if it could not be
+     * read, uncompressed or did not match its CRC-32.
+     */
+    QByteArray read(const QString& name) const;
+
+    /// The CRC-32 used in zip archives
+    static quint32 crc32(const QByteArray& data);
+
+private:
+    struct Entry {
+        quint16 _method;
+        quint32 _crc;
+        qint64 _compressedSize;
+        qint64 _size;
+        qint64 _localHeaderOffset;
+    };
+
+    QIODevice* _device;
+    QHash<QString, Entry> _entries;
+    QStringList _entryNames;
+};
+
+}
@@ -0,0 +1,86 @@
+/*
+ * This software is in the public domain, furnished "as is", without technical
+ * support, and with no warranty, express or implied, as to its usefulness for
+ * any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "checksums.h"
+#include "filesystem.h"
+#include "propagatorjobs.h"
+
+using namespace OCC;
+
+/*
+ * Compares computing the checksums one after the other with computing
+ * them in a single pass over the file.
+ *
+ * Set OWNCLOUD_BENCH_FILE_SIZE to the file size in MB, 64 by default.
+ * The file is likely in the page cache, so this measures the hashing
+ * rather than the disk.
+ */
+class BenchChecksums : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _dir;
+    QString _file;
+
+private slots:
+    void initTestCase() {
+        int sizeMb = qgetenv("OWNCLOUD_BENCH_FILE_SIZE").toInt();
+        if (sizeMb <= 0) {
+            sizeMb = 64;
+        }
+        _file = _dir.path() + "/bench";
+        QFile file(_file);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QByteArray block(1024 * 1024, Qt::Uninitialized);
+        for (int i = 0; i < block.size(); ++i) {
+            block[i] = char(qrand());
+        }
+        for (int i = 0; i < sizeMb; ++i) {
+            file.write(block);
+        }
+    }
+
+    void benchAdler32() {
+        QBENCHMARK {
+            ComputeChecksum::computeNow(_file, checkSumAdlerC);
+        }
+    }
+
+    void benchMd5() {
+        QBENCHMARK {
+            ComputeChecksum::computeNow(_file, checkSumMD5C);
+        }
+    }
+
+    void benchSha1() {
+        QBENCHMARK {
+            ComputeChecksum::computeNow(_file, checkSumSHA1C);
+        }
+    }
+
+    void benchAllSeparately() {
+        QBENCHMARK {
+            FileSystem::calcAdler32(_file);
+            FileSystem::calcMd5(_file);
+            FileSystem::calcSha1(_file);
+        }
+    }
+
+    void benchAllInOnePass() {
+        QList<QByteArray> types;
+        types << checkSumAdlerC << checkSumMD5C << checkSumSHA1C;
+        QBENCHMARK {
+            ComputeChecksum::computeNow(_file, types);
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(BenchChecksums)
+#include "benchchecksums.moc"
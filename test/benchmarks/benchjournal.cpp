@@ -0,0 +1,119 @@
+/*
+ * This software is in the public domain, furnished "as is", without technical
+ * support, and with no warranty, express or implied, as to its usefulness for
+ * any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "ownsql.h"
+#include "syncjournaldb.h"
+#include "syncjournalfilerecord.h"
+
+using namespace OCC;
+
+static void dropDebugMessages(QtMsgType type, const QMessageLogContext&, const QString& msg)
+{
+    if (type != QtDebugMsg) {
+        fprintf(stderr, "%s\n", qPrintable(msg));
+    }
+}
+
+/*
+ * Compares the subtree queries of the journal, the LIKE(?||'/%') form they
+ * used and the path range form they use now.
+ *
+ * Set OWNCLOUD_BENCH_JOURNAL_ROWS to the number of file records, 1000000
+ * by default, in directories of 1000 files each.
+ */
+class BenchJournal : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _dir;
+    SyncJournalDb* _journal;
+    SqlDatabase _db;
+    QString _subtree;
+
+    int countRows(const QString& sql) {
+        SqlQuery query(_db);
+        query.prepare(sql);
+        query.bindValue(1, _subtree);
+        if (!query.exec() || !query.next()) {
+            return -1;
+        }
+        return query.intValue(0);
+    }
+
+private slots:
+    void initTestCase() {
+        qInstallMessageHandler(dropDebugMessages);
+
+        int rows = qgetenv("OWNCLOUD_BENCH_JOURNAL_ROWS").toInt();
+        if (rows <= 0) {
+            rows = 1000000;
+        }
+        _journal = new SyncJournalDb(_dir.path(), this);
+        _journal->commit("bench");
+        SyncJournalFileRecord record;
+        record._modtime = QDateTime::currentDateTimeUtc();
+        record._etag = "etag";
+        record._fileId = "fileid";
+        for (int i = 0; i < rows; ++i) {
+            record._path = QString("dir%1/file%2").arg(i / 1000).arg(i % 1000);
+            record._inode = i + 1;
+            _journal->setFileRecord(record);
+        }
+        _journal->commit("bench");
+        _subtree = QString("dir%1").arg(rows / 2000);
+
+        QVERIFY(_db.openReadOnly(_journal->databaseFilePath()));
+        SqlQuery pragma(_db);
+        pragma.prepare("PRAGMA case_sensitive_like = ON;");
+        QVERIFY(pragma.exec());
+    }
+
+    void cleanupTestCase() {
+        _db.close();
+        _journal->close();
+    }
+
+    void benchBelowPathLike() {
+        QBENCHMARK {
+            QCOMPARE(countRows("SELECT COUNT(*) FROM metadata WHERE path LIKE(?1||'/%')"), 1000);
+        }
+    }
+
+    void benchBelowPathRange() {
+        QBENCHMARK {
+            QCOMPARE(countRows("SELECT COUNT(*) FROM metadata WHERE path > (?1||'/') AND path < (?1||'0')"), 1000);
+        }
+    }
+
+    void benchAvoidRenamesOnNextSync() {
+        QBENCHMARK {
+            _journal->avoidRenamesOnNextSync(_subtree);
+            _journal->commit("bench");
+        }
+    }
+
+    void benchAvoidReadFromDbOnNextSync() {
+        const QString file = _subtree + "/file1";
+        QBENCHMARK {
+            _journal->avoidReadFromDbOnNextSync(file);
+            _journal->commit("bench");
+        }
+    }
+
+    void benchDeleteSubtree() {
+        QBENCHMARK_ONCE {
+            QVERIFY(_journal->deleteFileRecord(_subtree, true));
+            _journal->commit("bench");
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(BenchJournal)
+#include "benchjournal.moc"
@@ -24,3 +24,26 @@ macro(owncloud_add_test test_class additional_cpp)
     add_definitions(-DOWNCLOUD_BIN_PATH=${CMAKE_BINARY_DIR}/bin)
     add_test(NAME ${OWNCLOUD_TEST_CLASS}Test COMMAND ${OWNCLOUD_TEST_CLASS}Test)
 endmacro()
+
+# Benchmarks are built like the tests, but not run by ctest
+macro(owncloud_add_benchmark benchmark_class additional_cpp)
+    include_directories(${QT_INCLUDES}
+                        "${PROJECT_SOURCE_DIR}/src/gui"
+                        "${PROJECT_SOURCE_DIR}/src/libsync"
+                        "${CMAKE_BINARY_DIR}/src/libsync"
+                        "${CMAKE_CURRENT_BINARY_DIR}"
+                       )
+
+    set(CMAKE_AUTOMOC TRUE)
+    set(OWNCLOUD_BENCHMARK_CLASS ${benchmark_class})
+    string(TOLOWER "${OWNCLOUD_BENCHMARK_CLASS}" OWNCLOUD_BENCHMARK_CLASS_LOWERCASE)
+
+    add_executable(${OWNCLOUD_BENCHMARK_CLASS}Bench benchmarks/bench${OWNCLOUD_BENCHMARK_CLASS_LOWERCASE}.cpp ${additional_cpp})
+    qt5_use_modules(${OWNCLOUD_BENCHMARK_CLASS}Bench Test Sql Xml Network)
+
+    target_link_libraries(${OWNCLOUD_BENCHMARK_CLASS}Bench
+        ${APPLICATION_EXECUTABLE}sync
+        ${QT_QTTEST_LIBRARY}
+        ${QT_QTCORE_LIBRARY}
+    )
+endmacro()
@@ -7,17 +7,27 @@
 #pragma once
 
 #include "account.h"
+#include "compression.h"
 #include "creds/abstractcredentials.h"
 #include "filesystem.h"
 #include "syncengine.h"
 #include "syncjournaldb.h"
+#include "ziparchive.h"
 
+#include <QCryptographicHash>
 #include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QNetworkReply>
 #include <QMap>
+#include <QRegularExpression>
+#include <QUrlQuery>
 #include <QtTest>
 
 static const QUrl sRootUrl("owncloud://somehost/owncloud/remote.php/webdav/");
+// The block size of the block maps the server publishes for delta downloads
+static const qint64 sBlockMapBlockSize = 64 * 1024;
 
 inline QString generateEtag() {
     return QString::number(QDateTime::currentDateTime().toMSecsSinceEpoch(), 16);
@@ -276,7 +286,8 @@ class FakePropfindReply : public QNetworkReply
 public:
     QByteArray payload;
 
-    FakePropfindReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
+    FakePropfindReply(FileInfo &remoteRootFileInfo, const QMap<QString, QByteArray> &blockMaps, bool wantsBlockMap,
+                      QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
     : QNetworkReply{parent} {
         setRequest(request);
         setUrl(request.url());
@@ -314,6 +325,8 @@ public:
             xml.writeTextElement(davUri, QStringLiteral("getetag"), fileInfo.etag);
             xml.writeTextElement(ocUri, QStringLiteral("permissions"), fileInfo.isShared ? QStringLiteral("SRDNVCKW") : QStringLiteral("RDNVCKW"));
             xml.writeTextElement(ocUri, QStringLiteral("id"), fileInfo.fileId);
+            if (wantsBlockMap && !fileInfo.isDir)
+                xml.writeTextElement(ocUri, QStringLiteral("blockmap"), blockMaps.value(fileInfo.path(), blockMap(fileInfo)));
             xml.writeEndElement(); // prop
             xml.writeTextElement(davUri, QStringLiteral("status"), "HTTP/1.1 200 OK");
             xml.writeEndElement(); // propstat
@@ -334,6 +347,18 @@ public:
         QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
     }
 
+    // "<block size>:<sha1>,<sha1>,...", see OCC::parseBlockMap()
+    static QByteArray blockMap(const FileInfo &fileInfo) {
+        QByteArray map = QByteArray::number(sBlockMapBlockSize) + ':';
+        for (qint64 pos = 0; pos < fileInfo.size; pos += sBlockMapBlockSize) {
+            if (pos > 0)
+                map += ',';
+            QByteArray block(qMin(sBlockMapBlockSize, fileInfo.size - pos), fileInfo.contentChar);
+            map += QCryptographicHash::hash(block, QCryptographicHash::Sha1).toHex();
+        }
+        return map;
+    }
+
     Q_INVOKABLE void respond() {
         setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
         setHeader(QNetworkRequest::ContentTypeHeader, "application/xml; charset=utf-8");
@@ -359,9 +384,10 @@ public:
 class FakePutReply : public QNetworkReply
 {
     Q_OBJECT
-    FileInfo *fileInfo;
+    FileInfo *fileInfo = nullptr;
 public:
-    FakePutReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, const QByteArray &putPayload, QObject *parent)
+    FakePutReply(FileInfo &remoteRootFileInfo, QMap<QString, QByteArray> &uploadedChunks, bool rejectChunkReuse,
+                 QNetworkAccessManager::Operation op, const QNetworkRequest &request, const QByteArray &putPayload, QObject *parent)
     : QNetworkReply{parent} {
         setRequest(request);
         setUrl(request.url());
@@ -370,12 +396,34 @@ public:
 
         Q_ASSERT(request.url().path().startsWith(sRootUrl.path()));
         QString fileName = request.url().path().mid(sRootUrl.path().length());
+        QByteArray data = putPayload;
+        if (request.rawHeader("OC-Chunked") == "1") {
+            // <file>-chunking-<transferid>-<count>-<index>. The client sends the
+            // last chunk last, the file is assembled when it arrives.
+            QRegularExpressionMatch match = QRegularExpression("^(.*)-chunking-(\\d+)-(\\d+)-(\\d+)$").match(fileName);
+            Q_ASSERT(match.hasMatch());
+            fileName = match.captured(1);
+            const QString transfer = fileName + '-' + match.captured(2) + '-';
+            const int count = match.captured(3).toInt();
+            const int index = match.captured(4).toInt();
+            uploadedChunks[transfer + QString::number(index)] = putPayload;
+            if (index < count - 1) {
+                QMetaObject::invokeMethod(this, "respondChunkStored", Qt::QueuedConnection);
+                return;
+            }
+            data = assembleChunks(remoteRootFileInfo, uploadedChunks, rejectChunkReuse, fileName, transfer, count);
+            if (data.isNull()) {
+                QMetaObject::invokeMethod(this, "respondBadRequest", Qt::QueuedConnection);
+                return;
+            }
+        }
+
         if ((fileInfo = remoteRootFileInfo.find(fileName))) {
-            fileInfo->size = putPayload.size();
-            fileInfo->contentChar = putPayload.at(0);
+            fileInfo->size = data.size();
+            fileInfo->contentChar = data.at(0);
         } else {
             // Assume that the file is filled with the same character
-            fileInfo = remoteRootFileInfo.create(fileName, putPayload.size(), putPayload.at(0));
+            fileInfo = remoteRootFileInfo.create(fileName, data.size(), data.at(0));
         }
 
         if (!fileInfo) {
@@ -385,6 +433,50 @@ public:
         QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
     }
 
+    // The chunks listed in OC-Chunk-Reuse are copied from the version named in
+    // If-Match, filled with its contentChar like every file of FileInfo.
+    // Returns a null array for a request the server would reject.
+    QByteArray assembleChunks(FileInfo &remoteRootFileInfo, QMap<QString, QByteArray> &uploadedChunks, bool rejectChunkReuse,
+                              const QString &fileName, const QString &transfer, int count) {
+        const QNetworkRequest &req = request();
+        const qint64 chunkSize = req.rawHeader("OC-Chunk-Size").toLongLong();
+        QList<int> reused;
+        foreach (const QByteArray &chunk, req.rawHeader("OC-Chunk-Reuse").split(',')) {
+            if (!chunk.isEmpty())
+                reused.append(chunk.toInt());
+        }
+        const FileInfo *previous = remoteRootFileInfo.find(fileName);
+        if (!reused.isEmpty() && (rejectChunkReuse || !previous
+                || req.rawHeader("If-Match") != '"' + previous->etag.toLatin1() + '"')) {
+            return QByteArray();
+        }
+
+        QByteArray data;
+        for (int i = 0; i < count; ++i) {
+            const QString key = transfer + QString::number(i);
+            if (uploadedChunks.contains(key)) {
+                data += uploadedChunks.take(key);
+            } else if (reused.contains(i)) {
+                data += QByteArray(qBound(qint64(0), previous->size - i * chunkSize, chunkSize), previous->contentChar);
+            } else {
+                return QByteArray();
+            }
+        }
+        if (data.size() != req.rawHeader("OC-Total-Length").toLongLong())
+            return QByteArray();
+
+        // A wrongly assembled file fails the checksum of the whole file
+        const QByteArray checksumHeader = req.rawHeader("OC-Checksum");
+        const int colon = checksumHeader.indexOf(':');
+        const QByteArray checksumType = checksumHeader.left(colon);
+        if (checksumType == "SHA1" || checksumType == "MD5") {
+            const auto algorithm = checksumType == "SHA1" ? QCryptographicHash::Sha1 : QCryptographicHash::Md5;
+            if (QCryptographicHash::hash(data, algorithm).toHex() != checksumHeader.mid(colon + 1))
+                return QByteArray();
+        }
+        return data;
+    }
+
     Q_INVOKABLE void respond() {
         setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
         setRawHeader("ETag", fileInfo->etag.toLatin1());
@@ -394,10 +486,106 @@ public:
         emit finished();
     }
 
+    // A chunk that is not the last one: no etag, the file is not there yet
+    Q_INVOKABLE void respondChunkStored() {
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 201);
+        emit metaDataChanged();
+        emit finished();
+    }
+
+    Q_INVOKABLE void respondBadRequest() {
+        setError(ProtocolInvalidOperationError, QStringLiteral("Bad Request"));
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 400);
+        emit metaDataChanged();
+        emit finished();
+    }
+
     void abort() override { }
     qint64 readData(char *, qint64) override { return 0; }
 };
 
+class FakePostBundleReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    QByteArray payload;
+
+    FakePostBundleReply(FileInfo &remoteRootFileInfo, const QStringList &errorPaths, QNetworkAccessManager::Operation op, const QNetworkRequest &request, const QByteArray &body, QObject *parent)
+    : QNetworkReply{parent} {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+
+        Q_ASSERT(request.url().path().startsWith(sRootUrl.path()));
+        QString dirName = request.url().path().mid(sRootUrl.path().length());
+        QByteArray contentType = request.rawHeader("Content-Type");
+        QByteArray boundary = "--" + contentType.mid(contentType.indexOf("boundary=") + 9);
+
+        QJsonObject results;
+        int pos = body.indexOf(boundary);
+        while (pos >= 0 && body.mid(pos + boundary.size(), 2) == "\r\n") {
+            pos += boundary.size() + 2;
+            QMap<QByteArray, QByteArray> headers;
+            int lineEnd;
+            while ((lineEnd = body.indexOf("\r\n", pos)) > pos) {
+                QByteArray line = body.mid(pos, lineEnd - pos);
+                int colon = line.indexOf(':');
+                headers[line.left(colon).toLower()] = line.mid(colon + 1).trimmed();
+                pos = lineEnd + 2;
+            }
+            pos += 2;
+            int size = headers["content-length"].toInt();
+            QByteArray data = body.mid(pos, size);
+            pos = body.indexOf(boundary, pos + size);
+
+            QString filePath = QUrl::fromPercentEncoding(headers["x-file-path"]);
+            QJsonObject result;
+            if (errorPaths.contains(filePath)) {
+                result["status"] = 500;
+                result["error"] = QStringLiteral("Internal Server Error");
+            } else {
+                // Assume that the file is filled with the same character
+                char contentChar = data.isEmpty() ? 'W' : data.at(0);
+                FileInfo *fileInfo = remoteRootFileInfo.find(dirName + '/' + filePath);
+                if (fileInfo) {
+                    fileInfo->size = data.size();
+                    fileInfo->contentChar = contentChar;
+                } else {
+                    fileInfo = remoteRootFileInfo.create(dirName + '/' + filePath, data.size(), contentChar);
+                }
+                result["status"] = 201;
+                result["etag"] = fileInfo->etag;
+                result["fileid"] = QString::fromLatin1(fileInfo->fileId);
+            }
+            results[filePath] = result;
+        }
+        payload = QJsonDocument(results).toJson();
+
+        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+    }
+
+    Q_INVOKABLE void respond() {
+        setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
+        setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        emit metaDataChanged();
+        if (bytesAvailable())
+            emit readyRead();
+        emit finished();
+    }
+
+    void abort() override { }
+
+    qint64 bytesAvailable() const override { return payload.size() + QIODevice::bytesAvailable(); }
+    qint64 readData(char *data, qint64 maxlen) override {
+        qint64 len = std::min(qint64{payload.size()}, maxlen);
+        strncpy(data, payload.constData(), len);
+        payload.remove(0, len);
+        return len;
+    }
+};
+
 class FakeMkcolReply : public QNetworkReply
 {
     Q_OBJECT
@@ -511,8 +699,23 @@ public:
 
     Q_INVOKABLE void respond() {
         payload.fill(fileInfo->contentChar, fileInfo->size);
+        int status = 200;
+        // "bytes=<first>-" or "bytes=<first>-<last>", a range is never compressed
+        QRegularExpressionMatch range = QRegularExpression("^bytes=(\\d+)-(\\d*)$").match(QString::fromLatin1(request().rawHeader("Range")));
+        if (range.hasMatch()) {
+            const qint64 first = range.captured(1).toLongLong();
+            const qint64 last = range.captured(2).isEmpty() ? fileInfo->size - 1
+                                                            : qMin(range.captured(2).toLongLong(), fileInfo->size - 1);
+            setRawHeader("Content-Range", "bytes " + QByteArray::number(first) + '-' + QByteArray::number(last)
+                         + '/' + QByteArray::number(fileInfo->size));
+            payload = payload.mid(first, last - first + 1);
+            status = 206;
+        } else if (request().rawHeader("Accept-Encoding").contains("gzip")) {
+            payload = OCC::gzipCompress(payload);
+            setRawHeader("Content-Encoding", "gzip");
+        }
         setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
-        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, status);
         setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
         setRawHeader("ETag", fileInfo->etag.toLatin1());
         setRawHeader("OC-FileId", fileInfo->fileId);
@@ -527,7 +730,93 @@ public:
 
     qint64 readData(char *data, qint64 maxlen) override {
         qint64 len = std::min(qint64{payload.size()}, maxlen);
-        strncpy(data, payload.constData(), len);
+        memcpy(data, payload.constData(), len);
+        payload.remove(0, len);
+        return len;
+    }
+};
+
+class FakeArchiveReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    QByteArray payload;
+
+    FakeArchiveReply(FileInfo &remoteRootFileInfo, const QStringList &errorPaths, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
+    : QNetworkReply{parent} {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+
+        QUrlQuery query(request.url());
+        QString dirName = query.queryItemValue(QStringLiteral("dir"), QUrl::FullyDecoded).mid(1);
+        QJsonArray files = QJsonDocument::fromJson(
+            query.queryItemValue(QStringLiteral("files"), QUrl::FullyDecoded).toUtf8()).array();
+
+        // A zip archive with stored and, if zlib is there, deflated entries.
+        // The files in errorPaths are left out.
+        QByteArray centralDir;
+        int entries = 0;
+        for (const QJsonValue &file : files) {
+            QString fileName = file.toString();
+            QString filePath = dirName.isEmpty() ? fileName : dirName + '/' + fileName;
+            FileInfo *fileInfo = remoteRootFileInfo.find(filePath);
+            if (!fileInfo || errorPaths.contains(filePath))
+                continue;
+            QByteArray data;
+            data.fill(fileInfo->contentChar, fileInfo->size);
+            QByteArray stored = data;
+            int method = 0;
+            if (entries % 2 && OCC::transferCompressionSupported()) {
+                // Without its 10 byte header and 8 byte trailer, gzip is raw deflate
+                QByteArray compressed = OCC::gzipCompress(data);
+                stored = compressed.mid(10, compressed.size() - 18);
+                method = 8;
+            }
+            QByteArray name = fileName.toUtf8();
+            QByteArray fields = zipNumber(20, 2) + zipNumber(0, 2) + zipNumber(method, 2)
+                + zipNumber(0, 4) + zipNumber(OCC::ZipArchive::crc32(data), 4)
+                + zipNumber(stored.size(), 4) + zipNumber(data.size(), 4)
+                + zipNumber(name.size(), 2) + zipNumber(0, 2);
+            centralDir += zipNumber(0x02014b50, 4) + zipNumber(20, 2) + fields
+                + zipNumber(0, 2) + zipNumber(0, 2) + zipNumber(0, 2) + zipNumber(0, 4)
+                + zipNumber(payload.size(), 4) + name;
+            payload += zipNumber(0x04034b50, 4) + fields + name + stored;
+            ++entries;
+        }
+        int centralDirOffset = payload.size();
+        payload += centralDir;
+        payload += zipNumber(0x06054b50, 4) + zipNumber(0, 2) + zipNumber(0, 2)
+            + zipNumber(entries, 2) + zipNumber(entries, 2)
+            + zipNumber(centralDir.size(), 4) + zipNumber(centralDirOffset, 4) + zipNumber(0, 2);
+
+        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+    }
+
+    static QByteArray zipNumber(quint32 value, int size) {
+        QByteArray result;
+        for (int i = 0; i < size; ++i)
+            result += char((value >> (8 * i)) & 0xFF);
+        return result;
+    }
+
+    Q_INVOKABLE void respond() {
+        setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
+        setHeader(QNetworkRequest::ContentTypeHeader, "application/zip");
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        emit metaDataChanged();
+        if (bytesAvailable())
+            emit readyRead();
+        emit finished();
+    }
+
+    void abort() override { }
+
+    qint64 bytesAvailable() const override { return payload.size() + QIODevice::bytesAvailable(); }
+    qint64 readData(char *data, qint64 maxlen) override {
+        qint64 len = std::min(qint64{payload.size()}, maxlen);
+        memcpy(data, payload.constData(), len);
         payload.remove(0, len);
         return len;
     }
@@ -560,26 +849,51 @@ class FakeQNAM : public QNetworkAccessManager
 {
     FileInfo _remoteRootFileInfo;
     QStringList _errorPaths;
+    QMap<QString, int> _requestCounts;
+    QList<QNetworkRequest> _requests;
+    QMap<QString, QByteArray> _uploadedChunks;
+    bool _rejectChunkReuse = false;
+    QMap<QString, QByteArray> _blockMaps;
 public:
     FakeQNAM(FileInfo initialRoot) : _remoteRootFileInfo{std::move(initialRoot)} { }
     FileInfo &currentRemoteState() { return _remoteRootFileInfo; }
     QStringList &errorPaths() { return _errorPaths; }
+    // The number of requests by verb
+    QMap<QString, int> &requestCounts() { return _requestCounts; }
+    // All the requests, in the order they were sent
+    QList<QNetworkRequest> &requests() { return _requests; }
+    // The chunks of unfinished chunked uploads, by "<file>-<transferid>-<chunk>"
+    QMap<QString, QByteArray> &uploadedChunks() { return _uploadedChunks; }
+    // Fail the final chunk of uploads that list chunks in OC-Chunk-Reuse
+    void setRejectChunkReuse(bool reject) { _rejectChunkReuse = reject; }
+    // Block maps to publish instead of the ones of the files' contents, by path
+    QMap<QString, QByteArray> &blockMaps() { return _blockMaps; }
 
 protected:
     QNetworkReply *createRequest(Operation op, const QNetworkRequest &request,
                                          QIODevice *outgoingData = 0) {
+        auto verb = request.attribute(QNetworkRequest::CustomVerbAttribute);
+        _requestCounts[verb.toString()]++;
+        _requests.append(request);
+
+        if (verb == QLatin1String("GET") && request.url().path().endsWith(QLatin1String("ajax/download.php")))
+            return new FakeArchiveReply{_remoteRootFileInfo, _errorPaths, op, request, this};
+
         const QString fileName = request.url().path().mid(sRootUrl.path().length());
         if (_errorPaths.contains(fileName))
             return new FakeErrorReply{op, request, this};
 
-        auto verb = request.attribute(QNetworkRequest::CustomVerbAttribute);
         if (verb == QLatin1String("PROPFIND"))
             // Ignore outgoingData always returning somethign good enough, works for now.
-            return new FakePropfindReply{_remoteRootFileInfo, op, request, this};
+            // Only the block map is left out unless it is asked for.
+            return new FakePropfindReply{_remoteRootFileInfo, _blockMaps,
+                                         outgoingData && outgoingData->readAll().contains("blockmap"), op, request, this};
         else if (verb == QLatin1String("GET"))
             return new FakeGetReply{_remoteRootFileInfo, op, request, this};
         else if (verb == QLatin1String("PUT"))
-            return new FakePutReply{_remoteRootFileInfo, op, request, outgoingData->readAll(), this};
+            return new FakePutReply{_remoteRootFileInfo, _uploadedChunks, _rejectChunkReuse, op, request, outgoingData->readAll(), this};
+        else if (verb == QLatin1String("POST"))
+            return new FakePostBundleReply{_remoteRootFileInfo, _errorPaths, op, request, outgoingData->readAll(), this};
         else if (verb == QLatin1String("MKCOL"))
             return new FakeMkcolReply{_remoteRootFileInfo, op, request, this};
         else if (verb == QLatin1String("DELETE"))
@@ -661,6 +975,18 @@ public:
 
     QStringList &serverErrorPaths() { return _fakeQnam->errorPaths(); }
 
+    QMap<QString, int> &serverRequestCounts() { return _fakeQnam->requestCounts(); }
+
+    QList<QNetworkRequest> &serverRequests() { return _fakeQnam->requests(); }
+
+    QMap<QString, QByteArray> &serverUploadedChunks() { return _fakeQnam->uploadedChunks(); }
+
+    void setServerRejectsChunkReuse(bool reject) { _fakeQnam->setRejectChunkReuse(reject); }
+
+    QMap<QString, QByteArray> &serverBlockMaps() { return _fakeQnam->blockMaps(); }
+
+    OCC::AccountPtr account() const { return _account; }
+
     QString localPath() const {
         // SyncEngine wants a trailing slash
         if (_tempDir.path().endsWith('/'))
@@ -145,6 +145,112 @@ using namespace OCC;
         delete vali;
     }
 
+    void testStreamingChecksums() {
+        QFile file(_testfile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QByteArray data = file.readAll();
+
+        QList<QByteArray> types;
+        types << checkSumMD5C << checkSumSHA1C << checkSumAdlerC;
+        QMap<QByteArray, QByteArray> known;
+        foreach (const QByteArray &type, types) {
+            ChecksumCalculator calculator(type);
+            QVERIFY(calculator.isValid());
+            // Feed the data in uneven pieces, like a download would
+            for (int pos = 0; pos < data.size(); pos += 1000) {
+                calculator.addData(data.constData() + pos, qMin(1000, data.size() - pos));
+            }
+            QCOMPARE(calculator.result(), ComputeChecksum::computeNow(_testfile, type));
+            known.insert(type, calculator.result());
+        }
+        QVERIFY(!ChecksumCalculator("Klaas32").isValid());
+
+        // All of them at once, unknown types are left out
+        QCOMPARE(ComputeChecksum::computeNow(_testfile, QList<QByteArray>(types) << "Klaas32"), known);
+
+        // A known checksum is used without reading the file
+        _successDown = false;
+        ValidateChecksumHeader vali;
+        connect(&vali, SIGNAL(validated(QByteArray,QByteArray)), this, SLOT(slotDownValidated()));
+        vali.start(_root + "/doesNotExist", makeChecksumHeader(checkSumSHA1C, known[checkSumSHA1C]), known);
+        QVERIFY(_successDown);
+    }
+
+
+    void testTreeChecksum() {
+        // Three and a half leaves
+        QString bigFile = _root + "/treeFile";
+        QFile file(bigFile);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QByteArray data(ChecksumCalculator::treeLeafSize * 7 / 2, Qt::Uninitialized);
+        for (int i = 0; i < data.size(); ++i) {
+            data[i] = char(qrand());
+        }
+        file.write(data);
+        file.close();
+
+        QByteArray digests;
+        for (qint64 pos = 0; pos < data.size(); pos += ChecksumCalculator::treeLeafSize) {
+            digests += QCryptographicHash::hash(data.mid(pos, ChecksumCalculator::treeLeafSize), QCryptographicHash::Sha1);
+        }
+        QByteArray expected = QCryptographicHash::hash(digests, QCryptographicHash::Sha1).toHex();
+
+        ChecksumCalculator calculator(checkSumSha1TreeC);
+        for (int pos = 0; pos < data.size(); pos += 100000) {
+            calculator.addData(data.constData() + pos, qMin(100000, data.size() - pos));
+        }
+        QCOMPARE(calculator.result(), expected);
+        QCOMPARE(ComputeChecksum::computeNow(bigFile, checkSumSha1TreeC), expected);
+
+        // An empty file has one empty leaf
+        QFile emptyFile(_root + "/emptyFile");
+        QVERIFY(emptyFile.open(QIODevice::WriteOnly));
+        emptyFile.close();
+        expected = QCryptographicHash::hash(QCryptographicHash::hash(QByteArray(), QCryptographicHash::Sha1),
+                                            QCryptographicHash::Sha1).toHex();
+        QCOMPARE(ChecksumCalculator(checkSumSha1TreeC).result(), expected);
+        QCOMPARE(ComputeChecksum::computeNow(emptyFile.fileName(), checkSumSha1TreeC), expected);
+
+        // A file that can't be read has no checksum, not the one of an empty file
+        QVERIFY(ComputeChecksum::computeNow(_root + "/missingFile", checkSumSha1TreeC).isEmpty());
+    }
+
+    void testBlockChecksums() {
+        // Three and a half blocks
+        const qint64 blockSize = 1000;
+        QString blockFile = _root + "/blockFile";
+        QFile file(blockFile);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QByteArray data(blockSize * 7 / 2, Qt::Uninitialized);
+        for (int i = 0; i < data.size(); ++i) {
+            data[i] = char(qrand());
+        }
+        file.write(data);
+        file.close();
+
+        QByteArray expected;
+        QByteArray blockMap = QByteArray::number(blockSize) + ':';
+        for (int pos = 0; pos < data.size(); pos += blockSize) {
+            QByteArray sha1 = QCryptographicHash::hash(data.mid(pos, blockSize), QCryptographicHash::Sha1).toHex();
+            expected += sha1;
+            blockMap += sha1.toUpper() + ',';
+        }
+        blockMap.chop(1);
+        QCOMPARE(expected.size(), 4 * 40);
+        QCOMPARE(ComputeBlockChecksums::computeNow(blockFile, blockSize), expected);
+        QVERIFY(ComputeBlockChecksums::computeNow(_root + "/doesNotExist", blockSize).isEmpty());
+
+        qint64 parsedBlockSize = 0;
+        QByteArray checksums;
+        QVERIFY(parseBlockMap(blockMap, &parsedBlockSize, &checksums));
+        QCOMPARE(parsedBlockSize, blockSize);
+        QCOMPARE(checksums, expected);
+
+        QVERIFY(!parseBlockMap(expected, &parsedBlockSize, &checksums));
+        QVERIFY(!parseBlockMap("0:" + expected.left(40), &parsedBlockSize, &checksums));
+        QVERIFY(!parseBlockMap("1000:" + expected.left(39), &parsedBlockSize, &checksums));
+        QVERIFY(!parseBlockMap("1000:" + expected.left(39) + 'x', &parsedBlockSize, &checksums));
+    }
 
     void cleanupTestCase() {
     }
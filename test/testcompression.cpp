@@ -0,0 +1,146 @@
+/*
+   This software is in the public domain, furnished "as is", without technical
+   support, and with no warranty, express or implied, as to its usefulness for
+   any purpose.
+*/
+
+#include <QtTest>
+
+#include "compression.h"
+#include "ziparchive.h"
+
+using namespace OCC;
+
+class TestCompression : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRoundTrip()
+    {
+        QByteArray data;
+        for (int i = 0; i < 20000; ++i) {
+            data += "line " + QByteArray::number(i) + ";" + QByteArray::number(qrand() % 100) + "\n";
+        }
+
+        QByteArray compressed = gzipCompress(data);
+        if (!transferCompressionSupported()) {
+            QVERIFY(compressed.isEmpty());
+            QVERIFY(!ContentDecoder("gzip").isValid());
+            return;
+        }
+        QVERIFY(!compressed.isEmpty());
+        QVERIFY(compressed.size() < data.size() / 2);
+
+        // Fed in small pieces, like the body of a download arrives
+        ContentDecoder decoder("gzip");
+        QVERIFY(decoder.isValid());
+        QByteArray decoded;
+        for (int pos = 0; pos < compressed.size(); pos += 1000) {
+            QVERIFY(!decoder.atEnd());
+            QVERIFY(decoder.addData(compressed.constData() + pos, qMin(1000, compressed.size() - pos), &decoded));
+        }
+        QVERIFY(decoder.atEnd());
+        QCOMPARE(decoded, data);
+
+        // Cut short
+        ContentDecoder truncated("gzip");
+        decoded.clear();
+        QVERIFY(truncated.addData(compressed.constData(), compressed.size() / 2, &decoded));
+        QVERIFY(!truncated.atEnd());
+
+        QVERIFY(!ContentDecoder("br").isValid());
+        ContentDecoder corrupt("gzip");
+        QVERIFY(!corrupt.addData(data.constData(), 1000, &decoded));
+    }
+
+    void testInflateRaw()
+    {
+        if (!transferCompressionSupported()) {
+            return;
+        }
+        QByteArray data;
+        for (int i = 0; i < 1000; ++i) {
+            data += "entry " + QByteArray::number(i) + "\n";
+        }
+
+        // Without its 10 byte header and 8 byte trailer, gzip is raw deflate
+        QByteArray compressed = gzipCompress(data);
+        QByteArray raw = compressed.mid(10, compressed.size() - 18);
+        QCOMPARE(inflateRaw(raw, data.size()), data);
+        QVERIFY(inflateRaw(raw, data.size() - 1).isNull());
+        QVERIFY(inflateRaw(raw.left(raw.size() / 2), data.size()).isNull());
+    }
+
+    void testZipCrc32()
+    {
+        QCOMPARE(ZipArchive::crc32(QByteArray()), quint32(0));
+        // The check value of CRC-32
+        QCOMPARE(ZipArchive::crc32("123456789"), quint32(0xCBF43926));
+    }
+
+    void testZipArchive()
+    {
+        QByteArray data;
+        for (int i = 0; i < 1000; ++i) {
+            data += "entry " + QByteArray::number(i) + "\n";
+        }
+        QByteArray stored = data;
+        int method = 0;
+        if (transferCompressionSupported()) {
+            QByteArray compressed = gzipCompress(data);
+            stored = compressed.mid(10, compressed.size() - 18);
+            method = 8;
+        }
+
+        auto number = [](quint32 value, int size) {
+            QByteArray result;
+            for (int i = 0; i < size; ++i)
+                result += char((value >> (8 * i)) & 0xFF);
+            return result;
+        };
+        const QByteArray name = "dir/entries.txt";
+        const QByteArray fields = number(20, 2) + number(0, 2) + number(method, 2)
+            + number(0, 4) + number(ZipArchive::crc32(data), 4)
+            + number(stored.size(), 4) + number(data.size(), 4)
+            + number(name.size(), 2) + number(0, 2);
+        QByteArray archive = number(0x04034b50, 4) + fields + name + stored;
+        const QByteArray centralDir = number(0x02014b50, 4) + number(20, 2) + fields
+            + number(0, 2) + number(0, 2) + number(0, 2) + number(0, 4) + number(0, 4) + name;
+        const int centralDirOffset = archive.size();
+        archive += centralDir;
+        archive += number(0x06054b50, 4) + number(0, 2) + number(0, 2) + number(1, 2) + number(1, 2)
+            + number(centralDir.size(), 4) + number(centralDirOffset, 4) + number(0, 2);
+
+        QBuffer buffer(&archive);
+        QVERIFY(buffer.open(QIODevice::ReadOnly));
+        ZipArchive zip(&buffer);
+        QVERIFY(zip.open());
+        QCOMPARE(zip.fileNames(), QStringList("dir/entries.txt"));
+        QCOMPARE(zip.fileSize("dir/entries.txt"), qint64(data.size()));
+        QCOMPARE(zip.read("dir/entries.txt"), data);
+        QVERIFY(zip.read("missing").isNull());
+
+        // A damaged entry fails its CRC-32
+        buffer.close();
+        const int damagedPos = 30 + name.size() + stored.size() / 2;
+        archive[damagedPos] = char(archive.at(damagedPos) ^ 0x01);
+        QVERIFY(buffer.open(QIODevice::ReadOnly));
+        ZipArchive damaged(&buffer);
+        QVERIFY(damaged.open());
+        QVERIFY(damaged.read("dir/entries.txt").isNull());
+    }
+
+    void testCompressibleFile()
+    {
+        QVERIFY(isCompressibleFile("foo/bar.csv"));
+        QVERIFY(isCompressibleFile("server.log"));
+        QVERIFY(isCompressibleFile("README"));
+        QVERIFY(!isCompressibleFile("foo/holiday.JPG"));
+        QVERIFY(!isCompressibleFile("backup.tar.gz"));
+        QVERIFY(!isCompressibleFile("report.docx"));
+    }
+};
+
+QTEST_APPLESS_MAIN(TestCompression)
+#include "testcompression.moc"
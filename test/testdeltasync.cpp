@@ -0,0 +1,196 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+using namespace OCC;
+
+// Small chunks keep the files of these tests small, the fake server's
+// block maps use the same size
+static const qint64 chunkSize = sBlockMapBlockSize;
+
+// Overwrites one chunk sized block of a local file
+static void writeBlock(FakeFolder &fakeFolder, const QString &relativePath, int block, char contentChar, int mtimeOffset)
+{
+    QFile file{fakeFolder.localPath() + relativePath};
+    QVERIFY(file.open(QFile::ReadWrite));
+    QVERIFY(file.seek(block * chunkSize));
+    file.write(QByteArray(chunkSize, contentChar));
+    file.close();
+    // Make sure the mtime differs from the last sync
+    FileSystem::setModTime(file.fileName(), Utility::qDateTimeToTime_t(QDateTime::currentDateTime().addSecs(mtimeOffset)));
+}
+
+// The PUT requests of the chunks of a file, as "<chunk>" or "<chunk> reuses <list>"
+static QStringList chunkPuts(FakeFolder &fakeFolder, const QString &relativePath)
+{
+    QStringList puts;
+    QRegularExpression chunkRe(QRegularExpression::escape(relativePath) + "-chunking-\\d+-\\d+-(\\d+)$");
+    foreach (const QNetworkRequest &request, fakeFolder.serverRequests()) {
+        QRegularExpressionMatch match = chunkRe.match(request.url().path());
+        if (request.attribute(QNetworkRequest::CustomVerbAttribute).toString() != "PUT" || !match.hasMatch())
+            continue;
+        QString put = match.captured(1);
+        if (request.hasRawHeader("OC-Chunk-Reuse"))
+            put += " reuses " + QString::fromLatin1(request.rawHeader("OC-Chunk-Reuse"));
+        puts.append(put);
+    }
+    return puts;
+}
+
+// The Range headers of the GET requests of a file, empty for a whole file
+static QStringList getRanges(FakeFolder &fakeFolder, const QString &relativePath)
+{
+    QStringList ranges;
+    foreach (const QNetworkRequest &request, fakeFolder.serverRequests()) {
+        if (request.attribute(QNetworkRequest::CustomVerbAttribute).toString() == "GET"
+                && request.url().path().endsWith('/' + relativePath))
+            ranges.append(QString::fromLatin1(request.rawHeader("Range")));
+    }
+    return ranges;
+}
+
+static QByteArray blockChecksum(qint64 size, char contentChar)
+{
+    return QCryptographicHash::hash(QByteArray(size, contentChar), QCryptographicHash::Sha1).toHex();
+}
+
+class TestDeltaSync : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase() {
+        // OwncloudPropagator::chunkSize() reads it once
+        qputenv("OWNCLOUD_CHUNK_SIZE", QByteArray::number(chunkSize));
+    }
+
+    void testDeltaDownload() {
+        FakeFolder fakeFolder{FileInfo{}};
+        fakeFolder.account()->setCapabilities({ { "files", QVariantMap{ { "deltaDownload", true } } } });
+        fakeFolder.remoteModifier().insert("big", 4 * chunkSize, 'A');
+        fakeFolder.syncOnce();
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Partial reuse: the four blocks come from the local file, the new byte is fetched
+        fakeFolder.remoteModifier().appendByte("big");
+        fakeFolder.serverRequests().clear();
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)));
+        fakeFolder.syncOnce();
+        QCOMPARE(completeSpy.count(), 1);
+        QCOMPARE(completeSpy[0][0].value<SyncFileItem>()._status, SyncFileItem::Success);
+        QCOMPARE(getRanges(fakeFolder, "big"), QStringList() << "bytes=262144-262144");
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Full reuse: nothing is fetched, the file is still checked against the block map
+        static_cast<FileInfo &>(fakeFolder.remoteModifier()).find("big", true)->size = 3 * chunkSize;
+        fakeFolder.serverRequests().clear();
+        completeSpy.clear();
+        fakeFolder.syncOnce();
+        QCOMPARE(completeSpy.count(), 1);
+        QCOMPARE(completeSpy[0][0].value<SyncFileItem>()._status, SyncFileItem::Success);
+        QCOMPARE(getRanges(fakeFolder, "big"), QStringList());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testDeltaDownloadMismatch() {
+        FakeFolder fakeFolder{FileInfo{}};
+        fakeFolder.account()->setCapabilities({ { "files", QVariantMap{ { "deltaDownload", true } } } });
+        fakeFolder.remoteModifier().insert("big", 4 * chunkSize, 'A');
+        fakeFolder.syncOnce();
+
+        // The block map promises a last block the range reply doesn't have:
+        // the assembled file is thrown away and fetched as a whole.
+        fakeFolder.remoteModifier().appendByte("big");
+        QByteArray map = QByteArray::number(chunkSize) + ':';
+        for (int i = 0; i < 4; ++i)
+            map += blockChecksum(chunkSize, 'A') + ',';
+        map += blockChecksum(1, 'B');
+        fakeFolder.serverBlockMaps()["big"] = map;
+        fakeFolder.serverRequests().clear();
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)));
+        fakeFolder.syncOnce();
+        QCOMPARE(completeSpy.count(), 1);
+        QCOMPARE(completeSpy[0][0].value<SyncFileItem>()._status, SyncFileItem::Success);
+        QCOMPARE(getRanges(fakeFolder, "big"), QStringList() << "bytes=262144-262144" << QString());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testDeltaUpload() {
+        FakeFolder fakeFolder{FileInfo{}};
+        fakeFolder.account()->setCapabilities({
+            { "files", QVariantMap{ { "deltaUpload", true } } },
+            { "checksums", QVariantMap{ { "supportedTypes", QVariantList{ QByteArray("SHA1") } } } } });
+        fakeFolder.localModifier().insert("big", 4 * chunkSize, 'A');
+        fakeFolder.syncOnce();
+        QCOMPARE(chunkPuts(fakeFolder, "big"), QStringList() << "0" << "1" << "2" << "3");
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Only the changed chunk and the final one are sent. The server
+        // checks the OC-Checksum of the file it assembles.
+        writeBlock(fakeFolder, "big", 1, 'B', -10);
+        fakeFolder.serverRequests().clear();
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)));
+        fakeFolder.syncOnce();
+        QCOMPARE(completeSpy.count(), 1);
+        QCOMPARE(completeSpy[0][0].value<SyncFileItem>()._status, SyncFileItem::Success);
+        QCOMPARE(chunkPuts(fakeFolder, "big"), QStringList() << "1" << "3 reuses 0,2");
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testDeltaUploadRejected() {
+        FakeFolder fakeFolder{FileInfo{}};
+        fakeFolder.account()->setCapabilities({
+            { "files", QVariantMap{ { "deltaUpload", true } } },
+            { "checksums", QVariantMap{ { "supportedTypes", QVariantList{ QByteArray("SHA1") } } } } });
+        fakeFolder.localModifier().insert("big", 4 * chunkSize, 'A');
+        fakeFolder.syncOnce();
+
+        // The server can't copy the chunks: all of them are uploaded again
+        fakeFolder.setServerRejectsChunkReuse(true);
+        writeBlock(fakeFolder, "big", 2, 'B', -10);
+        fakeFolder.serverRequests().clear();
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)));
+        fakeFolder.syncOnce();
+        QCOMPARE(completeSpy.count(), 1);
+        QCOMPARE(completeSpy[0][0].value<SyncFileItem>()._status, SyncFileItem::Success);
+        QCOMPARE(chunkPuts(fakeFolder, "big"),
+                 QStringList() << "2" << "3 reuses 0,1" << "0" << "1" << "2" << "3");
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testDeltaUploadResume() {
+        FakeFolder fakeFolder{FileInfo{}};
+        fakeFolder.account()->setCapabilities({
+            { "files", QVariantMap{ { "deltaUpload", true } } },
+            { "checksums", QVariantMap{ { "supportedTypes", QVariantList{ QByteArray("SHA1") } } } } });
+        fakeFolder.localModifier().insert("big", 4 * chunkSize, 'A');
+        fakeFolder.syncOnce();
+
+        // An upload that was interrupted after sending chunk 1 and reusing chunk 0
+        writeBlock(fakeFolder, "big", 1, 'B', -10);
+        SyncJournalDb::UploadInfo info;
+        info._valid = true;
+        info._chunk = 2;
+        info._transferid = 1234;
+        info._modtime = Utility::qDateTimeFromTime_t(FileSystem::getModTime(fakeFolder.localPath() + "big"));
+        fakeFolder.syncEngine().journal()->setUploadInfo("big", info);
+        fakeFolder.serverUploadedChunks()["big-" + QString::number(1234 ^ chunkSize) + "-1"] = QByteArray(chunkSize, 'B');
+
+        // Resuming sends neither of them again, but still reuses chunk 0
+        fakeFolder.serverRequests().clear();
+        fakeFolder.syncOnce();
+        QCOMPARE(chunkPuts(fakeFolder, "big"), QStringList() << "3 reuses 0,2");
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(!fakeFolder.syncEngine().journal()->getUploadInfo("big")._valid);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestDeltaSync)
+#include "testdeltasync.moc"
@@ -85,6 +85,19 @@ private slots:
        QVERIFY(sSum == sum );
     }
 
+    void testUnreadableFile()
+    {
+       QString file( _root+"/missing.bin");
+       bool called = false;
+       QVERIFY(!readFileInBlocks(file, [&called](const char*, qint64) { called = true; }));
+       QVERIFY(!called);
+       QVERIFY(calcMd5(file).isEmpty());
+       QVERIFY(calcSha1(file).isEmpty());
+#ifdef ZLIB_FOUND
+       QVERIFY(calcAdler32(file).isEmpty());
+#endif
+    }
+
 };
 
 QTEST_APPLESS_MAIN(TestFileSystem)
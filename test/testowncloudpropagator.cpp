@@ -7,6 +7,7 @@
 #include <QtTest>
 #include <QDebug>
 
+#include "account.h"
 #include "propagatedownload.h"
 #include "owncloudpropagator_p.h"
 
@@ -15,6 +16,18 @@ namespace OCC {
 QString OWNCLOUDSYNC_EXPORT createDownloadTmpFileName(const QString &previous);
 }
 
+// A job that only accounts for a slot in its lane, it never finishes
+class FakeTransferJob : public PropagateItemJob
+{
+    Q_OBJECT
+    TransferLane _lane;
+public:
+    FakeTransferJob(OwncloudPropagator *propagator, TransferLane lane)
+        : PropagateItemJob(propagator, SyncFileItemPtr(new SyncFileItem)), _lane(lane) {}
+    TransferLane transferLane() Q_DECL_OVERRIDE { return _lane; }
+    void start() Q_DECL_OVERRIDE { }
+};
+
 class TestOwncloudPropagator : public QObject
 {
     Q_OBJECT
@@ -76,7 +89,102 @@ private slots:
             QCOMPARE(parseEtag(test.first), QByteArray(test.second));
         }
     }
+
+    void testTransferLanes()
+    {
+        OwncloudPropagator propagator(Account::create(), QLatin1String("/tmp/"),
+                                      QLatin1String("/remote/"), QLatin1String("/"), 0);
+        QCOMPARE(propagator.transferLaneBudget(PropagatorJob::SmallTransferLane),
+                 propagator.hardMaximumActiveJob());
+
+        // Large and medium files first, then a lot of small ones
+        PropagateDirectory dir(&propagator);
+        QList<FakeTransferJob *> jobs;
+        for (int i = 0; i < 4; ++i) {
+            jobs.append(new FakeTransferJob(&propagator, PropagatorJob::LargeTransferLane));
+            jobs.append(new FakeTransferJob(&propagator, PropagatorJob::MediumTransferLane));
+        }
+        for (int i = 0; i < 20; ++i) {
+            jobs.append(new FakeTransferJob(&propagator, PropagatorJob::SmallTransferLane));
+        }
+        foreach (FakeTransferJob *job, jobs) {
+            dir.append(job);
+        }
+
+        while (dir.scheduleNextJob()) {
+        }
+
+        // The big transfers don't keep the small ones from starting
+        int running[PropagatorJob::TransferLaneCount] = { 0, 0, 0 };
+        foreach (FakeTransferJob *job, jobs) {
+            if (job->_state == PropagatorJob::Running) {
+                running[job->transferLane()]++;
+            }
+        }
+        for (int lane = 0; lane < PropagatorJob::TransferLaneCount; ++lane) {
+            const auto transferLane = PropagatorJob::TransferLane(lane);
+            QCOMPARE(running[lane], propagator.transferLaneBudget(transferLane));
+            QCOMPARE(propagator._runningJobsInLane[lane], running[lane]);
+        }
+    }
+
+    void testGlobalBudgetShare()
+    {
+        AccountPtr account = Account::create();
+        OwncloudPropagator first(account, QLatin1String("/tmp/a/"),
+                                 QLatin1String("/remote/a/"), QLatin1String("/a/"), 0);
+        const int hardMaximum = first.hardMaximumActiveJob();
+        const int global = first.globalMaximumActiveJob();
+        first.start(SyncFileItemVector());
+        QCOMPARE(first.globalBudgetShare(), qMin(global, hardMaximum));
+
+        // Folders syncing at the same time split the budget
+        OwncloudPropagator second(account, QLatin1String("/tmp/b/"),
+                                  QLatin1String("/remote/b/"), QLatin1String("/b/"), 0);
+        second.start(SyncFileItemVector());
+        QCOMPARE(first.globalBudgetShare(), qBound(1, global / 2, hardMaximum));
+        QCOMPARE(second.globalBudgetShare(), first.globalBudgetShare());
+
+        {
+            OwncloudPropagator third(account, QLatin1String("/tmp/c/"),
+                                     QLatin1String("/remote/c/"), QLatin1String("/c/"), 0);
+            third.start(SyncFileItemVector());
+            QCOMPARE(first.globalBudgetShare(), qBound(1, global / 3, hardMaximum));
+        }
+
+        // A finished sync leaves its share to the others
+        QCOMPARE(first.globalBudgetShare(), qBound(1, global / 2, hardMaximum));
+        second.abort();
+        QCOMPARE(first.globalBudgetShare(), qMin(global, hardMaximum));
+    }
+
+    void testTotalLimitModes()
+    {
+        OwncloudPropagator propagator(Account::create(), QLatin1String("/tmp/"),
+                                      QLatin1String("/remote/"), QLatin1String("/"), 0);
+        BandwidthManager &manager = propagator._bandwidthManager;
+
+        // The sync-wide limit alone puts both directions on the token buckets
+        propagator._totalLimit = 100 * 1024;
+        manager.switchingTimerExpired();
+        QVERIFY(manager.usingTotalLimit());
+        QVERIFY(manager.usingUploadTokenBucket());
+        QVERIFY(manager.usingDownloadTokenBucket());
+
+        // Together with an absolute limit
+        propagator._uploadLimit = 50 * 1024;
+        manager.switchingTimerExpired();
+        QVERIFY(manager.usingUploadTokenBucket());
+        QVERIFY(manager.usingDownloadTokenBucket());
+
+        // A relative limit is measured, the sync-wide limit doesn't cap it
+        propagator._uploadLimit = -50;
+        manager.switchingTimerExpired();
+        QVERIFY(manager.usingRelativeUploadLimit());
+        QVERIFY(!manager.usingUploadTokenBucket());
+        QVERIFY(manager.usingDownloadTokenBucket());
+    }
 };
 
-QTEST_APPLESS_MAIN(TestOwncloudPropagator)
+QTEST_GUILESS_MAIN(TestOwncloudPropagator)
 #include "testowncloudpropagator.moc"
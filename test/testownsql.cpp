@@ -145,6 +145,34 @@ private slots:
         }
     }
 
+    void testLockWait() {
+        SqlDatabase other;
+        QVERIFY(other.openOrCreateReadWrite(testdbC));
+        other.setBusyTimeout(100);
+        const SqlDatabase::LockWaitStats before = SqlDatabase::lockWaitStats();
+
+        // The first connection holds the write lock
+        QVERIFY(_db.transaction());
+        SqlQuery insert(_db);
+        insert.prepare("INSERT INTO addresses (id, name, address, entered) VALUES (10, 'a', 'b', 1);");
+        QVERIFY(insert.exec());
+
+        SqlQuery blocked(other);
+        blocked.prepare("INSERT INTO addresses (id, name, address, entered) VALUES (11, 'c', 'd', 2);");
+        QVERIFY(!blocked.exec());
+        QCOMPARE(blocked.errorId(), SQLITE_BUSY);
+
+        const SqlDatabase::LockWaitStats after = SqlDatabase::lockWaitStats();
+        QCOMPARE(after._waits, before._waits + 1);
+        QCOMPARE(after._timeouts, before._timeouts + 1);
+        QVERIFY(after._waitMsecs - before._waitMsecs >= 90);
+        QVERIFY(after._maxWaitMsecs >= 90);
+
+        QVERIFY(_db.commit());
+        blocked.reset_and_clear_bindings();
+        QVERIFY(blocked.exec());
+    }
+
 private:
     SqlDatabase _db;
 };
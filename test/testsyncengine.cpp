@@ -8,6 +8,7 @@
 #include <QtTest>
 #include "syncenginetestutils.h"
 #include <syncengine.h>
+#include <syncjournalfilerecord.h>
 
 using namespace OCC;
 
@@ -98,6 +99,186 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    void testManyFilesInDirectory() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)));
+        fakeFolder.localModifier().mkdir("W");
+        for (int i = 0; i < 500; ++i) {
+            fakeFolder.localModifier().insert(QString("W/w%1").arg(i));
+            fakeFolder.remoteModifier().insert(QString("A/d%1").arg(i));
+        }
+        // A rename is a barrier for the directories scheduled after it
+        fakeFolder.remoteModifier().rename("B/b1", "B/b3");
+        fakeFolder.syncOnce();
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "W/w0"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "W/w499"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/d499"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "B/b3"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testPrioritize() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        for (int i = 0; i < 100; ++i) {
+            fakeFolder.remoteModifier().insert(QString("A/p%1").arg(i, 3, 10, QLatin1Char('0')));
+        }
+        QStringList completed;
+        QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted,
+            [&](const SyncFileItem &item, const PropagatorJob &) {
+                if (completed.isEmpty()) {
+                    QVERIFY(fakeFolder.syncEngine().prioritize("A/p099"));
+                }
+                completed.append(item._file);
+            });
+        fakeFolder.syncOnce();
+        QVERIFY(completed.indexOf("A/p099") >= 0);
+        QVERIFY(completed.indexOf("A/p099") < 10);
+        // Nothing is left to propagate
+        QVERIFY(!fakeFolder.syncEngine().prioritize("A/p099"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Small new files are downloaded in archives of 100, more of them
+        // than can run at once: the archive with the file goes first
+        FakeFolder archiveFolder{FileInfo::A12_B12_C12_S12()};
+        archiveFolder.account()->setCapabilities({ { "files", QVariantMap{ { "archiveDownload", true } } } });
+        for (int i = 0; i < 1000; ++i) {
+            archiveFolder.remoteModifier().insert(QString("A/p%1").arg(i, 3, 10, QLatin1Char('0')));
+        }
+        completed.clear();
+        QObject::connect(&archiveFolder.syncEngine(), &SyncEngine::itemCompleted,
+            [&](const SyncFileItem &item, const PropagatorJob &) {
+                if (completed.isEmpty()) {
+                    QVERIFY(archiveFolder.syncEngine().prioritize("A/p999"));
+                }
+                completed.append(item._file);
+            });
+        archiveFolder.serverRequestCounts().clear();
+        archiveFolder.syncOnce();
+        QCOMPARE(archiveFolder.serverRequestCounts().value("GET"), 10);
+        QVERIFY(completed.indexOf("A/p999") >= 0);
+        // Before the first archive that was waiting
+        QVERIFY(completed.indexOf("A/p999") < completed.indexOf("A/p600"));
+        QCOMPARE(archiveFolder.currentLocalState(), archiveFolder.currentRemoteState());
+    }
+
+    void testBundledUpload() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.account()->setCapabilities({ { "files", QVariantMap{ { "bundledUploads", true } } } });
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)));
+        for (int i = 0; i < 10; ++i) {
+            fakeFolder.localModifier().insert(QString("A/n%1").arg(i));
+        }
+        // Too big for a bundle
+        fakeFolder.localModifier().insert("A/big", 200 * 1024);
+        // Refused in the bundle, and then on its own
+        fakeFolder.serverErrorPaths().append("A/n3");
+        fakeFolder.serverRequestCounts().clear();
+        fakeFolder.syncOnce();
+
+        QCOMPARE(fakeFolder.serverRequestCounts().value("POST"), 1);
+        QCOMPARE(fakeFolder.serverRequestCounts().value("PUT"), 2);
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/n0"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/n9"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/big"));
+        QVERIFY(itemDidComplete(completeSpy, "A/n3"));
+        QVERIFY(!itemDidCompleteSuccessfully(completeSpy, "A/n3"));
+
+        // The bundled files are in the journal like any other upload
+        SyncJournalFileRecord record = fakeFolder.syncEngine().journal()->getFileRecord("A/n0");
+        QVERIFY(record.isValid());
+        QCOMPARE(QString::fromUtf8(record._etag), fakeFolder.currentRemoteState().find("A/n0")->etag);
+
+        auto remoteState = fakeFolder.currentRemoteState();
+        QVERIFY(!remoteState.find("A/n3"));
+        auto localState = fakeFolder.currentLocalState();
+        localState.remove("A/n3");
+        QCOMPARE(localState, remoteState);
+    }
+
+    void testDownloadArchive() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.account()->setCapabilities({ { "files", QVariantMap{ { "archiveDownload", true } } } });
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)));
+        for (int i = 0; i < 10; ++i) {
+            fakeFolder.remoteModifier().insert(QString("A/n%1").arg(i), 64 + i, 'a' + i);
+        }
+        // Too big for an archive
+        fakeFolder.remoteModifier().insert("A/big", 200 * 1024);
+        // Missing from the archive, and then failing on its own
+        fakeFolder.serverErrorPaths().append("A/n3");
+        fakeFolder.serverRequestCounts().clear();
+        fakeFolder.syncOnce();
+
+        // The archive, A/big and A/n3
+        QCOMPARE(fakeFolder.serverRequestCounts().value("GET"), 3);
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/n0"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/n9"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/big"));
+        QVERIFY(itemDidComplete(completeSpy, "A/n3"));
+        QVERIFY(!itemDidCompleteSuccessfully(completeSpy, "A/n3"));
+
+        // The archived files are in the journal like any other download
+        SyncJournalFileRecord record = fakeFolder.syncEngine().journal()->getFileRecord("A/n0");
+        QVERIFY(record.isValid());
+        QCOMPARE(QString::fromUtf8(record._etag), fakeFolder.currentRemoteState().find("A/n0")->etag);
+
+        auto localState = fakeFolder.currentLocalState();
+        QVERIFY(!localState.find("A/n3"));
+        auto remoteState = fakeFolder.currentRemoteState();
+        remoteState.remove("A/n3");
+        QCOMPARE(localState, remoteState);
+    }
+
+    void testCompressedDownload() {
+        if (!transferCompressionSupported()) {
+            QSKIP("Built without zlib");
+        }
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)));
+        fakeFolder.remoteModifier().insert("A/text.txt", 300 * 1024, 't');
+        // Already compressed, not worth it
+        fakeFolder.remoteModifier().insert("A/image.jpg", 300 * 1024, 'j');
+        fakeFolder.serverRequests().clear();
+        fakeFolder.syncOnce();
+
+        QStringList compressed;
+        foreach (const QNetworkRequest &request, fakeFolder.serverRequests()) {
+            if (request.rawHeader("Accept-Encoding").contains("gzip")) {
+                compressed.append(request.url().path().mid(sRootUrl.path().length()));
+            }
+        }
+        QCOMPARE(compressed, QStringList("A/text.txt"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/text.txt"));
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/image.jpg"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testUploadChecksums() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        // The transmission checksum can't reuse the SHA1 content checksum
+        fakeFolder.account()->setCapabilities({ { "checksums", QVariantMap{
+            { "supportedTypes", QVariantList{ QByteArray("MD5") } } } } });
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)));
+        const QByteArray content(3 * 1024 * 1024, 'C');
+        fakeFolder.localModifier().insert("A/checksummed", content.size(), 'C');
+        fakeFolder.serverRequests().clear();
+        fakeFolder.syncOnce();
+        QVERIFY(itemDidCompleteSuccessfully(completeSpy, "A/checksummed"));
+
+        // Both were computed from the data that was uploaded
+        QByteArray sentChecksum;
+        foreach (const QNetworkRequest &request, fakeFolder.serverRequests()) {
+            if (request.url().path().endsWith("A/checksummed")) {
+                sentChecksum = request.rawHeader("OC-Checksum");
+            }
+        }
+        QCOMPARE(sentChecksum, "MD5:" + QCryptographicHash::hash(content, QCryptographicHash::Md5).toHex());
+        SyncJournalFileRecord record = fakeFolder.syncEngine().journal()->getFileRecord("A/checksummed");
+        QCOMPARE(record._contentChecksumType, QByteArray("SHA1"));
+        QCOMPARE(record._contentChecksum, QCryptographicHash::hash(content, QCryptographicHash::Sha1).toHex());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
     void testEmlLocalChecksum() {
         FakeFolder fakeFolder{FileInfo{}};
         fakeFolder.localModifier().insert("a1.eml", 64, 'A');
@@ -121,6 +302,47 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    void testMovedFolderKeepsRecords() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        SyncJournalDb *journal = fakeFolder.syncEngine().journal();
+        const QByteArray a1Etag = journal->getFileRecord("A/a1")._etag;
+        const QByteArray a2Etag = journal->getFileRecord("A/a2")._etag;
+        QVERIFY(!a1Etag.isEmpty());
+
+        // Moved locally, the server gets a MOVE
+        fakeFolder.localModifier().rename("A", "M");
+        fakeFolder.serverRequestCounts().clear();
+        fakeFolder.syncOnce();
+        QCOMPARE(fakeFolder.serverRequestCounts().value("MOVE"), 1);
+        QCOMPARE(fakeFolder.serverRequestCounts().value("PUT"), 0);
+        QCOMPARE(fakeFolder.serverRequestCounts().value("GET"), 0);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // The records of the children moved along
+        QVERIFY(!journal->getFileRecord("A/a1").isValid());
+        QCOMPARE(journal->getFileRecord("M/a1")._etag, a1Etag);
+        QCOMPARE(journal->getFileRecord("M/a2")._etag, a2Etag);
+
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItem &, const PropagatorJob &)));
+        fakeFolder.syncOnce(); // This sync should do nothing
+        QCOMPARE(completeSpy.count(), 0);
+
+        // Moved on the server, renamed locally
+        fakeFolder.remoteModifier().rename("M", "R");
+        fakeFolder.serverRequestCounts().clear();
+        fakeFolder.syncOnce();
+        QCOMPARE(fakeFolder.serverRequestCounts().value("GET"), 0);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(!journal->getFileRecord("M/a1").isValid());
+        QCOMPARE(journal->getFileRecord("R/a1")._etag, a1Etag);
+        QCOMPARE(journal->getFileRecord("R/a2")._etag, a2Etag);
+
+        completeSpy.clear();
+        fakeFolder.syncOnce();
+        QCOMPARE(completeSpy.count(), 0);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
     void testRemoteChangeInMovedFolder() {
         // issue #5192
         FakeFolder fakeFolder{FileInfo{ QString(), {
@@ -213,6 +435,36 @@ private slots:
         }
     }
 
+    void testParallelSyncs() {
+        // FolderMan runs the syncs of several folders at the same time
+        FakeFolder fakeFolderA{FileInfo::A12_B12_C12_S12()};
+        FakeFolder fakeFolderB{FileInfo::A12_B12_C12_S12()};
+        fakeFolderA.remoteModifier().insert("A/a0");
+        fakeFolderB.localModifier().insert("B/b0");
+        QSignalSpy finishedA(&fakeFolderA.syncEngine(), SIGNAL(finished(bool)));
+        QSignalSpy finishedB(&fakeFolderB.syncEngine(), SIGNAL(finished(bool)));
+
+        QCOMPARE(SyncEngine::runningSyncCount(), 0);
+        fakeFolderA.syncEngine().startSync();
+        fakeFolderB.syncEngine().startSync();
+        QCOMPARE(SyncEngine::runningSyncCount(), 2);
+
+        // The first one to finish must not count the other one as done
+        QVERIFY(finishedA.wait() || finishedB.count() == 1);
+        QCOMPARE(SyncEngine::runningSyncCount(), 2 - finishedA.count() - finishedB.count());
+        if (finishedA.isEmpty())
+            QVERIFY(finishedA.wait());
+        if (finishedB.isEmpty())
+            QVERIFY(finishedB.wait());
+        QCOMPARE(SyncEngine::runningSyncCount(), 0);
+        QCOMPARE(finishedA[0][0].toBool(), true);
+        QCOMPARE(finishedB[0][0].toBool(), true);
+
+        QCOMPARE(fakeFolderA.currentLocalState(), fakeFolderA.currentRemoteState());
+        QCOMPARE(fakeFolderB.currentLocalState(), fakeFolderB.currentRemoteState());
+        QVERIFY(fakeFolderA.currentLocalState().find("A/a0"));
+        QVERIFY(fakeFolderB.currentRemoteState().find("B/b0"));
+    }
 };
 
 QTEST_GUILESS_MAIN(TestSyncEngine)
@@ -8,6 +8,7 @@
 
 #include <sqlite3.h>
 
+#include "libsync/ownsql.h"
 #include "libsync/syncjournaldb.h"
 #include "libsync/syncjournalfilerecord.h"
 
@@ -167,6 +168,332 @@ private slots:
         QVERIFY(!wipedRecord._valid);
     }
 
+    void testBlockSignatures()
+    {
+        typedef SyncJournalDb::BlockSignatures Info;
+        Info record = _db.getBlockSignatures("nonexistant");
+        QVERIFY(!record._valid);
+
+        record._etag = "ABCDEF";
+        record._blockSize = 10 * 1024 * 1024;
+        record._checksums = QByteArray(40, 'a') + QByteArray(40, 'b');
+        record._valid = true;
+        _db.setBlockSignatures("foo", record);
+
+        Info storedRecord = _db.getBlockSignatures("foo");
+        QVERIFY(storedRecord == record);
+        QCOMPARE(storedRecord.blockCount(), 2);
+        QCOMPARE(storedRecord.blockChecksum(1), QByteArray(40, 'b'));
+        QVERIFY(storedRecord.blockChecksum(2).isEmpty());
+
+        _db.setBlockSignatures("foo", Info());
+        Info wipedRecord = _db.getBlockSignatures("foo");
+        QVERIFY(!wipedRecord._valid);
+    }
+
+    void testLocalChecksumCache()
+    {
+        const qint64 modtime = Utility::qDateTimeToTime_t(QDateTime::currentDateTime().addDays(-1));
+        QVERIFY(_db.getCachedLocalChecksum(4321, 100, modtime, "SHA1").isEmpty());
+
+        QVERIFY(_db.setCachedLocalChecksum(4321, 100, modtime, "SHA1", "sha1checksum"));
+        QVERIFY(_db.setCachedLocalChecksum(4321, 100, modtime, "MD5", "md5checksum"));
+        QCOMPARE(_db.getCachedLocalChecksum(4321, 100, modtime, "SHA1"), QByteArray("sha1checksum"));
+        QCOMPARE(_db.getCachedLocalChecksum(4321, 100, modtime, "MD5"), QByteArray("md5checksum"));
+
+        // Any change of the stat tuple is a miss
+        QVERIFY(_db.getCachedLocalChecksum(4321, 101, modtime, "SHA1").isEmpty());
+        QVERIFY(_db.getCachedLocalChecksum(4321, 100, modtime + 1, "SHA1").isEmpty());
+        QVERIFY(_db.getCachedLocalChecksum(4322, 100, modtime, "SHA1").isEmpty());
+
+        // New content replaces the old entry
+        QVERIFY(_db.setCachedLocalChecksum(4321, 200, modtime + 1, "SHA1", "newchecksum"));
+        QVERIFY(_db.getCachedLocalChecksum(4321, 100, modtime, "SHA1").isEmpty());
+        QCOMPARE(_db.getCachedLocalChecksum(4321, 200, modtime + 1, "SHA1"), QByteArray("newchecksum"));
+
+        // Files that were just modified are not cached
+        const qint64 now = Utility::qDateTimeToTime_t(QDateTime::currentDateTime());
+        QVERIFY(!_db.setCachedLocalChecksum(4323, 100, now, "SHA1", "sha1checksum"));
+        QVERIFY(_db.getCachedLocalChecksum(4323, 100, now, "SHA1").isEmpty());
+
+        // Journal files without an up to date cache entry
+        SyncJournalFileRecord record;
+        record._path = "foo-cached";
+        record._inode = 4321;
+        record._modtime = Utility::qDateTimeFromTime_t(modtime + 1);
+        record._fileSize = 200;
+        record._type = 0; // file
+        QVERIFY(_db.setFileRecord(record));
+        record._path = "foo-uncached";
+        record._inode = 4324;
+        QVERIFY(_db.setFileRecord(record));
+        QStringList uncached = _db.getFilesWithoutCachedLocalChecksum("SHA1");
+        QVERIFY(uncached.contains("foo-uncached"));
+        QVERIFY(!uncached.contains("foo-cached"));
+        QVERIFY(_db.getFilesWithoutCachedLocalChecksum("MD5").contains("foo-cached"));
+
+        // In batches, sorted by path
+        QStringList batch = _db.getFilesWithoutCachedLocalChecksum("MD5", QString(), 1);
+        QCOMPARE(batch.count(), 1);
+        QStringList next = _db.getFilesWithoutCachedLocalChecksum("MD5", batch.last(), 1);
+        QCOMPARE(next.count(), 1);
+        QVERIFY(next.last() > batch.last());
+    }
+
+    void testWriter()
+    {
+        typedef SyncJournalDb::DownloadInfo Info;
+        Info info;
+        info._etag = "ABCDEF";
+        info._tmpfile = "/tmp/foo-writer";
+        info._valid = true;
+        _db.setDownloadInfo("foo-writer", info);
+        _db.commit("test");
+
+        _db.startWriter();
+        SyncJournalFileRecord record;
+        record._path = "foo-writer";
+        record._inode = 5678;
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        record._etag = "writer1";
+        record._fileId = "abcd";
+        QVERIFY(_db.setFileRecord(record));
+        record._etag = "writer2";
+        QVERIFY(_db.setFileRecord(record));
+        _db.setDownloadInfo("foo-writer", Info());
+
+        // Queued writes are seen right away
+        QVERIFY(_db.getFileRecord("foo-writer") == record);
+        QVERIFY(!_db.getDownloadInfo("foo-writer")._valid);
+
+        // And by another connection once they are committed
+        QVERIFY(_db.flush());
+        SyncJournalDb other(testdbC);
+        QVERIFY(other.getFileRecord("foo-writer") == record);
+        QVERIFY(!other.getDownloadInfo("foo-writer")._valid);
+        other.close();
+
+        // A new info is not removed by a queued removal
+        _db.setDownloadInfo("foo-writer", Info());
+        _db.setDownloadInfo("foo-writer", info);
+        QVERIFY(_db.stopWriter());
+        QVERIFY(_db.getDownloadInfo("foo-writer") == info);
+        QVERIFY(_db.getFileRecord("foo-writer") == record);
+
+        // Not queued anymore
+        _db.setDownloadInfo("foo-writer", Info());
+        QVERIFY(_db.deleteFileRecord("foo-writer"));
+        QVERIFY(!_db.getFileRecord("foo-writer").isValid());
+    }
+
+    void testSyncGeneration()
+    {
+        SyncJournalFileRecord record;
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        foreach (const QString& path, QStringList() << "gen-seen" << "gen-gone" << "gen-dir" << "gen-dir/sub" << "gen-dirX") {
+            record._path = path;
+            QVERIFY(_db.setFileRecord(record));
+        }
+
+        _db.startSyncGeneration();
+        _db.markSeen("gen-seen");
+        _db.markSeen("gen-seen");
+        record._path = "gen-new";
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.postSyncCleanup(QSet<QString>() << "gen-dir"));
+
+        QVERIFY(_db.getFileRecord("gen-seen").isValid());
+        QVERIFY(_db.getFileRecord("gen-new").isValid());
+        QVERIFY(_db.getFileRecord("gen-dir").isValid());
+        QVERIFY(_db.getFileRecord("gen-dir/sub").isValid());
+        QVERIFY(!_db.getFileRecord("gen-dirX").isValid());
+        QVERIFY(!_db.getFileRecord("gen-gone").isValid());
+
+        // Only what is marked again survives the next sync
+        _db.startSyncGeneration();
+        _db.markSeen("gen-new");
+        QVERIFY(_db.postSyncCleanup(QSet<QString>()));
+        QVERIFY(_db.getFileRecord("gen-new").isValid());
+        QVERIFY(!_db.getFileRecord("gen-seen").isValid());
+        QVERIFY(!_db.getFileRecord("gen-dir/sub").isValid());
+    }
+
+    void testSubtree()
+    {
+        SyncJournalFileRecord record;
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        record._fileId = "id";
+        record._inode = 42;
+        foreach (const QString& path, QStringList() << "sub" << "sub/a" << "sub/a/b" << "sub-x" << "sub0" << "subx/a") {
+            record._path = path;
+            record._type = path.count('/') < 2 ? 2 : 0; // directories, and sub/a/b a file
+            record._etag = "etag";
+            QVERIFY(_db.setFileRecord(record));
+        }
+
+        _db.avoidReadFromDbOnNextSync("sub/a/b");
+        QCOMPARE(_db.getFileRecord("sub")._etag, QByteArray("_invalid_"));
+        QCOMPARE(_db.getFileRecord("sub/a")._etag, QByteArray("_invalid_"));
+        QCOMPARE(_db.getFileRecord("sub/a/b")._etag, QByteArray("etag"));
+        QCOMPARE(_db.getFileRecord("sub-x")._etag, QByteArray("etag"));
+
+        _db.avoidRenamesOnNextSync("sub");
+        QVERIFY(_db.getFileRecord("sub")._fileId.isEmpty());
+        QCOMPARE(_db.getFileRecord("sub/a/b")._inode, quint64(0));
+        QCOMPARE(_db.getFileRecord("sub-x")._fileId, QByteArray("id"));
+        QCOMPARE(_db.getFileRecord("sub0")._inode, quint64(42));
+
+        QVERIFY(_db.deleteFileRecord("sub", true));
+        QVERIFY(!_db.getFileRecord("sub").isValid());
+        QVERIFY(!_db.getFileRecord("sub/a").isValid());
+        QVERIFY(!_db.getFileRecord("sub/a/b").isValid());
+        QVERIFY(_db.getFileRecord("sub-x").isValid());
+        QVERIFY(_db.getFileRecord("sub0").isValid());
+        QVERIFY(_db.getFileRecord("subx/a").isValid());
+    }
+
+    void testRenameFileRecords()
+    {
+        SyncJournalFileRecord record;
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        record._remotePerm = "RDNVCK";
+        foreach (const QString& path, QStringList() << "mv" << "mv/a" << "mv/a/b" << "mv-x" << "moved/mv2/a") {
+            record._path = path;
+            record._fileId = path.toUtf8();
+            QVERIFY(_db.setFileRecord(record));
+        }
+        const int count = _db.getFileRecordCount();
+
+        QVERIFY(_db.renameFileRecords("mv", "moved/mv2"));
+        QVERIFY(!_db.getFileRecord("mv").isValid());
+        QVERIFY(!_db.getFileRecord("mv/a/b").isValid());
+        QCOMPARE(_db.getFileRecord("moved/mv2")._fileId, QByteArray("mv"));
+        QCOMPARE(_db.getFileRecord("moved/mv2/a/b")._path, QString("moved/mv2/a/b"));
+        QCOMPARE(_db.getFileRecord("moved/mv2/a/b")._fileId, QByteArray("mv/a/b"));
+        QCOMPARE(_db.getFileRecord("moved/mv2/a/b")._remotePerm, QByteArray("RDNVCK"));
+        // The record that was in the way is replaced
+        QCOMPARE(_db.getFileRecord("moved/mv2/a")._fileId, QByteArray("mv/a"));
+        QCOMPARE(_db.getFileRecord("mv-x")._fileId, QByteArray("mv-x"));
+        QCOMPARE(_db.getFileRecordCount(), count - 1);
+    }
+
+    void testReadOnlyRecord()
+    {
+        SyncJournalFileRecord record;
+        record._path = "readonly";
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        record._etag = "ro1";
+        record._fileId = "roid";
+        QVERIFY(_db.setFileRecord(record));
+        _db.commit("test");
+        QVERIFY(_db.getFileRecordReadOnly("readonly") == record);
+
+        // Not committed yet: the reader has the committed record
+        SyncJournalFileRecord changed = record;
+        changed._etag = "ro2";
+        QVERIFY(_db.setFileRecord(changed));
+        QCOMPARE(_db.getFileRecordReadOnly("readonly")._etag, QByteArray("ro1"));
+        QCOMPARE(_db.getFileRecord("readonly")._etag, QByteArray("ro2"));
+        _db.commit("test");
+        QCOMPARE(_db.getFileRecordReadOnly("readonly")._etag, QByteArray("ro2"));
+
+        QVERIFY(!_db.getFileRecordReadOnly("nonexistant").isValid());
+    }
+
+    void testSyncInfoCache()
+    {
+        SyncJournalDb::DownloadInfo download;
+        download._tmpfile = "cached.~tmp";
+        download._etag = "cachedetag";
+        download._errorCount = 1;
+        download._valid = true;
+        _db.setDownloadInfo("cached/download", download);
+        SyncJournalDb::UploadInfo upload;
+        upload._chunk = 3;
+        upload._transferid = 42;
+        upload._size = 1000;
+        upload._modtime = dropMsecs(QDateTime::currentDateTime());
+        upload._valid = true;
+        _db.setUploadInfo("cached/upload", upload);
+        SyncJournalErrorBlacklistRecord blacklisted;
+        blacklisted._file = "cached/Blacklisted";
+        blacklisted._errorString = "error";
+        blacklisted._retryCount = 2;
+        blacklisted._lastTryEtag = "etag";
+        blacklisted._lastTryTime = 1000;
+        blacklisted._ignoreDuration = 60;
+        _db.updateErrorBlacklistEntry(blacklisted);
+
+        _db.loadSyncInfoCache();
+        QVERIFY(_db.getDownloadInfo("cached/download") == download);
+        QVERIFY(_db.getUploadInfo("cached/upload") == upload);
+        QVERIFY(!_db.getUploadInfo("cached/download")._valid);
+        QVERIFY(_db.errorBlacklistEntry("cached/Blacklisted").isValid());
+        QCOMPARE(_db.errorBlacklistEntry("cached/Blacklisted")._errorString, QString("error"));
+        QCOMPARE(_db.errorBlacklistEntry("cached/Blacklisted")._retryCount, 2);
+        QVERIFY(!_db.errorBlacklistEntry("cached/other").isValid());
+        const int blacklistCount = _db.errorBlackListEntryCount();
+
+        // The setters write through
+        upload._chunk = 4;
+        _db.setUploadInfo("cached/upload", upload);
+        QCOMPARE(_db.getUploadInfo("cached/upload")._chunk, 4);
+        _db.setDownloadInfo("cached/download", SyncJournalDb::DownloadInfo());
+        QVERIFY(!_db.getDownloadInfo("cached/download")._valid);
+        blacklisted._retryCount = 3;
+        _db.updateErrorBlacklistEntry(blacklisted);
+        QCOMPARE(_db.errorBlacklistEntry("cached/Blacklisted")._retryCount, 3);
+        QCOMPARE(_db.errorBlackListEntryCount(), blacklistCount);
+
+        QVERIFY(_db.deleteStaleUploadInfos(QSet<QString>()));
+        QVERIFY(!_db.getUploadInfo("cached/upload")._valid);
+        QVERIFY(_db.deleteStaleErrorBlacklistEntries(QSet<QString>()));
+        QVERIFY(!_db.errorBlacklistEntry("cached/Blacklisted").isValid());
+
+        // Without the cache, the database says the same
+        _db.close();
+        QVERIFY(!_db.getDownloadInfo("cached/download")._valid);
+        QVERIFY(!_db.getUploadInfo("cached/upload")._valid);
+        QVERIFY(!_db.errorBlacklistEntry("cached/Blacklisted").isValid());
+        QCOMPARE(_db.errorBlackListEntryCount(), 0);
+    }
+
+    void testBulkLoad()
+    {
+        SqlDatabase db;
+        QVERIFY(db.openReadOnly(_db.databaseFilePath(), false));
+        SqlQuery indexes(db);
+        indexes.prepare("SELECT COUNT(*) FROM sqlite_master WHERE type='index' AND tbl_name='metadata'"
+                        " AND name IN ('metadata_file_id', 'metadata_inode', 'metadata_path', 'metadata_generation');");
+        QVERIFY(indexes.next());
+        QCOMPARE(indexes.intValue(0), 4);
+        indexes.reset_and_clear_bindings();
+
+        _db.beginBulkLoad();
+        QVERIFY(indexes.next());
+        QCOMPARE(indexes.intValue(0), 0);
+        indexes.reset_and_clear_bindings();
+
+        SyncJournalFileRecord record;
+        record._path = "bulk/file";
+        record._modtime = dropMsecs(QDateTime::currentDateTime());
+        record._inode = 1234;
+        record._fileId = "bulkid";
+        QVERIFY(_db.setFileRecord(record));
+        QVERIFY(_db.getFileRecord("bulk/file") == record);
+
+        _db.endBulkLoad();
+        QVERIFY(indexes.next());
+        QCOMPARE(indexes.intValue(0), 4);
+        indexes.finish();
+        QVERIFY(_db.getFileRecord("bulk/file") == record);
+
+        SqlQuery stats(db);
+        stats.prepare("SELECT COUNT(*) FROM sqlite_stat1 WHERE tbl='metadata';");
+        QVERIFY(stats.next());
+        QVERIFY(stats.intValue(0) > 0);
+    }
+
 private:
     SyncJournalDb _db;
 };